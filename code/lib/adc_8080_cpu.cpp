@@ -26,150 +26,650 @@
 
 #include <assert.h>   // For assert
 #include <inttypes.h> // For PRIu8, PRIu16, etc
+#include <stddef.h>   // For offsetof
+#include <stdlib.h>   // For calloc, malloc, free, qsort
+#include <string.h>   // For memcpy, memmove, memset
+
+#if ADC_8080_CPU_JIT
+#include <sys/mman.h> // For mmap, mprotect, munmap
+
+// The code memory is never writable and executable at once, which hardened
+// runtimes refuse. It is executable, and made writable only while a block is
+// being translated. On macOS it must also be mapped for a jit.
+#if defined(__APPLE__)
+#define JIT_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT)
+#else
+#define JIT_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+#endif
+
+// The layout of the cpu is relied on to keep its hot state in one cache line.
+static_assert(offsetof(adc_8080_cpu, read_pages) <= 64,
+              "The hot cpu state must fit in one cache line");
+static_assert(sizeof(void *) != 8 || offsetof(adc_8080_cpu, read_pages) == 64,
+              "The hot cpu state must fill its cache line on 64-bit hosts");
+static_assert(offsetof(adc_8080_cpu, total_cycles) % 8 == 0 &&
+                  offsetof(adc_8080_cpu, write_traps) % 8 == 0 &&
+                  offsetof(adc_8080_cpu, read_traps) % 8 == 0 &&
+                  offsetof(adc_8080_cpu, code_pages) % 8 == 0,
+              "The 64-bit cpu fields must be naturally aligned");
+static_assert(sizeof(adc_8080_cpu) ==
+                  offsetof(adc_8080_cpu, read_pages) +
+                      (2 * ADC_8080_CPU_PAGE_COUNT + 9) * sizeof(void *) +
+                      sizeof(uint64_t),
+              "The cold cpu state must have no padding");
 
-// LUTs
+// Public api implementation
 
-// clang-format off
-static int s_cycles_lut[256] = {
-//	 x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
-/*x0*/   4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,
-/*1x*/   4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,
-/*2x*/   4,  10, 16, 5,  5,  5,  7,  4,  4,  10, 16, 5,  5,  5,  7,  4,
-/*3x*/   4,  10, 13, 5,  10, 10, 10, 4,  4,  10, 13, 5,  5,  5,  7,  4,
-/*4x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
-/*5x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
-/*6x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
-/*7x*/   7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,
-/*8x*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
-/*9x*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
-/*Ax*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
-/*Bx*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
-/*Cx*/   5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7, 11,
-/*Dx*/   5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7, 11,
-/*Ex*/   5,  10, 10, 18, 11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7, 11,
-/*Fx*/   5,  10, 10, 4,  11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7, 11
-};
-// clang-format on
+void adc_8080_cpu_init(adc_8080_cpu *cpu) {
+  assert(cpu);
 
-static bool s_parity_lut[256];
+  // Init the cpu state to all zero values.
+  cpu->ra = 0, cpu->rb = 0, cpu->rc = 0, cpu->rd = 0, cpu->re = 0, cpu->rh = 0,
+  cpu->rl = 0;
+  cpu->pc = 0;
+  cpu->sp = 0;
+  cpu->psw = adc::FLAG_ONE;
+  cpu->lazy_op = adc::LAZY_NONE, cpu->lazy_lhs = 0, cpu->lazy_rhs = 0,
+  cpu->lazy_res = 0;
+  cpu->halted = false;
+  cpu->inte = false;
+  cpu->interrupt_pending = false;
+  cpu->interrupt_opcode = 0x00;
+  cpu->interrupt_delay = false;
+  cpu->break_hit = false;
+  cpu->total_cycles = 0;
+  cpu->userdata = NULL;
+  cpu->read_byte = NULL;
+  cpu->write_byte = NULL;
+  cpu->read_device = NULL;
+  cpu->write_device = NULL;
+  for (int i = 0; i < ADC_8080_CPU_PAGE_COUNT; i++) {
+    cpu->read_pages[i] = NULL;
+    cpu->write_pages[i] = NULL;
+  }
+  cpu->block_cache = NULL;
+  cpu->code_pages = 0;
+  cpu->write_traps = 0;
+  cpu->read_traps = 0;
+  cpu->jit = NULL;
+  cpu->idle_skip = false;
+  cpu->profile = NULL;
+  cpu->trace = NULL;
+  cpu->coverage = NULL;
+  cpu->breakpoints = NULL;
+}
 
-// Helper functions and macros
+int adc_8080_cpu_step(adc_8080_cpu *cpu) {
+  assert(cpu);
+  assert(cpu->read_byte);
+  assert(cpu->write_byte);
+  assert(cpu->read_device);
+  assert(cpu->write_device);
 
-static inline uint16_t word_from_bytes(uint8_t high, uint8_t low) {
-  return (uint16_t)((high << 8) | low);
+  return adc::I8080<adc::CallbackBus>::step(cpu);
 }
 
-static inline void bytes_from_word(uint8_t *high, uint8_t *low, uint16_t w) {
-  *high = w >> 8;
-  *low = w & 0xFF;
+int adc_8080_cpu_run(adc_8080_cpu *cpu, int cycle_budget) {
+  assert(cpu);
+  assert(cpu->read_byte);
+  assert(cpu->write_byte);
+  assert(cpu->read_device);
+  assert(cpu->write_device);
+
+  return adc::I8080<adc::CallbackBus>::run(cpu, cycle_budget);
 }
 
-static inline uint8_t read_byte(adc_8080_cpu *cpu, uint16_t addr) {
-  return cpu->read_byte(cpu->userdata, addr);
+void adc_8080_cpu_interrupt(adc_8080_cpu *cpu, uint8_t opcode) {
+  assert(cpu);
+
+  cpu->interrupt_pending = true;
+  cpu->interrupt_opcode = opcode;
 }
 
-static inline uint16_t read_word(adc_8080_cpu *cpu, uint16_t addr) {
-  return word_from_bytes(cpu->read_byte(cpu->userdata, addr + 1),
-                         cpu->read_byte(cpu->userdata, addr));
+void adc_8080_cpu_map_memory(adc_8080_cpu *cpu, uint16_t addr, uint32_t size,
+                             uint8_t *mem, int flags) {
+  assert(cpu);
+  assert((addr & (ADC_8080_CPU_PAGE_SIZE - 1)) == 0);
+  assert((size & (ADC_8080_CPU_PAGE_SIZE - 1)) == 0);
+  assert(addr + size <= 0x10000);
+
+  int first = addr >> ADC_8080_CPU_PAGE_SHIFT;
+  int count = size >> ADC_8080_CPU_PAGE_SHIFT;
+  for (int i = 0; i < count; i++) {
+    uint8_t *page = mem ? mem + i * ADC_8080_CPU_PAGE_SIZE : NULL;
+    cpu->read_pages[first + i] = (flags & ADC_8080_CPU_MAP_READ) ? page : NULL;
+    cpu->write_pages[first + i] = (flags & ADC_8080_CPU_MAP_WRITE) ? page : NULL;
+  }
+
+  // Which memory is trusted or tracked for writes may have changed.
+  adc_8080_cpu_flush_block_cache(cpu);
 }
 
-static inline void write_byte(adc_8080_cpu *cpu, uint16_t addr, uint8_t b) {
-  cpu->write_byte(cpu->userdata, addr, b);
+void adc_8080_cpu_set_block_cache(adc_8080_cpu *cpu,
+                                  adc_8080_cpu_block_cache *cache) {
+  assert(cpu);
+
+  cpu->block_cache = cache;
+  adc_8080_cpu_flush_block_cache(cpu);
 }
 
-static inline void write_word(adc_8080_cpu *cpu, uint16_t addr, uint16_t w) {
-  cpu->write_byte(cpu->userdata, addr, w & 0xFF);
-  cpu->write_byte(cpu->userdata, addr + 1, w >> 8);
+// Trap the pages holding breakpoints, and the pages holding cached code for
+// writes.
+static void update_traps(adc_8080_cpu *cpu) {
+  uint64_t read_traps = 0;
+  uint64_t write_traps = 0;
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  if (breakpoints) {
+    for (int i = 0; i < breakpoints->count; i++) {
+      const adc_8080_cpu_breakpoint *breakpoint = &breakpoints->breakpoints[i];
+      int first = breakpoint->addr >> ADC_8080_CPU_PAGE_SHIFT;
+      int last = (breakpoint->addr + breakpoint->size - 1) >>
+                 ADC_8080_CPU_PAGE_SHIFT;
+      uint64_t pages = 0;
+      for (int page = first; page <= last; page++)
+        pages |= (uint64_t)1 << page;
+      if (breakpoint->flags &
+          (ADC_8080_CPU_BREAK_EXEC | ADC_8080_CPU_BREAK_READ))
+        read_traps |= pages;
+      if (breakpoint->flags & ADC_8080_CPU_BREAK_WRITE)
+        write_traps |= pages;
+    }
+    breakpoints->write_traps = write_traps;
+  }
+
+  cpu->read_traps = read_traps;
+  cpu->write_traps = cpu->code_pages | write_traps;
 }
 
-static inline uint8_t next_byte(adc_8080_cpu *cpu) {
-  return read_byte(cpu, cpu->pc++);
+void adc_8080_cpu_flush_block_cache(adc_8080_cpu *cpu) {
+  assert(cpu);
+
+  cpu->code_pages = 0;
+  update_traps(cpu);
+
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  if (!cache)
+    return;
+
+  for (int i = 0; i < ADC_8080_CPU_PAGE_COUNT; i++)
+    cache->page_generations[i] = 0;
+  cache->generation = 0;
+  for (int i = 0; i < ADC_8080_CPU_BLOCK_CACHE_SIZE; i++)
+    cache->blocks[i].count = 0;
 }
 
-static inline uint16_t next_word(adc_8080_cpu *cpu) {
-  uint16_t w = read_word(cpu, cpu->pc);
-  cpu->pc += 2;
-  return w;
+void adc_8080_cpu_invalidate_memory(adc_8080_cpu *cpu, uint16_t addr,
+                                    uint32_t size) {
+  assert(cpu);
+  assert(addr + size <= 0x10000);
+
+  if (!cpu->block_cache || size == 0)
+    return;
+
+  int first = addr >> ADC_8080_CPU_PAGE_SHIFT;
+  int last = (addr + size - 1) >> ADC_8080_CPU_PAGE_SHIFT;
+  for (int page = first; page <= last; page++) {
+    if ((cpu->code_pages >> page) & 1)
+      adc::invalidate_code_page(cpu, page);
+  }
 }
 
-// Internal interface
+void adc_8080_cpu_set_idle_skip(adc_8080_cpu *cpu, bool enable) {
+  assert(cpu);
 
-static void exec_next(adc_8080_cpu *cpu, uint8_t opcode);
+  cpu->idle_skip = enable;
+}
 
-// Public api implementation
+adc_8080_cpu_jit *adc_8080_cpu_jit_create(uint32_t code_size, int flags) {
+#if ADC_8080_CPU_JIT
+  adc_8080_cpu_jit *jit = (adc_8080_cpu_jit *)calloc(1, sizeof(*jit));
+  if (!jit)
+    return NULL;
 
-void adc_8080_cpu_init(adc_8080_cpu *cpu) {
+  void *code = mmap(NULL, code_size, PROT_READ | PROT_EXEC, JIT_MAP_FLAGS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(jit);
+    return NULL;
+  }
+
+  jit->code = (uint8_t *)code;
+  jit->code_size = code_size;
+  jit->flags = flags;
+  return jit;
+#else
+  (void)code_size;
+  (void)flags;
+  return NULL;
+#endif
+}
+
+void adc_8080_cpu_jit_destroy(adc_8080_cpu_jit *jit) {
+#if ADC_8080_CPU_JIT
+  if (!jit)
+    return;
+
+  munmap(jit->code, jit->code_size);
+  free(jit);
+#else
+  (void)jit;
+#endif
+}
+
+void adc_8080_cpu_set_jit(adc_8080_cpu *cpu, adc_8080_cpu_jit *jit) {
   assert(cpu);
 
-  // Init the cpu state to all zero values.
-  cpu->ra = 0, cpu->rb = 0, cpu->rc = 0, cpu->rd = 0, cpu->re = 0, cpu->rh = 0,
-  cpu->rl = 0;
-  cpu->pc = 0;
-  cpu->sp = 0;
-  cpu->cfs = 0, cpu->cfz = 0, cpu->cfa = 0, cpu->cfp = 0, cpu->cfc = 0;
-  cpu->halted = false;
-  cpu->interrupt_pending = false;
-  cpu->interrupt_opcode = 0x00;
-  cpu->interrupt_delay = false;
-  cpu->cycles = 0;
-  cpu->userdata = NULL;
-  cpu->read_byte = NULL;
-  cpu->write_byte = NULL;
-  cpu->read_device = NULL;
-  cpu->write_device = NULL;
+  // Drop translations made by a previous jit.
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  if (cache) {
+    for (int i = 0; i < ADC_8080_CPU_BLOCK_CACHE_SIZE; i++) {
+      cache->blocks[i].hits = 0;
+      cache->blocks[i].native = NULL;
+    }
+  }
+
+  cpu->jit = jit;
+}
+
+void adc_8080_cpu_set_profile(adc_8080_cpu *cpu,
+                              adc_8080_cpu_profile *profile) {
+  assert(cpu);
+
+  cpu->profile = profile;
+}
+
+void adc_8080_cpu_reset_profile(adc_8080_cpu_profile *profile) {
+  assert(profile);
+
+  memset(profile, 0, sizeof(*profile));
+}
+
+static int compare_hot_spots(const void *a, const void *b) {
+  const adc_8080_cpu_hot_spot *x = (const adc_8080_cpu_hot_spot *)a;
+  const adc_8080_cpu_hot_spot *y = (const adc_8080_cpu_hot_spot *)b;
+  if (x->cycles != y->cycles)
+    return x->cycles > y->cycles ? -1 : 1;
+  return (int)x->pc - (int)y->pc;
+}
 
-  // Populate the parity bit LUT.
+// Returns every profiled address sorted by cycles in a new array, or NULL if
+// it can't be allocated.
+static adc_8080_cpu_hot_spot *
+sort_hot_spots(const adc_8080_cpu_profile *profile, int *count) {
+  adc_8080_cpu_hot_spot *hot_spots = (adc_8080_cpu_hot_spot *)malloc(
+      0x10000 * sizeof(adc_8080_cpu_hot_spot));
+  *count = 0;
+  if (!hot_spots)
+    return NULL;
+
+  for (int pc = 0; pc < 0x10000; pc++) {
+    if (profile->pc_counts[pc] == 0)
+      continue;
+    adc_8080_cpu_hot_spot *hot_spot = &hot_spots[(*count)++];
+    hot_spot->pc = pc;
+    hot_spot->opcode = profile->pc_opcodes[pc];
+    hot_spot->count = profile->pc_counts[pc];
+    hot_spot->cycles = profile->pc_cycles[pc];
+  }
+  qsort(hot_spots, *count, sizeof(*hot_spots), compare_hot_spots);
+  return hot_spots;
+}
+
+int adc_8080_cpu_profile_hot_spots(const adc_8080_cpu_profile *profile,
+                                   adc_8080_cpu_hot_spot *hot_spots, int max) {
+  assert(profile);
+  assert(hot_spots || max == 0);
+
+  int count;
+  adc_8080_cpu_hot_spot *sorted = sort_hot_spots(profile, &count);
+  if (count > max)
+    count = max;
+  for (int i = 0; i < count; i++)
+    hot_spots[i] = sorted[i];
+  free(sorted);
+  return count;
+}
+
+void adc_8080_cpu_write_profile(const adc_8080_cpu_profile *profile,
+                                FILE *stream, int max) {
+  assert(profile);
+  assert(stream);
+
+  uint64_t total_cycles = 0;
+  for (int i = 0; i < 256; i++)
+    total_cycles += profile->opcode_cycles[i];
+  double scale = total_cycles ? 100.0 / total_cycles : 0.0;
+
+  fprintf(stream, "kind,address,opcode,count,cycles,percent\n");
   for (int i = 0; i < 256; i++) {
-    int ones = 0;
-    for (int b = 0; b < 8; b++)
-      if (((i >> b) & 1) == 1)
-        ones++;
-    s_parity_lut[i] = (ones % 2) == 0;
+    if (profile->opcode_counts[i] == 0)
+      continue;
+    fprintf(stream, "opcode,,0x%02X,%" PRIu64 ",%" PRIu64 ",%.2f\n", i,
+            profile->opcode_counts[i], profile->opcode_cycles[i],
+            profile->opcode_cycles[i] * scale);
+  }
+
+  int count;
+  adc_8080_cpu_hot_spot *sorted = sort_hot_spots(profile, &count);
+  if (max > 0 && count > max)
+    count = max;
+  for (int i = 0; i < count; i++) {
+    const adc_8080_cpu_hot_spot *hot_spot = &sorted[i];
+    fprintf(stream, "pc,0x%04X,0x%02X,%" PRIu64 ",%" PRIu64 ",%.2f\n",
+            hot_spot->pc, hot_spot->opcode, hot_spot->count, hot_spot->cycles,
+            hot_spot->cycles * scale);
   }
+  free(sorted);
 }
 
-int adc_8080_cpu_step(adc_8080_cpu *cpu) {
+void adc_8080_cpu_trace_init(adc_8080_cpu_trace *trace,
+                             adc_8080_cpu_trace_record *records,
+                             uint32_t capacity) {
+  assert(trace);
+  assert(records);
+  assert(capacity && (capacity & (capacity - 1)) == 0);
+
+  trace->records = records;
+  trace->capacity = capacity;
+  trace->count = 0;
+  trace->cycles = 0;
+}
+
+void adc_8080_cpu_set_trace(adc_8080_cpu *cpu, adc_8080_cpu_trace *trace) {
   assert(cpu);
-  assert(cpu->read_byte);
-  assert(cpu->write_byte);
-  assert(cpu->read_device);
-  assert(cpu->write_device);
 
-  // Recognize a interrupt request when all of the following
-  // conditions are met:
-  // - There is an interrupt pending.
-  // - The INTE flip-flop is enabled.
-  // - The last instruction being executed has complete.
-  if (cpu->interrupt_pending && cpu->inte && !cpu->interrupt_delay) {
-    // The following states are reset once an interrupt
-    // request is recognized.
-    cpu->interrupt_pending = false;
-    cpu->inte = false;
-    cpu->halted = false;
-
-    // The pc is not incremented here because interrupt
-    // opcodes are not read from memory.
-    exec_next(cpu, cpu->interrupt_opcode);
-  } else if (!cpu->halted) {
-    exec_next(cpu, next_byte(cpu));
+  // Stamp the records with the cycle count of the cpu, which the trace keeps
+  // in step with as it records.
+  if (trace) {
+    trace->cycles = cpu->total_cycles;
   }
+  cpu->trace = trace;
+}
+
+// The trace file is the records as laid out in memory, which has no padding.
+static_assert(sizeof(adc_8080_cpu_trace_record) == 24,
+              "Trace records must be packed");
 
-  // Reset the cycle count and return the consumed cycles this step.
-  int cycles = cpu->cycles;
-  cpu->cycles = 0;
-  return cycles;
+int adc_8080_cpu_write_trace(const adc_8080_cpu_trace *trace, FILE *stream) {
+  assert(trace);
+  assert(stream);
+
+  uint64_t count =
+      trace->count < trace->capacity ? trace->count : trace->capacity;
+  adc_8080_cpu_trace_file_header header;
+  header.magic = ADC_8080_CPU_TRACE_MAGIC;
+  header.version = ADC_8080_CPU_TRACE_FILE_VERSION;
+  header.record_size = sizeof(adc_8080_cpu_trace_record);
+  header.count = count;
+  if (fwrite(&header, sizeof(header), 1, stream) != 1)
+    return -1;
+
+  // Write the ring buffer from the oldest record, in at most two runs.
+  uint32_t mask = trace->capacity - 1;
+  uint32_t first = (uint32_t)((trace->count - count) & mask);
+  uint32_t head = (uint32_t)count;
+  if (first + head > trace->capacity)
+    head = trace->capacity - first;
+  if (fwrite(trace->records + first, sizeof(adc_8080_cpu_trace_record), head,
+             stream) != head)
+    return -1;
+  uint32_t tail = (uint32_t)count - head;
+  if (fwrite(trace->records, sizeof(adc_8080_cpu_trace_record), tail, stream) !=
+      tail)
+    return -1;
+  return 0;
 }
 
-void adc_8080_cpu_interrupt(adc_8080_cpu *cpu, uint8_t opcode) {
+static_assert(ADC_8080_CPU_COVERAGE_EDGES > 0 &&
+                  ADC_8080_CPU_COVERAGE_EDGES <= 0x10000 &&
+                  (ADC_8080_CPU_COVERAGE_EDGES &
+                   (ADC_8080_CPU_COVERAGE_EDGES - 1)) == 0,
+              "COVERAGE_EDGES must be a power of two up to 65536");
+static_assert(ADC_8080_CPU_BLOCK_MAX_OPS * 3 < 64,
+              "A covered block must fit in a bitmap word");
+
+void adc_8080_cpu_set_coverage(adc_8080_cpu *cpu,
+                               adc_8080_cpu_coverage *coverage) {
   assert(cpu);
 
-  cpu->interrupt_pending = true;
-  cpu->interrupt_opcode = opcode;
+  cpu->coverage = coverage;
+}
+
+void adc_8080_cpu_reset_coverage(adc_8080_cpu_coverage *coverage) {
+  assert(coverage);
+
+  memset(coverage, 0, sizeof(*coverage));
+  coverage->next_pc = 0x10000;
+}
+
+void adc_8080_cpu_snapshot_coverage(adc_8080_cpu_coverage *coverage,
+                                    adc_8080_cpu_coverage *snapshot,
+                                    bool reset) {
+  assert(coverage);
+  assert(snapshot && snapshot != coverage);
+
+  memcpy(snapshot, coverage, sizeof(*snapshot));
+  if (reset) {
+    // Keep following the running program, so the first branch taken after the
+    // reset is still counted.
+    uint16_t last_pc = coverage->last_pc;
+    uint32_t next_pc = coverage->next_pc;
+    adc_8080_cpu_reset_coverage(coverage);
+    coverage->last_pc = last_pc;
+    coverage->next_pc = next_pc;
+  }
+}
+
+int adc_8080_cpu_coverage_addresses(const adc_8080_cpu_coverage *coverage) {
+  assert(coverage);
+
+  int count = 0;
+  for (int i = 0; i < 0x10000 / 64; i++) {
+    for (uint64_t bits = coverage->addresses[i]; bits; bits &= bits - 1)
+      count++;
+  }
+  return count;
+}
+
+static int compare_edges(const void *a, const void *b) {
+  const adc_8080_cpu_coverage_edge *x = (const adc_8080_cpu_coverage_edge *)a;
+  const adc_8080_cpu_coverage_edge *y = (const adc_8080_cpu_coverage_edge *)b;
+  if (x->from != y->from)
+    return (int)x->from - (int)y->from;
+  return (int)x->to - (int)y->to;
+}
+
+// The coverage file holds the edges as laid out in memory, which has no
+// padding.
+static_assert(sizeof(adc_8080_cpu_coverage_edge) == 8,
+              "Coverage edges must be packed");
+
+int adc_8080_cpu_write_coverage(const adc_8080_cpu_coverage *coverage,
+                                FILE *stream) {
+  assert(coverage);
+  assert(stream);
+
+  // Gather the edges out of the map and sort them.
+  adc_8080_cpu_coverage_edge *edges = (adc_8080_cpu_coverage_edge *)malloc(
+      ADC_8080_CPU_COVERAGE_EDGES * sizeof(adc_8080_cpu_coverage_edge));
+  if (!edges)
+    return -1;
+  uint32_t count = 0;
+  for (int i = 0; i < ADC_8080_CPU_COVERAGE_EDGES; i++) {
+    if (coverage->edges[i].count)
+      edges[count++] = coverage->edges[i];
+  }
+  qsort(edges, count, sizeof(*edges), compare_edges);
+
+  adc_8080_cpu_coverage_file_header header;
+  header.magic = ADC_8080_CPU_COVERAGE_MAGIC;
+  header.version = ADC_8080_CPU_COVERAGE_FILE_VERSION;
+  header.edge_size = sizeof(adc_8080_cpu_coverage_edge);
+  header.edge_count = count;
+  header.edges_dropped = coverage->edges_dropped;
+  bool written =
+      fwrite(&header, sizeof(header), 1, stream) == 1 &&
+      fwrite(coverage->addresses, sizeof(coverage->addresses), 1, stream) ==
+          1 &&
+      fwrite(edges, sizeof(*edges), count, stream) == count;
+  free(edges);
+  return written ? 0 : -1;
+}
+
+void adc_8080_cpu_set_breakpoints(adc_8080_cpu *cpu,
+                                  adc_8080_cpu_breakpoints *breakpoints) {
+  assert(cpu);
+
+  cpu->breakpoints = breakpoints;
+  cpu->break_hit = false;
+  if (breakpoints)
+    breakpoints->resuming = false;
+  update_traps(cpu);
+}
+
+int adc_8080_cpu_add_breakpoint(adc_8080_cpu *cpu, uint16_t addr,
+                                uint16_t size, int flags) {
+  assert(cpu);
+  assert(cpu->breakpoints);
+  assert(size > 0 && addr + size <= 0x10000);
+  assert(flags);
+
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  if (breakpoints->count == ADC_8080_CPU_MAX_BREAKPOINTS)
+    return -1;
+
+  int index = breakpoints->count++;
+  adc_8080_cpu_breakpoint *breakpoint = &breakpoints->breakpoints[index];
+  breakpoint->addr = addr;
+  breakpoint->size = size;
+  breakpoint->flags = flags;
+  update_traps(cpu);
+  return index;
+}
+
+void adc_8080_cpu_remove_breakpoint(adc_8080_cpu *cpu, int index) {
+  assert(cpu);
+  assert(cpu->breakpoints);
+  assert(index >= 0 && index < cpu->breakpoints->count);
+
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  breakpoints->count--;
+  memmove(&breakpoints->breakpoints[index],
+          &breakpoints->breakpoints[index + 1],
+          (breakpoints->count - index) * sizeof(adc_8080_cpu_breakpoint));
+  update_traps(cpu);
 }
 
-#define get_rbc() word_from_bytes(cpu->rb, cpu->rc)
-#define get_rde() word_from_bytes(cpu->rd, cpu->re)
-#define get_rhl() word_from_bytes(cpu->rh, cpu->rl)
+void adc_8080_cpu_resume(adc_8080_cpu *cpu) {
+  assert(cpu);
+
+  cpu->break_hit = false;
+
+  // The instruction at the pc is run once before its breakpoint is checked
+  // again.
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  if (breakpoints) {
+    breakpoints->resuming =
+        adc::find_breakpoint(cpu, cpu->pc, 1, ADC_8080_CPU_BREAK_EXEC) >= 0;
+    breakpoints->resume_pc = cpu->pc;
+  }
+}
+
+// Assembly of each opcode, formatted with the operand. Undocumented opcodes
+// are marked with a *.
+// clang-format off
+static constexpr const char *s_mnemonics[256] = {
+  "NOP", "LXI B,$%04X", "STAX B", "INX B",
+  "INR B", "DCR B", "MVI B,$%02X", "RLC",
+  "*NOP", "DAD B", "LDAX B", "DCX B",
+  "INR C", "DCR C", "MVI C,$%02X", "RRC",
+  "*NOP", "LXI D,$%04X", "STAX D", "INX D",
+  "INR D", "DCR D", "MVI D,$%02X", "RAL",
+  "*NOP", "DAD D", "LDAX D", "DCX D",
+  "INR E", "DCR E", "MVI E,$%02X", "RAR",
+  "*NOP", "LXI H,$%04X", "SHLD $%04X", "INX H",
+  "INR H", "DCR H", "MVI H,$%02X", "DAA",
+  "*NOP", "DAD H", "LHLD $%04X", "DCX H",
+  "INR L", "DCR L", "MVI L,$%02X", "CMA",
+  "*NOP", "LXI SP,$%04X", "STA $%04X", "INX SP",
+  "INR M", "DCR M", "MVI M,$%02X", "STC",
+  "*NOP", "DAD SP", "LDA $%04X", "DCX SP",
+  "INR A", "DCR A", "MVI A,$%02X", "CMC",
+  "MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E",
+  "MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A",
+  "MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E",
+  "MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A",
+  "MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E",
+  "MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A",
+  "MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E",
+  "MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A",
+  "MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E",
+  "MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A",
+  "MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E",
+  "MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A",
+  "MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E",
+  "MOV M,H", "MOV M,L", "HLT", "MOV M,A",
+  "MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E",
+  "MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A",
+  "ADD B", "ADD C", "ADD D", "ADD E",
+  "ADD H", "ADD L", "ADD M", "ADD A",
+  "ADC B", "ADC C", "ADC D", "ADC E",
+  "ADC H", "ADC L", "ADC M", "ADC A",
+  "SUB B", "SUB C", "SUB D", "SUB E",
+  "SUB H", "SUB L", "SUB M", "SUB A",
+  "SBB B", "SBB C", "SBB D", "SBB E",
+  "SBB H", "SBB L", "SBB M", "SBB A",
+  "ANA B", "ANA C", "ANA D", "ANA E",
+  "ANA H", "ANA L", "ANA M", "ANA A",
+  "XRA B", "XRA C", "XRA D", "XRA E",
+  "XRA H", "XRA L", "XRA M", "XRA A",
+  "ORA B", "ORA C", "ORA D", "ORA E",
+  "ORA H", "ORA L", "ORA M", "ORA A",
+  "CMP B", "CMP C", "CMP D", "CMP E",
+  "CMP H", "CMP L", "CMP M", "CMP A",
+  "RNZ", "POP B", "JNZ $%04X", "JMP $%04X",
+  "CNZ $%04X", "PUSH B", "ADI $%02X", "RST 0",
+  "RZ", "RET", "JZ $%04X", "*JMP $%04X",
+  "CZ $%04X", "CALL $%04X", "ACI $%02X", "RST 1",
+  "RNC", "POP D", "JNC $%04X", "OUT $%02X",
+  "CNC $%04X", "PUSH D", "SUI $%02X", "RST 2",
+  "RC", "*RET", "JC $%04X", "IN $%02X",
+  "CC $%04X", "*CALL $%04X", "SBI $%02X", "RST 3",
+  "RPO", "POP H", "JPO $%04X", "XTHL",
+  "CPO $%04X", "PUSH H", "ANI $%02X", "RST 4",
+  "RPE", "PCHL", "JPE $%04X", "XCHG",
+  "CPE $%04X", "*CALL $%04X", "XRI $%02X", "RST 5",
+  "RP", "POP PSW", "JP $%04X", "DI",
+  "CP $%04X", "PUSH PSW", "ORI $%02X", "RST 6",
+  "RM", "SPHL", "JM $%04X", "EI",
+  "CM $%04X", "*CALL $%04X", "CPI $%02X", "RST 7",
+};
+// clang-format on
+
+int adc_8080_cpu_disassemble(uint8_t opcode, uint16_t operand, char *buf,
+                             int size) {
+  assert(buf || size == 0);
+
+  if (size > 0)
+    snprintf(buf, size, s_mnemonics[opcode], operand);
+  return adc::s_length_lut[opcode];
+}
+
+uint8_t adc_8080_cpu_get_psw(adc_8080_cpu *cpu) {
+  assert(cpu);
+
+  return adc::get_psw(cpu);
+}
+
+void adc_8080_cpu_set_psw(adc_8080_cpu *cpu, uint8_t psw) {
+  assert(cpu);
+
+  adc::set_psw(cpu, psw);
+}
+
+#define get_rbc() (uint16_t)((cpu->rb << 8) | cpu->rc)
+#define get_rde() (uint16_t)((cpu->rd << 8) | cpu->re)
+#define get_rhl() (uint16_t)((cpu->rh << 8) | cpu->rl)
 
 void adc_8080_cpu_print(adc_8080_cpu *cpu, FILE *stream) {
 #define u8 "0x%02" PRIx8
@@ -186,981 +686,641 @@ void adc_8080_cpu_print(adc_8080_cpu *cpu, FILE *stream) {
           "inte:%d, interrupt_pending:%d, interrupt_opcode:" u8 "\n"
           "halted: %d\n",
           cpu->ra, cpu->rb, cpu->rc, cpu->rd, cpu->re, cpu->rh, cpu->rl,
-          get_rbc(), get_rde(), get_rhl(), cpu->pc, cpu->sp, cpu->cfs, cpu->cfz,
-          cpu->cfa, cpu->cfp, cpu->cfc, cpu->inte, cpu->interrupt_pending,
-          cpu->interrupt_opcode, cpu->halted);
+          get_rbc(), get_rde(), get_rhl(), cpu->pc, cpu->sp, adc::flag_s(cpu),
+          adc::flag_z(cpu), adc::flag_a(cpu), adc::flag_p(cpu), adc::flag_c(cpu),
+          cpu->inte, cpu->interrupt_pending, cpu->interrupt_opcode,
+          cpu->halted);
 #undef u8
 #undef u16
 }
 
-// Internal implementation and helper macros
+#if ADC_8080_CPU_JIT
 
-#define set_rbc(w) bytes_from_word(&cpu->rb, &cpu->rc, w)
-#define set_rde(w) bytes_from_word(&cpu->rd, &cpu->re, w)
-#define set_rhl(w) bytes_from_word(&cpu->rh, &cpu->rl, w)
+// Jit implementation
+//
+// Blocks are translated into x86-64 code for the System V abi. The cpu is
+// pinned in rbx and the 8080 registers are operated on in place in the cpu
+// struct, so nothing has to be spilled around the calls to the Bus helpers.
+// The 8080 PSW has the same layout as the low byte of the x86 flags, so the
+// flags are taken with LAHF straight after the matching x86 instruction, with
+// the aux carry fixed up where the two differ. Instructions without a
+// translation call back into the interpreter.
+//
+// Translated blocks keep the generation of the block cache in r12d, and after
+// every instruction which may write memory leave early if it changed.
+
+#define CPU_OFFSET(field) ((int)offsetof(adc_8080_cpu, field))
+
+static_assert(offsetof(adc_8080_cpu, psw) < 128 &&
+                  offsetof(adc_8080_cpu, sp) < 128 &&
+                  offsetof(adc_8080_cpu, pc) < 128,
+              "The jit addresses the registers with 8-bit displacements");
+
+// Offsets of the 8080 registers by their encoding in opcodes (B, C, D, E, H,
+// L, M, A). M has no offset.
+static constexpr int s_jit_reg_offsets[8] = {
+    CPU_OFFSET(rb), CPU_OFFSET(rc), CPU_OFFSET(rd), CPU_OFFSET(re),
+    CPU_OFFSET(rh), CPU_OFFSET(rl), -1,             CPU_OFFSET(ra)};
+
+// Offsets of the register pairs by their encoding in opcodes (BC, DE, HL, SP).
+// The pairs are stored high byte first, unlike sp.
+static constexpr int s_jit_pair_offsets[4] = {CPU_OFFSET(rb), CPU_OFFSET(rd),
+                                          CPU_OFFSET(rh), CPU_OFFSET(sp)};
+
+// x86 ALU opcodes by the 8080 ALU op encoding (ADD, ADC, SUB, SBB, ANA, XRA,
+// ORA, CMP), in their "op r8, r/m8" and "op al, imm8" forms.
+static constexpr uint8_t s_jit_alu_rm[8] = {0x02, 0x12, 0x2A, 0x1A,
+                                        0x22, 0x32, 0x0A, 0x3A};
+static constexpr uint8_t s_jit_alu_imm[8] = {0x04, 0x14, 0x2C, 0x1C,
+                                         0x24, 0x34, 0x0C, 0x3C};
+
+// Flag tested by the conditional jumps, calls and returns by the condition
+// encoding (NZ, Z, NC, C, PO, PE, P, M) divided by 2. Odd conditions are met
+// when the flag is set.
+static constexpr uint8_t s_jit_cond_flags[4] = {adc::FLAG_Z, adc::FLAG_C,
+                                            adc::FLAG_P, adc::FLAG_S};
+
+// x86 registers, as 8-bit registers AL, CL, DL and AH, or 32-bit EAX, ECX,
+// EDX and ESI.
+enum { X86_AX = 0, X86_CX = 1, X86_DX = 2, X86_AH = 4, X86_SI = 6 };
+
+// Kinds of translated instructions.
+enum {
+  JIT_OP_UNSUPPORTED, // Nothing emitted, the interpreter runs it.
+  JIT_OP_DONE,
+  JIT_OP_WRITES, // May write memory, and with that cached code.
+  JIT_OP_EXITS   // Set the pc and the return value, the block ends.
+};
 
-#define set_cf_zsp(v)                                                          \
-  {                                                                            \
-    cpu->cfs = (v) >> 7;                                                       \
-    cpu->cfz = (v) == 0;                                                       \
-    cpu->cfp = s_parity_lut[(v)];                                              \
-  }
+struct JitEmitter {
+  uint8_t *p;
+  uint8_t *end;
+  const adc::JitHelpers *helpers;
+};
 
-static inline void stack_push(adc_8080_cpu *cpu, uint16_t w) {
-  cpu->sp -= 2;
-  write_word(cpu, cpu->sp, w);
+static void emit(JitEmitter *e, int b) {
+  // Keep counting past the end so running out of memory can be detected once
+  // the block is done.
+  if (e->p < e->end)
+    *e->p = (uint8_t)b;
+  e->p++;
 }
 
-static inline uint16_t stack_pop(adc_8080_cpu *cpu) {
-  uint16_t w = read_word(cpu, cpu->sp);
-  cpu->sp += 2;
-  return w;
+static void emit16(JitEmitter *e, int w) {
+  emit(e, w & 0xFF);
+  emit(e, (w >> 8) & 0xFF);
 }
 
-static inline uint8_t op_inr(adc_8080_cpu *cpu, uint8_t val) {
-  uint8_t res = val + 1;
-  cpu->cfa = (res & 0x0F) == 0;
-  set_cf_zsp(res);
-  return res;
+static void emit32(JitEmitter *e, uint32_t v) {
+  emit16(e, v & 0xFFFF);
+  emit16(e, v >> 16);
 }
 
-static inline uint8_t op_dcr(adc_8080_cpu *cpu, uint8_t val) {
-  uint8_t res = val - 1;
-  cpu->cfa = !((res & 0x0F) == 0x0F);
-  set_cf_zsp(res);
-  return res;
+static void emit64(JitEmitter *e, uint64_t v) {
+  emit32(e, v & 0xFFFFFFFF);
+  emit32(e, v >> 32);
 }
 
-static inline void op_add(adc_8080_cpu *cpu, uint8_t val, bool c) {
-  uint8_t res = cpu->ra + val + c;
-  int16_t sres = cpu->ra + val + c;
-  int16_t carry = sres ^ cpu->ra ^ val;
-  cpu->cfc = carry & (1 << 8) ? 1 : 0;
-  cpu->cfa = carry & (1 << 4) ? 1 : 0;
-  set_cf_zsp(res);
-  cpu->ra = res;
+// ModRM byte and displacement addressing [rbx + offset].
+static void emit_cpu_operand(JitEmitter *e, int reg, int offset) {
+  emit(e, 0x43 | reg << 3);
+  emit(e, offset);
 }
 
-static inline void op_sub(adc_8080_cpu *cpu, uint8_t val, bool c) {
-  op_add(cpu, ~val, !c);
-  cpu->cfc = !cpu->cfc;
+// Emit a forward jcc with an 8-bit displacement, to be patched by
+// patch_jump() at its target.
+static uint8_t *emit_jump(JitEmitter *e, int opcode) {
+  emit(e, opcode);
+  uint8_t *at = e->p;
+  emit(e, 0);
+  return at;
 }
 
-static inline void op_ana(adc_8080_cpu *cpu, uint8_t val) {
-  uint8_t result = cpu->ra & val;
-  cpu->cfc = 0;
-  cpu->cfa = ((cpu->ra | val) & 0x08) != 0;
-  set_cf_zsp(result);
-  cpu->ra = result;
+static void patch_jump(JitEmitter *e, uint8_t *at) {
+  assert(e->p - (at + 1) < 128);
+  if (at < e->end)
+    *at = (uint8_t)(e->p - (at + 1));
 }
 
-static inline void op_xra(adc_8080_cpu *cpu, uint8_t val) {
-  cpu->ra = cpu->ra ^ val;
-  cpu->cfc = 0;
-  cpu->cfa = 0;
-  set_cf_zsp(cpu->ra);
+static void emit_call(JitEmitter *e, uintptr_t fn) {
+  emit(e, 0x48), emit(e, 0x89), emit(e, 0xDF); // mov rdi, rbx
+  emit(e, 0x48), emit(e, 0xB8), emit64(e, fn); // mov rax, fn
+  emit(e, 0xFF), emit(e, 0xD0);                // call rax
 }
 
-static inline void op_ora(adc_8080_cpu *cpu, uint8_t val) {
-  cpu->ra = cpu->ra | val;
-  cpu->cfc = 0;
-  cpu->cfa = 0;
-  set_cf_zsp(cpu->ra);
+static void emit_prologue(JitEmitter *e, uint32_t *generation) {
+  emit(e, 0x53);                                      // push rbx
+  emit(e, 0x55);                                      // push rbp
+  emit(e, 0x41), emit(e, 0x54);                       // push r12
+  emit(e, 0x48), emit(e, 0x89), emit(e, 0xFB);        // mov rbx, rdi
+  emit(e, 0x48), emit(e, 0xBD);                       // mov rbp, generation
+  emit64(e, (uintptr_t)generation);
+  emit(e, 0x44), emit(e, 0x8B), emit(e, 0x65), emit(e, 0x00); // mov r12d, [rbp]
 }
 
-static inline void op_cmp(adc_8080_cpu *cpu, uint8_t val) {
-  int16_t res = cpu->ra - val;
-  cpu->cfc = res >> 8;
-  cpu->cfa = ~(cpu->ra ^ res ^ val) & 0x10;
-  set_cf_zsp(res & 0xFF);
+static void emit_epilogue(JitEmitter *e) {
+  emit(e, 0x41), emit(e, 0x5C); // pop r12
+  emit(e, 0x5D);                // pop rbp
+  emit(e, 0x5B);                // pop rbx
+  emit(e, 0xC3);                // ret
 }
 
-static inline void op_jmp_cond(adc_8080_cpu *cpu, uint16_t addr,
-                               bool condition) {
-  if (condition)
-    cpu->pc = addr;
+static void emit_set_pc(JitEmitter *e, int pc) {
+  emit(e, 0x66), emit(e, 0xC7), emit_cpu_operand(e, 0, CPU_OFFSET(pc));
+  emit16(e, pc);
 }
 
-static inline void op_call(adc_8080_cpu *cpu, uint16_t addr) {
-  stack_push(cpu, cpu->pc);
-  cpu->pc = addr;
+// Load a register pair into a 32-bit x86 register.
+static void emit_load_pair(JitEmitter *e, int reg, int rp) {
+  emit(e, 0x0F), emit(e, 0xB7), emit_cpu_operand(e, reg, s_jit_pair_offsets[rp]);
+  if (rp != 3)
+    emit(e, 0x66), emit(e, 0xC1), emit(e, 0xC0 | reg), emit(e, 8); // rol r16, 8
 }
 
-static inline void op_call_cond(adc_8080_cpu *cpu, uint16_t addr,
-                                bool condition) {
-  if (condition) {
-    op_call(cpu, addr);
-    cpu->cycles += 6;
-  }
+// Store ax to a register pair.
+static void emit_store_pair(JitEmitter *e, int rp) {
+  if (rp != 3)
+    emit(e, 0x66), emit(e, 0xC1), emit(e, 0xC0), emit(e, 8); // rol ax, 8
+  emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_AX, s_jit_pair_offsets[rp]);
 }
 
-static inline void op_ret_cond(adc_8080_cpu *cpu, bool condition) {
-  if (condition) {
-    cpu->pc = stack_pop(cpu);
-    cpu->cycles += 6;
-  }
+static void emit_load_psw_to_flags(JitEmitter *e) {
+  emit(e, 0x8A), emit_cpu_operand(e, X86_AH, CPU_OFFSET(psw)); // mov ah, [psw]
+  emit(e, 0x9E);                                               // sahf
 }
 
-static inline void op_dad(adc_8080_cpu *cpu, uint16_t val) {
-  uint32_t res = get_rhl() + val;
-  cpu->cfc = res > 0xFFFF;
-  set_rhl(res & 0xFFFF);
+// Store the x86 carry flag to the 8080 carry flag.
+static void emit_store_carry(JitEmitter *e) {
+  emit(e, 0x0F), emit(e, 0x92), emit(e, 0xC2);                   // setc dl
+  emit(e, 0x80), emit_cpu_operand(e, 4, CPU_OFFSET(psw));        // and [psw],
+  emit(e, 0xFE);                                                 //   ~FLAG_C
+  emit(e, 0x08), emit_cpu_operand(e, X86_DX, CPU_OFFSET(psw));   // or [psw], dl
 }
 
-static inline void op_xchg(adc_8080_cpu *cpu) {
-  uint16_t tmp = get_rhl();
-  set_rhl(get_rde());
-  set_rde(tmp);
+// Read the byte at HL into al.
+static void emit_read_hl(JitEmitter *e) {
+  emit_load_pair(e, X86_SI, 2);
+  emit_call(e, (uintptr_t)e->helpers->read_byte);
 }
 
-static inline void op_xthl(adc_8080_cpu *cpu) {
-  uint16_t val = read_word(cpu, cpu->sp);
-  write_word(cpu, cpu->sp, get_rhl());
-  set_rhl(val);
+// Write edx to the byte at HL.
+static void emit_write_hl(JitEmitter *e) {
+  emit_load_pair(e, X86_SI, 2);
+  emit_call(e, (uintptr_t)e->helpers->write_byte);
 }
 
-static inline void op_rlc(adc_8080_cpu *cpu) {
-  cpu->cfc = cpu->ra >> 7;
-  cpu->ra = (cpu->ra << 1) | cpu->cfc;
+// Push edx.
+static void emit_push(JitEmitter *e) {
+  emit(e, 0x66), emit(e, 0x83), emit_cpu_operand(e, 5, CPU_OFFSET(sp)); // sub
+  emit(e, 2);                                                           //   [sp], 2
+  emit_load_pair(e, X86_SI, 3);
+  emit_call(e, (uintptr_t)e->helpers->write_word);
 }
 
-static inline void op_rrc(adc_8080_cpu *cpu) {
-  cpu->cfc = cpu->ra & 1;
-  cpu->ra = (cpu->ra >> 1) | (cpu->cfc << 7);
+// Pop into ax.
+static void emit_pop(JitEmitter *e) {
+  emit_load_pair(e, X86_SI, 3);
+  emit_call(e, (uintptr_t)e->helpers->read_word);
+  emit(e, 0x66), emit(e, 0x83), emit_cpu_operand(e, 0, CPU_OFFSET(sp)); // add
+  emit(e, 2);                                                           //   [sp], 2
 }
 
-static inline void op_ral(adc_8080_cpu *cpu) {
-  bool carrybit = cpu->cfc;
-  cpu->cfc = cpu->ra >> 7;
-  cpu->ra = (cpu->ra << 1) | carrybit;
+// Sources of an ALU op.
+enum { JIT_SRC_REG, JIT_SRC_CL, JIT_SRC_IMM };
+
+// Emit "op reg, src" in the "op r8, r/m8" form, or with an immediate.
+static void emit_alu_src(JitEmitter *e, int rm_opcode, int imm_opcode, int reg,
+                         int src, int val) {
+  if (src == JIT_SRC_REG) {
+    emit(e, rm_opcode), emit_cpu_operand(e, reg, val);
+  } else if (src == JIT_SRC_CL) {
+    emit(e, rm_opcode), emit(e, 0xC0 | reg << 3 | X86_CX);
+  } else if (reg == X86_AX) {
+    emit(e, imm_opcode), emit(e, val);
+  } else {
+    // The "op r/m8, imm8" form, only used for or.
+    emit(e, 0x80), emit(e, 0xC0 | 1 << 3 | reg), emit(e, val);
+  }
 }
 
-static inline void op_rar(adc_8080_cpu *cpu) {
-  bool carrybit = cpu->cfc;
-  cpu->cfc = cpu->ra & 1;
-  cpu->ra = (cpu->ra >> 1) | (carrybit << 7);
-}
+static void emit_alu(JitEmitter *e, int op, int src, int val) {
+  enum { ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP };
 
-static void op_push_psw(adc_8080_cpu *cpu) {
-  uint8_t psw = 0;
-  psw |= cpu->cfs << 7;
-  psw |= cpu->cfz << 6;
-  psw |= cpu->cfa << 4;
-  psw |= cpu->cfp << 2;
-  psw |= 1 << 1;
-  psw |= cpu->cfc << 0;
+  if (op == ADC || op == SBB)
+    emit_load_psw_to_flags(e);
+  emit(e, 0x8A), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra)); // mov al, [ra]
 
-  stack_push(cpu, word_from_bytes(cpu->ra, psw));
+  // The aux carry of ANA is bit 3 of the operands or'ed.
+  if (op == ANA) {
+    emit(e, 0x88), emit(e, 0xC2);                            // mov dl, al
+    emit_alu_src(e, 0x0A, 0x0C, X86_DX, src, val);           // or dl, src
+  }
+
+  emit_alu_src(e, s_jit_alu_rm[op], s_jit_alu_imm[op], X86_AX, src, val);
+  emit(e, 0x9F); // lahf
+
+  if (op == SUB || op == SBB || op == CMP) {
+    // The 8080 subtracts by adding the complement, so its aux carry is the
+    // inverse of the x86 aux borrow.
+    emit(e, 0x80), emit(e, 0xF4), emit(e, adc::FLAG_A); // xor ah, FLAG_A
+  } else if (op == ANA || op == XRA || op == ORA) {
+    emit(e, 0x80), emit(e, 0xE4), emit(e, ~adc::FLAG_A & 0xFF); // and ah, ~FLAG_A
+    if (op == ANA) {
+      emit(e, 0xD0), emit(e, 0xE2);                          // shl dl, 1
+      emit(e, 0x80), emit(e, 0xE2), emit(e, adc::FLAG_A);    // and dl, FLAG_A
+      emit(e, 0x0A), emit(e, 0xE2);                          // or ah, dl
+    }
+  }
+
+  if (op != CMP)
+    emit(e, 0x88), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra)); // mov [ra], al
+  emit(e, 0x88), emit_cpu_operand(e, X86_AH, CPU_OFFSET(psw));  // mov [psw], ah
 }
 
-static void op_pop_psw(adc_8080_cpu *cpu) {
-  uint8_t a, psw;
-  bytes_from_word(&a, &psw, stack_pop(cpu));
+// Emit INR/DCR on the register at offset, or on al for -1. INC and DEC keep
+// the carry, so it is loaded first and stored back with the rest.
+static void emit_inr_dcr(JitEmitter *e, bool dcr, int offset) {
+  emit_load_psw_to_flags(e);
+  if (offset < 0)
+    emit(e, 0xFE), emit(e, dcr ? 0xC8 : 0xC0); // inc/dec al
+  else
+    emit(e, 0xFE), emit_cpu_operand(e, dcr ? 1 : 0, offset); // inc/dec [r]
+  emit(e, 0x9F); // lahf
+
+  // The 8080 aux carry of DCR is the inverse of the x86 aux borrow.
+  if (dcr)
+    emit(e, 0x80), emit(e, 0xF4), emit(e, adc::FLAG_A); // xor ah, FLAG_A
+  emit(e, 0x88), emit_cpu_operand(e, X86_AH, CPU_OFFSET(psw)); // mov [psw], ah
+}
 
-  cpu->ra = a;
-  cpu->cfs = (psw >> 7) & 1;
-  cpu->cfz = (psw >> 6) & 1;
-  cpu->cfa = (psw >> 4) & 1;
-  cpu->cfp = (psw >> 2) & 1;
-  cpu->cfc = (psw >> 0) & 1;
+// Emit a conditional skip of the code up to patch_jump(), taken when the
+// condition of a Jcc/Ccc/Rcc opcode is not met.
+static uint8_t *emit_skip_unless(JitEmitter *e, uint8_t opcode) {
+  int cond = (opcode >> 3) & 7;
+  emit(e, 0xF6), emit_cpu_operand(e, 0, CPU_OFFSET(psw)); // test [psw],
+  emit(e, s_jit_cond_flags[cond >> 1]);                   //   flag
+  return emit_jump(e, (cond & 1) ? 0x74 : 0x75);          // jz/jnz
 }
 
-static void op_daa(adc_8080_cpu *cpu) {
-  uint8_t lownib = cpu->ra & 0x0F;
-  uint8_t highnib = cpu->ra >> 4;
-  bool carrybit = cpu->cfc;
-  uint8_t addition = 0;
+static void emit_return(JitEmitter *e, int val) {
+  if (val == 0)
+    emit(e, 0x31), emit(e, 0xC0); // xor eax, eax
+  else
+    emit(e, 0xB8), emit32(e, val); // mov eax, val
+}
 
-  if (lownib > 9 || cpu->cfa) {
-    addition += 0x06;
+// Translate one instruction, where next_pc is the address of the following
+// one. Returns the kind of the translation.
+static int emit_op(JitEmitter *e, const adc_8080_cpu_uop *uop, uint16_t next_pc) {
+  uint8_t opcode = uop->opcode;
+  uint16_t operand = uop->operand;
+  int dst = (opcode >> 3) & 7;
+  int src = opcode & 7;
+  int rp = (opcode >> 4) & 3;
+
+  // MOV and HLT.
+  if (opcode >= 0x40 && opcode < 0x80) {
+    if (opcode == 0x76)
+      return JIT_OP_UNSUPPORTED;
+    if (dst == 6) {
+      emit(e, 0x0F), emit(e, 0xB6), emit_cpu_operand(e, X86_DX, s_jit_reg_offsets[src]);
+      emit_write_hl(e);
+      return JIT_OP_WRITES;
+    }
+    if (src == 6)
+      emit_read_hl(e);
+    else if (src != dst)
+      emit(e, 0x8A), emit_cpu_operand(e, X86_AX, s_jit_reg_offsets[src]);
+    if (src != dst)
+      emit(e, 0x88), emit_cpu_operand(e, X86_AX, s_jit_reg_offsets[dst]);
+    return JIT_OP_DONE;
   }
 
-  if (highnib > 9 || cpu->cfc || (highnib >= 9 && lownib > 9)) {
-    addition += 0x60;
-    carrybit = 1;
+  // ALU ops on registers, memory and immediates.
+  if ((opcode >= 0x80 && opcode < 0xC0) || (opcode & 0xC7) == 0xC6) {
+    int op = (opcode >> 3) & 7;
+    if (opcode >= 0xC0) {
+      emit_alu(e, op, JIT_SRC_IMM, operand);
+    } else if (src == 6) {
+      emit_read_hl(e);
+      emit(e, 0x88), emit(e, 0xC1); // mov cl, al
+      emit_alu(e, op, JIT_SRC_CL, 0);
+    } else {
+      emit_alu(e, op, JIT_SRC_REG, s_jit_reg_offsets[src]);
+    }
+    return JIT_OP_DONE;
   }
 
-  op_add(cpu, addition, 0);
-  cpu->cfc = carrybit;
-}
-
-static void exec_next(adc_8080_cpu *cpu, uint8_t opcode) {
-  cpu->cycles = s_cycles_lut[opcode];
-
-  if (cpu->interrupt_delay)
-    cpu->interrupt_delay = false;
+  // INR, DCR and MVI.
+  if (opcode < 0x40 && (src == 4 || src == 5 || src == 6)) {
+    if (dst != 6) {
+      if (src == 6) {
+        emit(e, 0xC6), emit_cpu_operand(e, 0, s_jit_reg_offsets[dst]);
+        emit(e, operand);
+      } else {
+        emit_inr_dcr(e, src == 5, s_jit_reg_offsets[dst]);
+      }
+      return JIT_OP_DONE;
+    }
+
+    if (src == 6) {
+      emit(e, 0xBA), emit32(e, operand); // mov edx, operand
+    } else {
+      emit_read_hl(e);
+      emit_inr_dcr(e, src == 5, -1);
+      emit(e, 0x0F), emit(e, 0xB6), emit(e, 0xD0); // movzx edx, al
+    }
+    emit_write_hl(e);
+    return JIT_OP_WRITES;
+  }
 
   switch (opcode) {
-  // Carry bit ops
-  case 0x37: // STC
-    cpu->cfc = 1;
-    break;
-  case 0x3F: // CMC
-    cpu->cfc = !cpu->cfc;
-    break;
-
-  // Single register ops
-  case 0x04: // INR B
-    cpu->rb = op_inr(cpu, cpu->rb);
-    break;
-  case 0x05: // DCR B
-    cpu->rb = op_dcr(cpu, cpu->rb);
-    break;
-  case 0x0C: // INR C
-    cpu->rc = op_inr(cpu, cpu->rc);
-    break;
-  case 0x0D: // DCR C
-    cpu->rc = op_dcr(cpu, cpu->rc);
-    break;
-  case 0x14: // INR D
-    cpu->rd = op_inr(cpu, cpu->rd);
-    break;
-  case 0x15: // DCR D
-    cpu->rd = op_dcr(cpu, cpu->rd);
-    break;
-  case 0x1C: // INR E
-    cpu->re = op_inr(cpu, cpu->re);
-    break;
-  case 0x1D: // DCR E
-    cpu->re = op_dcr(cpu, cpu->re);
-    break;
-  case 0x24: // INR H
-    cpu->rh = op_inr(cpu, cpu->rh);
-    break;
-  case 0x25: // DCR H
-    cpu->rh = op_dcr(cpu, cpu->rh);
-    break;
-  case 0x2C: // INR L
-    cpu->rl = op_inr(cpu, cpu->rl);
-    break;
-  case 0x2D: // DCR L
-    cpu->rl = op_dcr(cpu, cpu->rl);
-    break;
-  case 0x34: // INR M
-    write_byte(cpu, get_rhl(), op_inr(cpu, read_byte(cpu, get_rhl())));
-    break;
-  case 0x35: // DCR M
-    write_byte(cpu, get_rhl(), op_dcr(cpu, read_byte(cpu, get_rhl())));
-    break;
-  case 0x3C: // INR A
-    cpu->ra = op_inr(cpu, cpu->ra);
-    break;
-  case 0x3D: // DCR A
-    cpu->ra = op_dcr(cpu, cpu->ra);
-    break;
-  case 0X2F: // CMA
-    cpu->ra = ~cpu->ra;
-    break;
-  case 0X27: // DAA
-    op_daa(cpu);
-    break;
-
-  // NOP ops
   case 0x00: // NOP
-  case 0X08: // *NOP
-  case 0X10: // *NOP
-  case 0X18: // *NOP
+  case 0x08: // *NOP
+  case 0x10: // *NOP
+  case 0x18: // *NOP
   case 0x20: // *NOP
   case 0x28: // *NOP
   case 0x30: // *NOP
   case 0x38: // *NOP
-    break;
-
-  // Data transfer ops
-  case 0X40: // MOV B,B
-    break;
-  case 0X41: // MOV B,C
-    cpu->rb = cpu->rc;
-    break;
-  case 0X42: // MOV B,D
-    cpu->rb = cpu->rd;
-    break;
-  case 0X43: // MOV B,E
-    cpu->rb = cpu->re;
-    break;
-  case 0X44: // MOV B,H
-    cpu->rb = cpu->rh;
-    break;
-  case 0X45: // MOV B,L
-    cpu->rb = cpu->rl;
-    break;
-  case 0X46: // MOV B,M
-    cpu->rb = read_byte(cpu, get_rhl());
-    break;
-  case 0X47: // MOV B,A
-    cpu->rb = cpu->ra;
-    break;
-  case 0X48: // MOV C,B
-    cpu->rc = cpu->rb;
-    break;
-  case 0X49: // MOV C,C
-    break;
-  case 0X4A: // MOV C,D
-    cpu->rc = cpu->rd;
-    break;
-  case 0X4B: // MOV C,E
-    cpu->rc = cpu->re;
-    break;
-  case 0X4C: // MOV C,H
-    cpu->rc = cpu->rh;
-    break;
-  case 0X4D: // MOV C,L
-    cpu->rc = cpu->rl;
-    break;
-  case 0X4E: // MOV C,M
-    cpu->rc = read_byte(cpu, get_rhl());
-    break;
-  case 0X4F: // MOV C,A
-    cpu->rc = cpu->ra;
-    break;
-  case 0X50: // MOV D,B
-    cpu->rd = cpu->rb;
-    break;
-  case 0X51: // MOV D,C
-    cpu->rd = cpu->rc;
-    break;
-  case 0X52: // MOV D,D
-    break;
-  case 0X53: // MOV D,E
-    cpu->rd = cpu->re;
-    break;
-  case 0X54: // MOV D,H
-    cpu->rd = cpu->rh;
-    break;
-  case 0X55: // MOV D,L
-    cpu->rd = cpu->rl;
-    break;
-  case 0X56: // MOV D,M
-    cpu->rd = read_byte(cpu, get_rhl());
-    break;
-  case 0X57: // MOV D,A
-    cpu->rd = cpu->ra;
-    break;
-  case 0X58: // MOV E,B
-    cpu->re = cpu->rb;
-    break;
-  case 0X59: // MOV E,C
-    cpu->re = cpu->rc;
-    break;
-  case 0X5A: // MOV E,D
-    cpu->re = cpu->rd;
-    break;
-  case 0X5B: // MOV E,E
-    break;
-  case 0X5C: // MOV E,H
-    cpu->re = cpu->rh;
-    break;
-  case 0X5D: // MOV E,L
-    cpu->re = cpu->rl;
-    break;
-  case 0X5E: // MOV E,M
-    cpu->re = read_byte(cpu, get_rhl());
-    break;
-  case 0X5F: // MOV E,A
-    cpu->re = cpu->ra;
-    break;
-  case 0X60: // MOV H,B
-    cpu->rh = cpu->rb;
-    break;
-  case 0X61: // MOV H,C
-    cpu->rh = cpu->rc;
-    break;
-  case 0X62: // MOV H,D
-    cpu->rh = cpu->rd;
-    break;
-  case 0X63: // MOV H,E
-    cpu->rh = cpu->re;
-    break;
-  case 0X64: // MOV H,H
-    break;
-  case 0X65: // MOV H,L
-    cpu->rh = cpu->rl;
-    break;
-  case 0X66: // MOV H,M
-    cpu->rh = read_byte(cpu, get_rhl());
-    break;
-  case 0X67: // MOV H,A
-    cpu->rh = cpu->ra;
-    break;
-  case 0X68: // MOV L,B
-    cpu->rl = cpu->rb;
-    break;
-  case 0X69: // MOV L,C
-    cpu->rl = cpu->rc;
-    break;
-  case 0X6A: // MOV L,D
-    cpu->rl = cpu->rd;
-    break;
-  case 0X6B: // MOV L,E
-    cpu->rl = cpu->re;
-    break;
-  case 0X6C: // MOV L,H
-    cpu->rl = cpu->rh;
-    break;
-  case 0X6D: // MOV L,L
-    break;
-  case 0X6E: // MOV L,M
-    cpu->rl = read_byte(cpu, get_rhl());
-    break;
-  case 0X6F: // MOV L,A
-    cpu->rl = cpu->ra;
-    break;
-  case 0X70: // MOV M,B
-    write_byte(cpu, get_rhl(), cpu->rb);
-    break;
-  case 0X71: // MOV M,C
-    write_byte(cpu, get_rhl(), cpu->rc);
-    break;
-  case 0X72: // MOV M,D
-    write_byte(cpu, get_rhl(), cpu->rd);
-    break;
-  case 0X73: // MOV M,E
-    write_byte(cpu, get_rhl(), cpu->re);
-    break;
-  case 0X74: // MOV M,H
-    write_byte(cpu, get_rhl(), cpu->rh);
-    break;
-  case 0X75: // MOV M,L
-    write_byte(cpu, get_rhl(), cpu->rl);
-    break;
-  case 0X77: // MOV M,A
-    write_byte(cpu, get_rhl(), cpu->ra);
-    break;
-  case 0X78: // MOV A,B
-    cpu->ra = cpu->rb;
-    break;
-  case 0X79: // MOV A,C
-    cpu->ra = cpu->rc;
-    break;
-  case 0X7A: // MOV A,D
-    cpu->ra = cpu->rd;
-    break;
-  case 0X7B: // MOV A,E
-    cpu->ra = cpu->re;
-    break;
-  case 0X7C: // MOV A,H
-    cpu->ra = cpu->rh;
-    break;
-  case 0X7D: // MOV A,L
-    cpu->ra = cpu->rl;
-    break;
-  case 0X7E: // MOV A,M
-    cpu->ra = read_byte(cpu, get_rhl());
-    break;
-  case 0X7F: // MOV A,A
-    break;
-
-  // Register or memory to accumulator ops
-  case 0X80: // ADD B
-    op_add(cpu, cpu->rb, 0);
-    break;
-  case 0X81: // ADD C
-    op_add(cpu, cpu->rc, 0);
-    break;
-  case 0X82: // ADD D
-    op_add(cpu, cpu->rd, 0);
-    break;
-  case 0X83: // ADD E
-    op_add(cpu, cpu->re, 0);
-    break;
-  case 0X84: // ADD H
-    op_add(cpu, cpu->rh, 0);
-    break;
-  case 0X85: // ADD L
-    op_add(cpu, cpu->rl, 0);
-    break;
-  case 0X86: // ADD M
-    op_add(cpu, read_byte(cpu, get_rhl()), 0);
-    break;
-  case 0X87: // ADD A
-    op_add(cpu, cpu->ra, 0);
-    break;
-  case 0X88: // ADC B
-    op_add(cpu, cpu->rb, cpu->cfc);
-    break;
-  case 0X89: // ADC C
-    op_add(cpu, cpu->rc, cpu->cfc);
-    break;
-  case 0X8A: // ADC D
-    op_add(cpu, cpu->rd, cpu->cfc);
-    break;
-  case 0X8B: // ADC E
-    op_add(cpu, cpu->re, cpu->cfc);
-    break;
-  case 0X8C: // ADC H
-    op_add(cpu, cpu->rh, cpu->cfc);
-    break;
-  case 0X8D: // ADC L
-    op_add(cpu, cpu->rl, cpu->cfc);
-    break;
-  case 0X8E: // ADC M
-    op_add(cpu, read_byte(cpu, get_rhl()), cpu->cfc);
-    break;
-  case 0X8F: // ADC A
-    op_add(cpu, cpu->ra, cpu->cfc);
-    break;
-  case 0X90: // SUB B
-    op_sub(cpu, cpu->rb, 0);
-    break;
-  case 0X91: // SUB C
-    op_sub(cpu, cpu->rc, 0);
-    break;
-  case 0X92: // SUB D
-    op_sub(cpu, cpu->rd, 0);
-    break;
-  case 0X93: // SUB E
-    op_sub(cpu, cpu->re, 0);
-    break;
-  case 0X94: // SUB H
-    op_sub(cpu, cpu->rh, 0);
-    break;
-  case 0X95: // SUB L
-    op_sub(cpu, cpu->rl, 0);
-    break;
-  case 0X96: // SUB M
-    op_sub(cpu, read_byte(cpu, get_rhl()), 0);
-    break;
-  case 0X97: // SUB A
-    op_sub(cpu, cpu->ra, 0);
-    break;
-  case 0X98: // SBB B
-    op_sub(cpu, cpu->rb, cpu->cfc);
-    break;
-  case 0X99: // SBB C
-    op_sub(cpu, cpu->rc, cpu->cfc);
-    break;
-  case 0X9A: // SBB D
-    op_sub(cpu, cpu->rd, cpu->cfc);
-    break;
-  case 0X9B: // SBB E
-    op_sub(cpu, cpu->re, cpu->cfc);
-    break;
-  case 0X9C: // SBB H
-    op_sub(cpu, cpu->rh, cpu->cfc);
-    break;
-  case 0X9D: // SBB L
-    op_sub(cpu, cpu->rl, cpu->cfc);
-    break;
-  case 0X9E: // SBB M
-    op_sub(cpu, read_byte(cpu, get_rhl()), cpu->cfc);
-    break;
-  case 0X9F: // SBB A
-    op_sub(cpu, cpu->ra, cpu->cfc);
-    break;
-  case 0XA0: // ANA B
-    op_ana(cpu, cpu->rb);
-    break;
-  case 0XA1: // ANA C
-    op_ana(cpu, cpu->rc);
-    break;
-  case 0XA2: // ANA D
-    op_ana(cpu, cpu->rd);
-    break;
-  case 0XA3: // ANA E
-    op_ana(cpu, cpu->re);
-    break;
-  case 0XA4: // ANA H
-    op_ana(cpu, cpu->rh);
-    break;
-  case 0XA5: // ANA L
-    op_ana(cpu, cpu->rl);
-    break;
-  case 0XA6: // ANA M
-    op_ana(cpu, read_byte(cpu, get_rhl()));
-    break;
-  case 0XA7: // ANA A
-    op_ana(cpu, cpu->ra);
-    break;
-  case 0XA8: // XRA B
-    op_xra(cpu, cpu->rb);
-    break;
-  case 0XA9: // XRA C
-    op_xra(cpu, cpu->rc);
-    break;
-  case 0XAA: // XRA D
-    op_xra(cpu, cpu->rd);
-    break;
-  case 0XAB: // XRA E
-    op_xra(cpu, cpu->re);
-    break;
-  case 0XAC: // XRA H
-    op_xra(cpu, cpu->rh);
-    break;
-  case 0XAD: // XRA L
-    op_xra(cpu, cpu->rl);
-    break;
-  case 0XAE: // XRA M
-    op_xra(cpu, read_byte(cpu, get_rhl()));
-    break;
-  case 0XAF: // XRA A
-    op_xra(cpu, cpu->ra);
-    break;
-  case 0XB0: // ORA B
-    op_ora(cpu, cpu->rb);
-    break;
-  case 0XB1: // ORA C
-    op_ora(cpu, cpu->rc);
-    break;
-  case 0XB2: // ORA D
-    op_ora(cpu, cpu->rd);
-    break;
-  case 0XB3: // ORA E
-    op_ora(cpu, cpu->re);
-    break;
-  case 0XB4: // ORA H
-    op_ora(cpu, cpu->rh);
-    break;
-  case 0XB5: // ORA L
-    op_ora(cpu, cpu->rl);
-    break;
-  case 0XB6: // ORA M
-    op_ora(cpu, read_byte(cpu, get_rhl()));
-    break;
-  case 0XB7: // ORA A
-    op_ora(cpu, cpu->ra);
-    break;
-  case 0XB8: // CMP B
-    op_cmp(cpu, cpu->rb);
-    break;
-  case 0XB9: // CMP C
-    op_cmp(cpu, cpu->rc);
-    break;
-  case 0XBA: // CMP D
-    op_cmp(cpu, cpu->rd);
-    break;
-  case 0XBB: // CMP E
-    op_cmp(cpu, cpu->re);
-    break;
-  case 0XBC: // CMP H
-    op_cmp(cpu, cpu->rh);
-    break;
-  case 0XBD: // CMP L
-    op_cmp(cpu, cpu->rl);
-    break;
-  case 0XBE: // CMP M
-    op_cmp(cpu, read_byte(cpu, get_rhl()));
-    break;
-  case 0XBF: // CMP A
-    op_cmp(cpu, cpu->ra);
-    break;
-
-  // Rotate accumulator opts
-  case 0X07: // RLC
-    op_rlc(cpu);
-    break;
-  case 0X0F: // RRC
-    op_rrc(cpu);
-    break;
-  case 0X17: // RAL
-    op_ral(cpu);
-    break;
-  case 0X1F: // RAR
-    op_rar(cpu);
-    break;
-
-  // Register pair ops
-  case 0XC5: // PUSH B
-    stack_push(cpu, get_rbc());
-    break;
-  case 0XD5: // PUSH D
-    stack_push(cpu, get_rde());
-    break;
-  case 0XE5: // PUSH H
-    stack_push(cpu, get_rhl());
-    break;
-  case 0XF5: // PUSH PSW
-    op_push_psw(cpu);
-    break;
-  case 0XC1: // POP B
-    set_rbc(stack_pop(cpu));
-    break;
-  case 0XD1: // POP D
-    set_rde(stack_pop(cpu));
-    break;
-  case 0XE1: // POP H
-    set_rhl(stack_pop(cpu));
-    break;
-  case 0XF1: // POP PSW
-    op_pop_psw(cpu);
-    break;
-  case 0X09: // DAD B
-    op_dad(cpu, get_rbc());
-    break;
-  case 0X19: // DAD D
-    op_dad(cpu, get_rde());
-    break;
-  case 0X29: // DAD H
-    op_dad(cpu, get_rhl());
-    break;
-  case 0X39: // DAD SP
-    op_dad(cpu, cpu->sp);
-    break;
-  case 0X03: // INX B
-    set_rbc(get_rbc() + 1);
-    break;
-  case 0X13: // INX D
-    set_rde(get_rde() + 1);
-    break;
-  case 0X23: // INX H
-    set_rhl(get_rhl() + 1);
-    break;
-  case 0X33: // INX SP
-    cpu->sp++;
-    break;
+    return JIT_OP_DONE;
+
+  case 0x01: // LXI B
+  case 0x11: // LXI D
+  case 0x21: // LXI H
+  case 0x31: // LXI SP
+    emit(e, 0x66), emit(e, 0xC7), emit_cpu_operand(e, 0, s_jit_pair_offsets[rp]);
+    emit16(e, rp == 3 ? operand : (operand >> 8) | (operand << 8));
+    return JIT_OP_DONE;
+
+  case 0x03: // INX B
+  case 0x13: // INX D
+  case 0x23: // INX H
   case 0x0B: // DCX B
-    set_rbc(get_rbc() - 1);
-    break;
   case 0x1B: // DCX D
-    set_rde(get_rde() - 1);
-    break;
-  case 0X2B: // DCX H
-    set_rhl(get_rhl() - 1);
-    break;
+  case 0x2B: // DCX H
+    emit_load_pair(e, X86_AX, rp);
+    emit(e, 0xFF), emit(e, (opcode & 0x08) ? 0xC8 : 0xC0); // inc/dec eax
+    emit_store_pair(e, rp);
+    return JIT_OP_DONE;
+  case 0x33: // INX SP
   case 0x3B: // DCX SP
-    cpu->sp--;
-    break;
-  case 0XEB: // XCHG
-    op_xchg(cpu);
-    break;
-  case 0XE3: // XTHL
-    op_xthl(cpu);
-    break;
-  case 0XF9: // SPHL
-    cpu->sp = get_rhl();
-    break;
-
-  // Immediate ops
-  case 0X01: // LXI B
-    set_rbc(next_word(cpu));
-    break;
-  case 0X11: // LXI D
-    set_rde(next_word(cpu));
-    break;
-  case 0X21: // LXI H
-    set_rhl(next_word(cpu));
-    break;
-  case 0X31: // LXI SP
-    cpu->sp = next_word(cpu);
-    break;
-  case 0X06: // MVI B
-    cpu->rb = next_byte(cpu);
-    break;
-  case 0X0E: // MVI C
-    cpu->rc = next_byte(cpu);
-    break;
-  case 0X16: // MVI D
-    cpu->rd = next_byte(cpu);
-    break;
-  case 0X1E: // MVI E
-    cpu->re = next_byte(cpu);
-    break;
-  case 0X26: // MVI H
-    cpu->rh = next_byte(cpu);
-    break;
-  case 0X2E: // MVI L
-    cpu->rl = next_byte(cpu);
-    break;
-  case 0X36: // MVI M
-    write_byte(cpu, get_rhl(), next_byte(cpu));
-    break;
-  case 0X3E: // MVI A
-    cpu->ra = next_byte(cpu);
-    break;
-  case 0XC6: // ADI
-    op_add(cpu, next_byte(cpu), 0);
-    break;
-  case 0XCE: // ACI
-    op_add(cpu, next_byte(cpu), cpu->cfc);
-    break;
-  case 0XD6: // SUI
-    op_sub(cpu, next_byte(cpu), 0);
-    break;
-  case 0XDE: // SBI
-    op_sub(cpu, next_byte(cpu), cpu->cfc);
-    break;
-  case 0XE6: // ANI
-    op_ana(cpu, next_byte(cpu));
-    break;
-  case 0XEE: // XRI
-    op_xra(cpu, next_byte(cpu));
-    break;
-  case 0XF6: // ORI
-    op_ora(cpu, next_byte(cpu));
-    break;
-  case 0XFE: // CPI
-    op_cmp(cpu, next_byte(cpu));
-    break;
-
-  // Direct addressing ops
-  case 0X02: // STAX B
-    write_byte(cpu, get_rbc(), cpu->ra);
-    break;
-  case 0X12: // STAX D
-    write_byte(cpu, get_rde(), cpu->ra);
-    break;
-  case 0X32: // STA
-    write_byte(cpu, next_word(cpu), cpu->ra);
-    break;
-  case 0X0A: // LDAX B
-    cpu->ra = read_byte(cpu, get_rbc());
-    break;
-  case 0X1A: // LDAX D
-    cpu->ra = read_byte(cpu, get_rde());
-    break;
-  case 0X3A: // LDA
-    cpu->ra = read_byte(cpu, next_word(cpu));
-    break;
-  case 0X22: // SHLD
-    write_word(cpu, next_word(cpu), get_rhl());
-    break;
-  case 0X2A: // LHLD
-    set_rhl(read_word(cpu, next_word(cpu)));
-    break;
-
-  // Jump ops
-  case 0XE9: // PCHL
-    cpu->pc = get_rhl();
-    break;
-  case 0XC2: // JNZ
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfz == 0);
-    break;
-  case 0XC3: // JMP
-  case 0XCB: // *JMP
-    cpu->pc = next_word(cpu);
-    break;
-  case 0XCA: // JZ
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfz == 1);
-    break;
-  case 0XD2: // JNC
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfc == 0);
-    break;
-  case 0XDA: // JC
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfc == 1);
-    break;
-  case 0XE2: // JPO
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfp == 0);
-    break;
-  case 0XEA: // JPE
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfp == 1);
-    break;
-  case 0XF2: // JP
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfs == 0);
-    break;
-  case 0XFA: // JM
-    op_jmp_cond(cpu, next_word(cpu), cpu->cfs == 1);
-    break;
-
-  // Call ops
-  case 0XCD: // CALL
-  case 0XDD: // *CALL
-  case 0XED: // *CALL
-  case 0XFD: // *CALL
-    op_call(cpu, next_word(cpu));
-    break;
-  case 0XDC: // CC
-    op_call_cond(cpu, next_word(cpu), cpu->cfc == 1);
-    break;
-  case 0XD4: // CNC
-    op_call_cond(cpu, next_word(cpu), cpu->cfc == 0);
-    break;
-  case 0XCC: // CZ
-    op_call_cond(cpu, next_word(cpu), cpu->cfz == 1);
-    break;
-  case 0XC4: // CNZ
-    op_call_cond(cpu, next_word(cpu), cpu->cfz == 0);
-    break;
-  case 0XF4: // CP
-    op_call_cond(cpu, next_word(cpu), cpu->cfs == 0);
-    break;
-  case 0XFC: // CM
-    op_call_cond(cpu, next_word(cpu), cpu->cfs == 1);
-    break;
-  case 0XEC: // CPE
-    op_call_cond(cpu, next_word(cpu), cpu->cfp == 1);
-    break;
-  case 0XE4: // CPO
-    op_call_cond(cpu, next_word(cpu), cpu->cfp == 0);
-    break;
-
-  // Return ops
-  case 0XC9: // RET
-  case 0XD9: // *RET
-    cpu->pc = stack_pop(cpu);
-    break;
-  case 0XD8: // RC
-    op_ret_cond(cpu, cpu->cfc == 1);
-    break;
-  case 0XD0: // RNC
-    op_ret_cond(cpu, cpu->cfc == 0);
-    break;
-  case 0XC8: // RZ
-    op_ret_cond(cpu, cpu->cfz == 1);
-    break;
-  case 0XC0: // RNZ
-    op_ret_cond(cpu, cpu->cfz == 0);
-    break;
-  case 0XF8: // RM
-    op_ret_cond(cpu, cpu->cfs == 1);
-    break;
-  case 0XF0: // RP
-    op_ret_cond(cpu, cpu->cfs == 0);
-    break;
-  case 0XE8: // RPE
-    op_ret_cond(cpu, cpu->cfp == 1);
-    break;
-  case 0XE0: // RPO
-    op_ret_cond(cpu, cpu->cfp == 0);
-    break;
-
-  // RST ops
-  case 0XC7: // RST 0
-    op_call(cpu, 0x00);
-    break;
-  case 0XCF: // RST 1
-    op_call(cpu, 0x08);
-    break;
-  case 0XD7: // RST 2
-    op_call(cpu, 0x10);
-    break;
-  case 0XDF: // RST 3
-    op_call(cpu, 0x18);
-    break;
-  case 0XE7: // RST 4
-    op_call(cpu, 0x20);
-    break;
-  case 0XEF: // RST 5
-    op_call(cpu, 0x28);
-    break;
-  case 0XF7: // RST 6
-    op_call(cpu, 0x30);
-    break;
-  case 0XFF: // RST 7
-    op_call(cpu, 0x38);
-    break;
-
-  // INTE flip-flop ops
-  case 0XFB: // EI
-    cpu->inte = true;
-    cpu->interrupt_delay = true;
-    break;
-  case 0XF3: // DI
-    cpu->inte = false;
-    break;
-
-  // Device read/write ops
-  case 0XDB: // IN
-    cpu->ra = cpu->read_device(cpu, next_byte(cpu));
-    break;
-  case 0XD3: // OUT
-    cpu->write_device(cpu, next_byte(cpu), cpu->ra);
-    break;
-
-  // HLT ops
-  case 0X76: // HLT
-    cpu->halted = true;
-    break;
-
-  default:
-    break;
+    emit(e, 0x66), emit(e, 0xFF);
+    emit_cpu_operand(e, (opcode & 0x08) ? 1 : 0, CPU_OFFSET(sp)); // inc/dec [sp]
+    return JIT_OP_DONE;
+
+  case 0x09: // DAD B
+  case 0x19: // DAD D
+  case 0x29: // DAD H
+  case 0x39: // DAD SP
+    emit_load_pair(e, X86_AX, 2);
+    emit_load_pair(e, X86_CX, rp);
+    emit(e, 0x66), emit(e, 0x01), emit(e, 0xC8); // add ax, cx
+    emit_store_carry(e);
+    emit_store_pair(e, 2);
+    return JIT_OP_DONE;
+
+  case 0x02: // STAX B
+  case 0x12: // STAX D
+    emit(e, 0x0F), emit(e, 0xB6), emit_cpu_operand(e, X86_DX, CPU_OFFSET(ra));
+    emit_load_pair(e, X86_SI, rp);
+    emit_call(e, (uintptr_t)e->helpers->write_byte);
+    return JIT_OP_WRITES;
+  case 0x0A: // LDAX B
+  case 0x1A: // LDAX D
+    emit_load_pair(e, X86_SI, rp);
+    emit_call(e, (uintptr_t)e->helpers->read_byte);
+    emit(e, 0x88), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra));
+    return JIT_OP_DONE;
+  case 0x32: // STA
+    emit(e, 0x0F), emit(e, 0xB6), emit_cpu_operand(e, X86_DX, CPU_OFFSET(ra));
+    emit(e, 0xBE), emit32(e, operand); // mov esi, operand
+    emit_call(e, (uintptr_t)e->helpers->write_byte);
+    return JIT_OP_WRITES;
+  case 0x3A: // LDA
+    emit(e, 0xBE), emit32(e, operand); // mov esi, operand
+    emit_call(e, (uintptr_t)e->helpers->read_byte);
+    emit(e, 0x88), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra));
+    return JIT_OP_DONE;
+  case 0x22: // SHLD
+    emit_load_pair(e, X86_DX, 2);
+    emit(e, 0xBE), emit32(e, operand); // mov esi, operand
+    emit_call(e, (uintptr_t)e->helpers->write_word);
+    return JIT_OP_WRITES;
+  case 0x2A: // LHLD
+    emit(e, 0xBE), emit32(e, operand); // mov esi, operand
+    emit_call(e, (uintptr_t)e->helpers->read_word);
+    emit_store_pair(e, 2);
+    return JIT_OP_DONE;
+
+  case 0x07: // RLC
+  case 0x0F: // RRC
+  case 0x17: // RAL
+  case 0x1F: // RAR
+    if (opcode == 0x17 || opcode == 0x1F)
+      emit_load_psw_to_flags(e);
+    emit(e, 0x8A), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra));
+    emit(e, 0xD0), emit(e, 0xC0 | ((opcode >> 3) & 3) << 3); // rol/ror/rcl/rcr al, 1
+    emit(e, 0x88), emit_cpu_operand(e, X86_AX, CPU_OFFSET(ra));
+    emit_store_carry(e);
+    return JIT_OP_DONE;
+
+  case 0x2F: // CMA
+    emit(e, 0xF6), emit_cpu_operand(e, 2, CPU_OFFSET(ra)); // not [ra]
+    return JIT_OP_DONE;
+  case 0x37: // STC
+    emit(e, 0x80), emit_cpu_operand(e, 1, CPU_OFFSET(psw)), emit(e, adc::FLAG_C);
+    return JIT_OP_DONE;
+  case 0x3F: // CMC
+    emit(e, 0x80), emit_cpu_operand(e, 6, CPU_OFFSET(psw)), emit(e, adc::FLAG_C);
+    return JIT_OP_DONE;
+
+  case 0xEB: // XCHG
+    emit(e, 0x66), emit(e, 0x8B), emit_cpu_operand(e, X86_AX, CPU_OFFSET(rd));
+    emit(e, 0x66), emit(e, 0x8B), emit_cpu_operand(e, X86_CX, CPU_OFFSET(rh));
+    emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_CX, CPU_OFFSET(rd));
+    emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_AX, CPU_OFFSET(rh));
+    return JIT_OP_DONE;
+  case 0xF9: // SPHL
+    emit_load_pair(e, X86_AX, 2);
+    emit_store_pair(e, 3);
+    return JIT_OP_DONE;
+
+  case 0xC5: // PUSH B
+  case 0xD5: // PUSH D
+  case 0xE5: // PUSH H
+    emit_load_pair(e, X86_DX, rp);
+    emit_push(e);
+    return JIT_OP_WRITES;
+  case 0xF5: // PUSH PSW
+    emit(e, 0x0F), emit(e, 0xB6), emit_cpu_operand(e, X86_DX, CPU_OFFSET(ra));
+    emit(e, 0xC1), emit(e, 0xE2), emit(e, 8); // shl edx, 8
+    emit(e, 0x8A), emit_cpu_operand(e, X86_DX, CPU_OFFSET(psw));
+    emit_push(e);
+    return JIT_OP_WRITES;
+  case 0xC1: // POP B
+  case 0xD1: // POP D
+  case 0xE1: // POP H
+    emit_pop(e);
+    emit_store_pair(e, rp);
+    return JIT_OP_DONE;
+  case 0xF1: // POP PSW
+    emit_pop(e);
+    emit(e, 0x88), emit_cpu_operand(e, X86_AH, CPU_OFFSET(ra));
+    emit(e, 0x24), emit(e, adc::FLAG_MASK);     // and al, FLAG_MASK
+    emit(e, 0x0C), emit(e, adc::FLAG_ONE);      // or al, FLAG_ONE
+    emit(e, 0x88), emit_cpu_operand(e, X86_AX, CPU_OFFSET(psw));
+    return JIT_OP_DONE;
+
+  case 0xC3: // JMP
+  case 0xCB: // *JMP
+    emit_set_pc(e, operand);
+    emit_return(e, 0);
+    return JIT_OP_EXITS;
+  case 0xCD: // CALL
+  case 0xDD: // *CALL
+  case 0xED: // *CALL
+  case 0xFD: // *CALL
+    emit(e, 0xBA), emit32(e, next_pc); // mov edx, next_pc
+    emit_push(e);
+    emit_set_pc(e, operand);
+    emit_return(e, 0);
+    return JIT_OP_EXITS;
+  case 0xC9: // RET
+  case 0xD9: // *RET
+    emit_pop(e);
+    emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_AX, CPU_OFFSET(pc));
+    emit_return(e, 0);
+    return JIT_OP_EXITS;
+  case 0xE9: // PCHL
+    emit_load_pair(e, X86_AX, 2);
+    emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_AX, CPU_OFFSET(pc));
+    emit_return(e, 0);
+    return JIT_OP_EXITS;
+  }
+
+  if ((opcode & 0xC7) == 0xC7) { // RST
+    emit(e, 0xBA), emit32(e, next_pc); // mov edx, next_pc
+    emit_push(e);
+    emit_set_pc(e, opcode & 0x38);
+    emit_return(e, 0);
+    return JIT_OP_EXITS;
+  }
+
+  if ((opcode & 0xC7) == 0xC2) { // Jcc
+    emit_return(e, 0);
+    emit_set_pc(e, next_pc);
+    uint8_t *skip = emit_skip_unless(e, opcode);
+    emit_set_pc(e, operand);
+    patch_jump(e, skip);
+    return JIT_OP_EXITS;
+  }
+
+  if ((opcode & 0xC7) == 0xC4) { // Ccc
+    emit_return(e, 0);
+    emit_set_pc(e, next_pc);
+    uint8_t *skip = emit_skip_unless(e, opcode);
+    emit(e, 0xBA), emit32(e, next_pc); // mov edx, next_pc
+    emit_push(e);
+    emit_set_pc(e, operand);
+    emit_return(e, 6);
+    patch_jump(e, skip);
+    return JIT_OP_EXITS;
   }
+
+  if ((opcode & 0xC7) == 0xC0) { // Rcc
+    emit_return(e, 0);
+    emit_set_pc(e, next_pc);
+    uint8_t *skip = emit_skip_unless(e, opcode);
+    emit_pop(e);
+    emit(e, 0x66), emit(e, 0x89), emit_cpu_operand(e, X86_AX, CPU_OFFSET(pc));
+    emit_return(e, 6);
+    patch_jump(e, skip);
+    return JIT_OP_EXITS;
+  }
+
+  // DAA, XTHL, IN, OUT, EI, DI.
+  return JIT_OP_UNSUPPORTED;
+}
+
+adc::NativeBlock adc::jit_translate(adc_8080_cpu *cpu,
+                                    const adc_8080_cpu_block *block,
+                                    const JitHelpers *helpers) {
+  adc_8080_cpu_jit *jit = cpu->jit;
+  if (mprotect(jit->code, jit->code_size, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+
+  JitEmitter e = {jit->code + jit->code_used, jit->code + jit->code_size,
+                  helpers};
+  uint8_t *start = e.p;
+
+  emit_prologue(&e, &cpu->block_cache->generation);
+
+  uint16_t pc = block->pc;
+  int remaining_cycles = block->cycles;
+  int kind = JIT_OP_DONE;
+  for (int i = 0; i < block->count; i++) {
+    const adc_8080_cpu_uop *uop = &block->ops[i];
+    uint16_t next_pc = pc + uop->length;
+    bool last = i == block->count - 1;
+    remaining_cycles -= s_cycles_lut[uop->opcode];
+
+    kind = emit_op(&e, uop, next_pc);
+    if (kind == JIT_OP_UNSUPPORTED) {
+      // Interpret the instruction from memory. When it ends the block it sets
+      // the pc, and may take extra cycles.
+      emit_set_pc(&e, pc);
+      emit_call(&e, (uintptr_t)helpers->step);
+      if (last) {
+        emit(&e, 0x2D), emit32(&e, s_cycles_lut[uop->opcode]); // sub eax, cycles
+        kind = JIT_OP_EXITS;
+      } else {
+        kind = JIT_OP_WRITES;
+      }
+    }
+
+    if (kind == JIT_OP_WRITES && !last) {
+      // Leave if the write invalidated any cached code, giving back the
+      // cycles of the instructions which are skipped.
+      emit(&e, 0x44), emit(&e, 0x39), emit(&e, 0x65), emit(&e, 0x00); // cmp [rbp], r12d
+      uint8_t *skip = emit_jump(&e, 0x74);                           // je
+      emit_set_pc(&e, next_pc);
+      emit_return(&e, -remaining_cycles);
+      emit_epilogue(&e);
+      patch_jump(&e, skip);
+    }
+
+    pc = next_pc;
+  }
+
+  if (kind != JIT_OP_EXITS) {
+    emit_set_pc(&e, pc);
+    emit_return(&e, 0);
+  }
+  emit_epilogue(&e);
+
+  // Failing to make the code executable again leaves every translation
+  // unusable, and the caller flushes them when NULL is returned.
+  if (mprotect(jit->code, jit->code_size, PROT_READ | PROT_EXEC) != 0 ||
+      e.p > e.end)
+    return NULL;
+
+  // Keep the translations 16-byte aligned.
+  jit->code_used = ((e.p - jit->code) + 15) & ~15;
+  if (jit->code_used > jit->code_size)
+    jit->code_used = jit->code_size;
+  jit->translated_blocks++;
+  return (NativeBlock)start;
+}
+
+void adc::jit_flush(adc_8080_cpu *cpu) {
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  for (int i = 0; i < ADC_8080_CPU_BLOCK_CACHE_SIZE; i++)
+    cache->blocks[i].native = NULL;
+  cpu->jit->code_used = 0;
+  cpu->jit->code_flushes++;
 }
+
+#undef CPU_OFFSET
+
+#endif // ADC_8080_CPU_JIT
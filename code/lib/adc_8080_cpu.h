@@ -18,18 +18,338 @@
 #define ADC_8080_CPU_VERSION_MINOR 4
 #define ADC_8080_CPU_VERSION_PATCH 1
 
+// Allow overriding of THREADED_DISPATCH.
+// When enabled each opcode handler jumps straight to the next handler through
+// a table of label addresses (computed goto), giving every opcode its own
+// indirect branch. Otherwise a single switch is used, which is also the
+// fallback for compilers without the labels as values extension.
+#ifndef ADC_8080_CPU_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define ADC_8080_CPU_THREADED_DISPATCH 1
+#else
+#define ADC_8080_CPU_THREADED_DISPATCH 0
+#endif
+#endif
+
+// Allow overriding of LAZY_FLAGS.
+// When enabled the ALU ops only record their operation, operands and result,
+// and the sign, zero, parity and aux carry flags are derived from that record
+// when a conditional jump/call/ret, DAA or PUSH PSW reads them. The carry flag
+// is always kept up to date since ADC, SBB and the rotates consume it. Must be
+// set the same way for every translation unit including this header.
+#ifndef ADC_8080_CPU_LAZY_FLAGS
+#define ADC_8080_CPU_LAZY_FLAGS 0
+#endif
+
+// Allow overriding of JIT.
+// When enabled hot blocks in the block cache can be translated into native
+// code, see adc_8080_cpu_set_jit(). Only x86-64 with the System V abi (Linux
+// and macOS) is supported, and not with LAZY_FLAGS since the translated code
+// keeps every flag up to date.
+#ifndef ADC_8080_CPU_JIT
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) &&       \
+    !ADC_8080_CPU_LAZY_FLAGS
+#define ADC_8080_CPU_JIT 1
+#else
+#define ADC_8080_CPU_JIT 0
+#endif
+#endif
+
+// Number of times a block runs before the jit translates it.
+#ifndef ADC_8080_CPU_JIT_THRESHOLD
+#define ADC_8080_CPU_JIT_THRESHOLD 16
+#endif
+
+// Allow overriding of PROFILE.
+// When enabled every instruction executed is counted in the profile attached
+// with adc_8080_cpu_set_profile(), if any. Disabled by default since even with
+// no profile attached it costs a branch per instruction. Must be set the same
+// way for every translation unit including this header.
+#ifndef ADC_8080_CPU_PROFILE
+#define ADC_8080_CPU_PROFILE 0
+#endif
+
+// Allow overriding of TRACE.
+// When enabled every instruction executed is recorded in the trace attached
+// with adc_8080_cpu_set_trace(), if any. Disabled by default for the same
+// reason as PROFILE, and must also be set the same way for every translation
+// unit including this header.
+#ifndef ADC_8080_CPU_TRACE
+#define ADC_8080_CPU_TRACE 0
+#endif
+
+// Allow overriding of COVERAGE.
+// When enabled the addresses and taken branches the cpu executes are recorded
+// in the coverage attached with adc_8080_cpu_set_coverage(), if any. Blocks
+// are recorded as a whole when they start, so the cost is a branch per block
+// rather than per instruction. Disabled by default, and must be set the same
+// way for every translation unit including this header.
+#ifndef ADC_8080_CPU_COVERAGE
+#define ADC_8080_CPU_COVERAGE 0
+#endif
+
+// Number of entries in the coverage edge map (a power of two, at most 65536),
+// and how many of them are probed for an edge before it is dropped.
+#ifndef ADC_8080_CPU_COVERAGE_EDGES
+#define ADC_8080_CPU_COVERAGE_EDGES 4096
+#endif
+#define ADC_8080_CPU_COVERAGE_PROBES 16
+
+// The address space is split into 1 KB pages for the memory page tables.
+#define ADC_8080_CPU_PAGE_SHIFT 10
+#define ADC_8080_CPU_PAGE_SIZE (1 << ADC_8080_CPU_PAGE_SHIFT)
+#define ADC_8080_CPU_PAGE_COUNT (0x10000 >> ADC_8080_CPU_PAGE_SHIFT)
+
+// Memory mapping flags.
+enum { ADC_8080_CPU_MAP_READ = 1 << 0, ADC_8080_CPU_MAP_WRITE = 1 << 1 };
+
+// A block holds at most BLOCK_MAX_OPS instructions, and the block cache is
+// direct mapped on the block address with BLOCK_CACHE_SIZE entries (a power of
+// two).
+#define ADC_8080_CPU_BLOCK_MAX_OPS 16
+#define ADC_8080_CPU_BLOCK_CACHE_SIZE 4096
+
+// A pre-decoded instruction.
+typedef struct {
+  uint8_t opcode;
+  uint8_t length;
+  uint16_t operand; // Immediate byte or word, if any.
+} adc_8080_cpu_uop;
+
+// A straight-line run of instructions decoded from a single page. A block ends
+// after the first jump, call, return, restart, IN, OUT, EI or HLT instruction,
+// or before an instruction which would cross into the next page.
+typedef struct {
+  uint16_t pc;          // Address of the first instruction.
+  uint16_t end_pc;      // Address following the last instruction.
+  uint16_t cycles;      // Cycles of all the instructions, conditions not met.
+  uint16_t last_cycles; // Cycles of the last instruction.
+  uint32_t generation;  // Generation of the page when the block was decoded.
+  uint8_t count;        // Number of instructions, 0 for an empty entry.
+  uint16_t hits;        // Times the block has run, until it is translated.
+  void *native;         // Native translation of the block, or NULL.
+  bool idle_loop;       // Only reads and jumps back to itself, may be idle.
+  adc_8080_cpu_uop ops[ADC_8080_CPU_BLOCK_MAX_OPS];
+} adc_8080_cpu_block;
+
+typedef struct {
+  // A page generation is bumped when a write may have modified code decoded
+  // from the page, which invalidates all of its blocks.
+  uint32_t page_generations[ADC_8080_CPU_PAGE_COUNT];
+
+  // Bumped on every invalidation so a running block can stop when it modifies
+  // itself.
+  uint32_t generation;
+
+  adc_8080_cpu_block blocks[ADC_8080_CPU_BLOCK_CACHE_SIZE];
+} adc_8080_cpu_block_cache;
+
+// Jit flags.
+enum {
+  // Run every translated block in lockstep with the interpreter and count the
+  // blocks where the two disagree.
+  ADC_8080_CPU_JIT_VALIDATE = 1 << 0
+};
+
+typedef struct {
+  // Executable memory the translations are written to. When it fills up all
+  // translations are dropped and it is reused.
+  uint8_t *code;
+  uint32_t code_size;
+  uint32_t code_used;
+  int flags;
+
+  // Stats.
+  uint32_t translated_blocks;
+  uint32_t code_flushes;
+  uint64_t validated_blocks;
+  uint32_t mismatches;
+  uint16_t mismatch_pc; // Address of the latest block which failed validation.
+
+  // Memory writes and device accesses recorded from the interpreter while
+  // validating, which the translated block is replayed against.
+  bool replaying;
+  bool replay_failed;
+  int write_count;
+  int replay_write_count;
+  int io_count;
+  int replay_io_count;
+  struct {
+    uint16_t addr;
+    uint8_t old_val;
+    uint8_t val;
+  } writes[64], replay_writes[64];
+  struct {
+    uint8_t device;
+    uint8_t val;
+    bool out;
+  } io[4];
+} adc_8080_cpu_jit;
+
+// Executions and cycles counted per opcode and per instruction address.
+typedef struct {
+  uint64_t opcode_counts[256];
+  uint64_t opcode_cycles[256];
+  uint64_t pc_counts[0x10000];
+  uint64_t pc_cycles[0x10000];
+
+  // The latest opcode executed at each address.
+  uint8_t pc_opcodes[0x10000];
+
+  // The latest instruction, charged the extra cycles of a taken conditional
+  // call or return.
+  uint16_t last_pc;
+  uint8_t last_opcode;
+} adc_8080_cpu_profile;
+
+// A profiled instruction address, see adc_8080_cpu_profile_hot_spots().
+typedef struct {
+  uint16_t pc;
+  uint8_t opcode;
+  uint64_t count;
+  uint64_t cycles;
+} adc_8080_cpu_hot_spot;
+
+// Trace record flags.
+enum {
+  ADC_8080_CPU_TRACE_INTERRUPT = 1 << 0, // Run from an interrupt request.
+  ADC_8080_CPU_TRACE_INTE = 1 << 1       // Interrupts were enabled.
+};
+
+// A traced instruction and the cpu state before it ran.
+typedef struct {
+  uint64_t cycles; // Cycles the cpu had run before the instruction.
+  uint16_t pc;
+  uint16_t sp;
+  uint16_t operand; // Immediate byte or word, if any.
+  uint8_t opcode;
+  uint8_t psw;
+  uint8_t ra, rb, rc, rd, re, rh, rl;
+  uint8_t flags;
+} adc_8080_cpu_trace_record;
+
+// A ring buffer holding the latest traced instructions.
+typedef struct {
+  adc_8080_cpu_trace_record *records;
+  uint32_t capacity; // A power of two.
+  uint64_t count;    // Records written, including those overwritten.
+  uint64_t cycles;
+} adc_8080_cpu_trace;
+
+// A taken branch from the instruction at from to the instruction at to, and
+// the times it was taken (saturating). Empty edge map entries have no count.
+typedef struct {
+  uint16_t from;
+  uint16_t to;
+  uint32_t count;
+} adc_8080_cpu_coverage_edge;
+
+// The addresses executed, as a bit per byte of every instruction run (the
+// opcode and its operands), and the taken branches hashed into a fixed size
+// map. An instruction is taken to branch when the next one run isn't the one
+// following it in memory, which includes returns but not interrupts.
 typedef struct {
+  // Bit addr & 63 of word addr >> 6 is set once addr has been executed.
+  uint64_t addresses[0x10000 / 64];
+  adc_8080_cpu_coverage_edge edges[ADC_8080_CPU_COVERAGE_EDGES];
+  uint32_t edge_count;    // Distinct edges in the map.
+  uint64_t edges_dropped; // Branches not counted since the map was too full.
+
+  // The latest instruction, and the address following it or past 0xFFFF
+  // when the next instruction can't be a branch target.
+  uint16_t last_pc;
+  uint32_t next_pc;
+} adc_8080_cpu_coverage;
+
+// Header of a coverage file written by adc_8080_cpu_write_coverage(), followed
+// by the address bitmap in host byte order and then edge_count edges.
+#define ADC_8080_CPU_COVERAGE_MAGIC 0x56433038 // "80CV"
+#define ADC_8080_CPU_COVERAGE_FILE_VERSION 1
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t edge_size;
+  uint64_t edge_count;
+  uint64_t edges_dropped;
+} adc_8080_cpu_coverage_file_header;
+
+// Accesses a breakpoint stops the cpu on.
+enum {
+  ADC_8080_CPU_BREAK_EXEC = 1 << 0, // Running an instruction in the range.
+  ADC_8080_CPU_BREAK_READ = 1 << 1, // Reading data in the range.
+  ADC_8080_CPU_BREAK_WRITE = 1 << 2 // Writing to the range.
+};
+
+#define ADC_8080_CPU_MAX_BREAKPOINTS 16
+
+// A breakpoint on the size bytes from addr, or a watchpoint with READ or
+// WRITE.
+typedef struct {
+  uint16_t addr;
+  uint16_t size;
+  int flags;
+} adc_8080_cpu_breakpoint;
+
+// The breakpoints a cpu stops on, and the latest one hit. Instructions
+// fetched and operands decoded aren't data reads, so only EXEC breakpoints see
+// them.
+typedef struct {
+  adc_8080_cpu_breakpoint breakpoints[ADC_8080_CPU_MAX_BREAKPOINTS];
+  int count;
+
+  // Index of the breakpoint hit while break_hit is set, and the access which
+  // hit it: its kind, the address and the value read or written.
+  int hit_index;
+  int hit_flags;
+  uint16_t hit_addr;
+  uint8_t hit_val;
+
+  // One bit per page holding a WRITE breakpoint.
+  uint64_t write_traps;
+
+  // Set by adc_8080_cpu_resume() to run the instruction at resume_pc once
+  // without stopping on its EXEC breakpoint.
+  bool resuming;
+  uint16_t resume_pc;
+} adc_8080_cpu_breakpoints;
+
+// Header of a trace file written by adc_8080_cpu_write_trace(), followed by
+// count records from the oldest to the latest.
+#define ADC_8080_CPU_TRACE_MAGIC 0x52543038 // "80TR"
+#define ADC_8080_CPU_TRACE_FILE_VERSION 1
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint64_t count;
+} adc_8080_cpu_trace_file_header;
+
+typedef struct {
+  // Hot state, used by every instruction or block. It is packed into the first
+  // 64 bytes, up to and including jit, so it takes a single cache line
+  // when the cpu is allocated on a 64 byte boundary.
+
   // 7 8-bit registers (accum and scratch).
   uint8_t ra, rb, rc, rd, re, rh, rl;
 
+  // Condition flags packed in the PUSH PSW layout (sign, zero, 0, aux, 0,
+  // parity, 1, carry). With lazy flags only the carry bit is always current,
+  // use adc_8080_cpu_get_psw() to read them all.
+  uint8_t psw;
+
   // 16-bit program counter.
   uint16_t pc;
 
   // 16-bit stack pointer.
   uint16_t sp;
 
-  // Condition flags (sign, zero, aux, parity, carry).
-  bool cfs, cfz, cfa, cfp, cfc;
+  // The last flag setting operation, its operands and result, used to derive
+  // the flags with lazy flags enabled.
+  uint8_t lazy_op, lazy_lhs, lazy_rhs, lazy_res;
+
+  // Cycles the cpu has consumed since it was initialized. Counted once per
+  // call to adc_8080_cpu_step() or adc_8080_cpu_run(), not per instruction.
+  uint64_t total_cycles;
 
   // Interrupt and halt state variables.
   bool halted;
@@ -38,8 +358,40 @@ typedef struct {
   uint8_t interrupt_opcode;
   bool interrupt_delay;
 
-  // Cycles the cpu has consumed in the latest step.
-  int cycles;
+  // Skip idle loops and halts, see adc_8080_cpu_set_idle_skip().
+  bool idle_skip;
+
+  // Set when a breakpoint is hit, which stops the cpu until
+  // adc_8080_cpu_resume().
+  bool break_hit;
+
+  // One bit per page, set when a write to the page must take the slow path
+  // since it may modify code held in the block cache or is watched.
+  uint64_t write_traps;
+
+  // One bit per page, set when reading data from the page is watched or code
+  // run from it may hit a breakpoint.
+  uint64_t read_traps;
+
+  // Block cache used by adc_8080_cpu_run(), or NULL to decode every
+  // instruction as it is executed.
+  adc_8080_cpu_block_cache *block_cache;
+
+  // Jit used to translate blocks in the block cache, or NULL.
+  adc_8080_cpu_jit *jit;
+
+  // Memory page tables. Each entry points directly at the host memory backing
+  // a page, or is NULL to trap to the read_byte/write_byte handlers. Only the
+  // entries of the pages in use are touched.
+  uint8_t *read_pages[ADC_8080_CPU_PAGE_COUNT];
+  uint8_t *write_pages[ADC_8080_CPU_PAGE_COUNT];
+
+  // Cold state, only used for unmapped memory, devices, decoding blocks and
+  // debugging.
+
+  // One bit per page, set when a write to the page may modify code held in the
+  // block cache.
+  uint64_t code_pages;
 
   // Custom user data for function handlers.
   void *userdata;
@@ -51,6 +403,21 @@ typedef struct {
   // Device read and write function handlers.
   uint8_t (*read_device)(void *userdata, uint8_t device);
   void (*write_device)(void *userdata, uint8_t device, uint8_t val);
+
+  // Profile counting the executed instructions, or NULL. Only used with
+  // PROFILE enabled.
+  adc_8080_cpu_profile *profile;
+
+  // Trace recording the executed instructions, or NULL. Only used with TRACE
+  // enabled.
+  adc_8080_cpu_trace *trace;
+
+  // Coverage recording the executed addresses and branches, or NULL. Only used
+  // with COVERAGE enabled.
+  adc_8080_cpu_coverage *coverage;
+
+  // Breakpoints and watchpoints the cpu stops on, or NULL.
+  adc_8080_cpu_breakpoints *breakpoints;
 } adc_8080_cpu;
 
 #ifdef __cpluscplus
@@ -58,16 +425,232 @@ extern "C" {
 #endif
 
 // adc_8080_cpu_init() - Init the 8080 cpu.
+//
+// The core keeps no global state, so cpus can be initialized and run on
+// different threads at once as long as they don't share a block cache, jit,
+// profile, trace or coverage.
 void adc_8080_cpu_init(adc_8080_cpu *cpu);
 
 // adc_8080_cpu_step() - Decode and execute the next instruction.
 //
-// Returns the number of cycles consumed from this step.
+// Returns the number of cycles consumed from this step, which are also added to
+// cpu->total_cycles.
 int adc_8080_cpu_step(adc_8080_cpu *cpu);
 
+// adc_8080_cpu_run() - Decode and execute instructions until at least
+// cycle_budget cycles have been consumed.
+//
+// Interrupts requested while running (e.g. from a device handler) are
+// recognized at the next instruction boundary without leaving the loop. Returns
+// early if the cpu halts, unless idle skipping is enabled.
+//
+// Returns the number of cycles consumed, which can exceed the budget by at most
+// one instruction. The cycles are also added to cpu->total_cycles.
+int adc_8080_cpu_run(adc_8080_cpu *cpu, int cycle_budget);
+
 // adc_8080_cpu_interrupt() - Request an interrupt with the given opcode.
 void adc_8080_cpu_interrupt(adc_8080_cpu *cpu, uint8_t opcode);
 
+// adc_8080_cpu_map_memory() - Map host memory directly into the address space.
+//
+// Accesses to mapped pages are served inline without calling the memory
+// handlers. The flags select whether reads, writes or both are mapped; the
+// other kind of access keeps trapping to the handlers. Passing a NULL mem or no
+// flags unmaps the range. The addr and size must be multiples of
+// ADC_8080_CPU_PAGE_SIZE, and mem must hold at least size bytes.
+void adc_8080_cpu_map_memory(adc_8080_cpu *cpu, uint16_t addr, uint32_t size,
+                             uint8_t *mem, int flags);
+
+// adc_8080_cpu_set_block_cache() - Attach a block cache to the cpu, or detach
+// it by passing NULL.
+//
+// With a block cache adc_8080_cpu_run() decodes straight-line code once into
+// blocks of pre-decoded instructions and executes them without fetching. Only
+// code in pages mapped for reads with adc_8080_cpu_map_memory() is cached, the
+// rest is still decoded as it is executed.
+//
+// Memory which is only mapped for reads is trusted never to change. Blocks
+// decoded from memory which is also mapped for writes, at any address, are
+// invalidated when the cpu writes to it. Flush the cache with
+// adc_8080_cpu_flush_block_cache() if cached memory is changed any other way.
+// Interrupts requested by the memory handlers are recognized at the end of
+// the running block.
+void adc_8080_cpu_set_block_cache(adc_8080_cpu *cpu,
+                                  adc_8080_cpu_block_cache *cache);
+
+// adc_8080_cpu_flush_block_cache() - Invalidate every block in the attached
+// block cache. Done by adc_8080_cpu_map_memory() too.
+void adc_8080_cpu_flush_block_cache(adc_8080_cpu *cpu);
+
+// adc_8080_cpu_invalidate_memory() - Invalidate the blocks decoded from the
+// given range of memory mapped for writes, after changing it other than
+// through the cpu. Cheaper than a flush when only part of memory changed.
+void adc_8080_cpu_invalidate_memory(adc_8080_cpu *cpu, uint16_t addr,
+                                    uint32_t size);
+
+// adc_8080_cpu_set_idle_skip() - Enable or disable skipping the cycles the
+// cpu spends idle in adc_8080_cpu_run(). Disabled by default.
+//
+// While halted the rest of the cycle budget is consumed at once instead of
+// returning early. With a block cache, a block which only reads memory and
+// registers and jumps back to itself is idle when an iteration leaves the cpu
+// unchanged, as in a loop polling memory for an interrupt handler to change.
+// Such a loop runs for the rest of the budget in a single step. The cycles
+// and state are the same as running the loop, provided memory only changes
+// through the cpu and interrupts are only requested between runs.
+void adc_8080_cpu_set_idle_skip(adc_8080_cpu *cpu, bool enable);
+
+// adc_8080_cpu_jit_create() - Create a jit with code_size bytes of executable
+// memory for its translations. See the jit flags for the flags. The memory is
+// only made writable while a block is translated, never writable and
+// executable at once.
+//
+// Returns NULL if the jit is not supported on this platform or the memory
+// can't be allocated.
+adc_8080_cpu_jit *adc_8080_cpu_jit_create(uint32_t code_size, int flags);
+
+// adc_8080_cpu_jit_destroy() - Free a jit and its translations. The jit must
+// be detached from the cpu first.
+void adc_8080_cpu_jit_destroy(adc_8080_cpu_jit *jit);
+
+// adc_8080_cpu_set_jit() - Attach a jit to the cpu, or detach it by passing
+// NULL to go back to interpreting the block cache.
+//
+// Once a cached block has run ADC_8080_CPU_JIT_THRESHOLD times it is
+// translated to native code, which adc_8080_cpu_run() calls instead of
+// interpreting the block. Cycle counts, interrupt timing and block
+// invalidation are the same as with the block cache alone, so the jit requires
+// one to be attached. A jit must only be attached to a single cpu.
+void adc_8080_cpu_set_jit(adc_8080_cpu *cpu, adc_8080_cpu_jit *jit);
+
+// adc_8080_cpu_set_profile() - Attach a profile to the cpu, or detach it by
+// passing NULL.
+//
+// With PROFILE enabled every instruction executed by adc_8080_cpu_step() and
+// adc_8080_cpu_run() is added to the profile, including the iterations of
+// skipped idle loops. Cycles spent halted aren't counted. Blocks are
+// interpreted instead of run through the jit while a profile is attached. The
+// profile is not reset, see adc_8080_cpu_reset_profile().
+void adc_8080_cpu_set_profile(adc_8080_cpu *cpu,
+                              adc_8080_cpu_profile *profile);
+
+// adc_8080_cpu_reset_profile() - Zero every count in the profile.
+void adc_8080_cpu_reset_profile(adc_8080_cpu_profile *profile);
+
+// adc_8080_cpu_profile_hot_spots() - Fill hot_spots with up to max of the
+// profiled instruction addresses, the most cycles first.
+//
+// Returns the number of hot spots filled.
+int adc_8080_cpu_profile_hot_spots(const adc_8080_cpu_profile *profile,
+                                   adc_8080_cpu_hot_spot *hot_spots, int max);
+
+// adc_8080_cpu_write_profile() - Write the profile as CSV to the given stream,
+// with a row per executed opcode followed by a row per hot spot, the most
+// cycles first. Passing a max of 0 writes every hot spot.
+void adc_8080_cpu_write_profile(const adc_8080_cpu_profile *profile,
+                                FILE *stream, int max);
+
+// adc_8080_cpu_trace_init() - Init a trace to record into the given buffer of
+// capacity records, which must be a power of two. Once full the oldest
+// records are overwritten.
+void adc_8080_cpu_trace_init(adc_8080_cpu_trace *trace,
+                             adc_8080_cpu_trace_record *records,
+                             uint32_t capacity);
+
+// adc_8080_cpu_set_trace() - Attach a trace to the cpu, or detach it by
+// passing NULL.
+//
+// With TRACE enabled every instruction executed by adc_8080_cpu_step() and
+// adc_8080_cpu_run() is recorded with the cpu state before it ran. The cycles
+// of skipped idle loops and halts are counted but their iterations aren't
+// recorded. As with a profile, blocks are interpreted instead of run through
+// the jit while a trace is attached.
+void adc_8080_cpu_set_trace(adc_8080_cpu *cpu, adc_8080_cpu_trace *trace);
+
+// adc_8080_cpu_write_trace() - Write the records held in the trace to the
+// given binary stream, see adc_8080_cpu_trace_file_header.
+//
+// Returns 0 on success, or -1 if the stream could not be written.
+int adc_8080_cpu_write_trace(const adc_8080_cpu_trace *trace, FILE *stream);
+
+// adc_8080_cpu_set_coverage() - Attach a coverage to the cpu, or detach it by
+// passing NULL.
+//
+// With COVERAGE enabled every instruction executed by adc_8080_cpu_step() and
+// adc_8080_cpu_run() is recorded, including those of blocks run through the
+// jit. A block is recorded when it starts, so if it stops early after writing
+// to its own code the rest of it is counted as well, and the iterations of
+// skipped idle loops are only counted once. The coverage is not reset, see
+// adc_8080_cpu_reset_coverage().
+void adc_8080_cpu_set_coverage(adc_8080_cpu *cpu,
+                               adc_8080_cpu_coverage *coverage);
+
+// adc_8080_cpu_reset_coverage() - Clear every address and edge.
+void adc_8080_cpu_reset_coverage(adc_8080_cpu_coverage *coverage);
+
+// adc_8080_cpu_snapshot_coverage() - Copy the coverage to snapshot, e.g. to
+// compare the phases of a program. Pass reset to clear the coverage after.
+void adc_8080_cpu_snapshot_coverage(adc_8080_cpu_coverage *coverage,
+                                    adc_8080_cpu_coverage *snapshot,
+                                    bool reset);
+
+// adc_8080_cpu_coverage_addresses() - Returns the number of addresses
+// executed.
+int adc_8080_cpu_coverage_addresses(const adc_8080_cpu_coverage *coverage);
+
+// adc_8080_cpu_write_coverage() - Write the coverage to the given binary
+// stream, see adc_8080_cpu_coverage_file_header. The edges are written in
+// order of their addresses.
+//
+// Returns 0 on success, or -1 if the stream could not be written.
+int adc_8080_cpu_write_coverage(const adc_8080_cpu_coverage *coverage,
+                                FILE *stream);
+
+// adc_8080_cpu_set_breakpoints() - Attach breakpoints to the cpu, or detach
+// them by passing NULL. Zero the breakpoints before attaching them the first
+// time.
+//
+// Once a breakpoint is hit break_hit is set and adc_8080_cpu_step() and
+// adc_8080_cpu_run() return without running anything more until
+// adc_8080_cpu_resume(). Only the pages holding breakpoints are trapped, so
+// accesses to the rest of memory cost nothing more. The cpu stops before an
+// instruction on an EXEC breakpoint, and after one writing to a WRITE
+// breakpoint. A READ breakpoint stops it after the block reading it, or the
+// instruction when stepping. Without a block cache adc_8080_cpu_run() steps an
+// instruction at a time while any breakpoint is set.
+void adc_8080_cpu_set_breakpoints(adc_8080_cpu *cpu,
+                                  adc_8080_cpu_breakpoints *breakpoints);
+
+// adc_8080_cpu_add_breakpoint() - Add a breakpoint on size bytes from addr to
+// the breakpoints attached to the cpu, see adc_8080_cpu_breakpoint.
+//
+// Returns the index of the breakpoint, or -1 if there is no room for it.
+int adc_8080_cpu_add_breakpoint(adc_8080_cpu *cpu, uint16_t addr,
+                                uint16_t size, int flags);
+
+// adc_8080_cpu_remove_breakpoint() - Remove the breakpoint at index, moving
+// the ones after it down.
+void adc_8080_cpu_remove_breakpoint(adc_8080_cpu *cpu, int index);
+
+// adc_8080_cpu_resume() - Continue after a breakpoint was hit. An EXEC
+// breakpoint at the pc is passed over once.
+void adc_8080_cpu_resume(adc_8080_cpu *cpu);
+
+// adc_8080_cpu_disassemble() - Write the assembly of an instruction to buf,
+// truncated to fit size bytes.
+//
+// Returns the length of the instruction in bytes.
+int adc_8080_cpu_disassemble(uint8_t opcode, uint16_t operand, char *buf,
+                             int size);
+
+// adc_8080_cpu_get_psw() - Returns the condition flags packed in the same bit
+// layout as PUSH PSW (sign, zero, 0, aux, 0, parity, 1, carry).
+uint8_t adc_8080_cpu_get_psw(adc_8080_cpu *cpu);
+
+// adc_8080_cpu_set_psw() - Set the condition flags from the same bit layout as
+// POP PSW.
+void adc_8080_cpu_set_psw(adc_8080_cpu *cpu, uint8_t psw);
+
 // adc_8080_cpu_print() - Print the state of the cpu in a readable form to the
 // given stream.
 void adc_8080_cpu_print(adc_8080_cpu *cpu, FILE *stream);
@@ -76,4 +659,2342 @@ void adc_8080_cpu_print(adc_8080_cpu *cpu, FILE *stream);
 }
 #endif
 
+// Begin C++ template core
+
+#ifdef __cplusplus
+
+#include <assert.h> // For assert
+
+// adc::I8080<Bus> is the interpreter specialized on a compile-time Bus type,
+// so the memory map and device decoding of a machine can be inlined straight
+// into the opcode handlers. The cpu state lives in a plain adc_8080_cpu, and
+// the C api above is a thin wrapper around adc::I8080<adc::CallbackBus>.
+//
+// A Bus supplies the following static functions:
+//
+// static uint8_t read(adc_8080_cpu *cpu, uint16_t addr);
+// static void write(adc_8080_cpu *cpu, uint16_t addr, uint8_t val);
+// static uint8_t in(adc_8080_cpu *cpu, uint8_t device);
+// static void out(adc_8080_cpu *cpu, uint8_t device, uint8_t val);
+
+namespace adc {
+
+// LUTs
+
+// clang-format off
+static constexpr int s_cycles_lut[256] = {
+//	 x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+/*x0*/   4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,
+/*1x*/   4,  10, 7,  5,  5,  5,  7,  4,  4,  10, 7,  5,  5,  5,  7,  4,
+/*2x*/   4,  10, 16, 5,  5,  5,  7,  4,  4,  10, 16, 5,  5,  5,  7,  4,
+/*3x*/   4,  10, 13, 5,  10, 10, 10, 4,  4,  10, 13, 5,  5,  5,  7,  4,
+/*4x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+/*5x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+/*6x*/   5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+/*7x*/   7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,
+/*8x*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+/*9x*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+/*Ax*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+/*Bx*/   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+/*Cx*/   5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7, 11,
+/*Dx*/   5,  10, 10, 10, 11, 11, 7,  11, 5,  10, 10, 10, 11, 17, 7, 11,
+/*Ex*/   5,  10, 10, 18, 11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7, 11,
+/*Fx*/   5,  10, 10, 4,  11, 11, 7,  11, 5,  5,  10, 4,  11, 17, 7, 11
+};
+
+// Instruction lengths in bytes, including the opcode.
+static constexpr int s_length_lut[256] = {
+//	 x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+/*0x*/   1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1,
+/*1x*/   1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1,
+/*2x*/   1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1,
+/*3x*/   1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1,
+/*4x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*5x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*6x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*7x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*8x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*9x*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*Ax*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*Bx*/   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*Cx*/   1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  3,  3,  3,  2,  1,
+/*Dx*/   1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1,
+/*Ex*/   1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1,
+/*Fx*/   1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1
+};
+// clang-format on
+
+// Flag bits in the hardware PSW layout. Bit 1 always reads as set and bits 3
+// and 5 as clear, so the cpu psw field can be pushed as is.
+enum {
+  FLAG_C = 1 << 0,
+  FLAG_ONE = 1 << 1,
+  FLAG_P = 1 << 2,
+  FLAG_A = 1 << 4,
+  FLAG_Z = 1 << 6,
+  FLAG_S = 1 << 7,
+  FLAG_MASK = FLAG_S | FLAG_Z | FLAG_A | FLAG_P | FLAG_C
+};
+
+// Flag LUT generators. These are single expressions so they can be evaluated
+// at compile time with C++11 constexpr. 0x6996 holds the odd parity of every
+// 4-bit value, and a byte has the same parity as its two nibbles xor'ed.
+constexpr uint8_t parity_flags(int v) {
+  return ((0x6996 >> ((v ^ (v >> 4)) & 0x0F)) & 1) ? 0 : FLAG_P;
+}
+
+constexpr uint8_t zsp_flags(int v) {
+  return (v & FLAG_S) | (v == 0 ? FLAG_Z : 0) | parity_flags(v) | FLAG_ONE;
+}
+
+// Indexed by the 9-bit sum of an add, so the carry comes from bit 8.
+constexpr uint8_t add_flags(int sum) {
+  return zsp_flags(sum & 0xFF) | (sum >> 8);
+}
+
+// Indexed by the 9-bit sum of an add of the negated operand, where the borrow
+// is the inverse of bit 8.
+constexpr uint8_t sub_flags(int sum) {
+  return zsp_flags(sum & 0xFF) | ((sum >> 8) ^ FLAG_C);
+}
+
+constexpr uint8_t inr_flags(int res) {
+  return zsp_flags(res) | ((res & 0x0F) == 0 ? FLAG_A : 0);
+}
+
+constexpr uint8_t dcr_flags(int res) {
+  return zsp_flags(res) | ((res & 0x0F) != 0x0F ? FLAG_A : 0);
+}
+
+#define LUT_16(f, i)                                                           \
+  f(i + 0x0), f(i + 0x1), f(i + 0x2), f(i + 0x3), f(i + 0x4), f(i + 0x5),      \
+      f(i + 0x6), f(i + 0x7), f(i + 0x8), f(i + 0x9), f(i + 0xA), f(i + 0xB),  \
+      f(i + 0xC), f(i + 0xD), f(i + 0xE), f(i + 0xF)
+#define LUT_256(f, i)                                                          \
+  LUT_16(f, i + 0x00), LUT_16(f, i + 0x10), LUT_16(f, i + 0x20),               \
+      LUT_16(f, i + 0x30), LUT_16(f, i + 0x40), LUT_16(f, i + 0x50),           \
+      LUT_16(f, i + 0x60), LUT_16(f, i + 0x70), LUT_16(f, i + 0x80),           \
+      LUT_16(f, i + 0x90), LUT_16(f, i + 0xA0), LUT_16(f, i + 0xB0),           \
+      LUT_16(f, i + 0xC0), LUT_16(f, i + 0xD0), LUT_16(f, i + 0xE0),           \
+      LUT_16(f, i + 0xF0)
+
+// The sign, zero and parity flags (and bit 1) of a result.
+static constexpr uint8_t s_zsp_lut[256] = {LUT_256(zsp_flags, 0)};
+
+// All flags of an ADD/ADC and a SUB/SBB/CMP except the aux carry, which is
+// bit 4 of lhs ^ rhs ^ sum and so needs no table.
+static constexpr uint8_t s_add_lut[512] = {LUT_256(add_flags, 0),
+                                           LUT_256(add_flags, 0x100)};
+static constexpr uint8_t s_sub_lut[512] = {LUT_256(sub_flags, 0),
+                                           LUT_256(sub_flags, 0x100)};
+
+// All flags of an INR/DCR except the carry, which they leave alone.
+static constexpr uint8_t s_inr_lut[256] = {LUT_256(inr_flags, 0)};
+static constexpr uint8_t s_dcr_lut[256] = {LUT_256(dcr_flags, 0)};
+
+#undef LUT_16
+#undef LUT_256
+
+// Every table is generated at compile time into read only data, so there is
+// nothing to setup before the first cpu runs and no shared state between cpus.
+static_assert(s_zsp_lut[0x00] == (FLAG_Z | FLAG_P | FLAG_ONE) &&
+                  s_zsp_lut[0x01] == FLAG_ONE &&
+                  s_zsp_lut[0x81] == (FLAG_S | FLAG_P | FLAG_ONE),
+              "Flag tables must be generated at compile time");
+
+// Flag setting operations recorded for lazy flags. They differ in how the aux
+// carry flag is derived; the sign, zero and parity flags always come from the
+// result. LAZY_NONE means the flags are held in the cpu psw field.
+enum {
+  LAZY_NONE = 0,
+  LAZY_ADD, // Also used for subtraction and compare with a negated rhs.
+  LAZY_INR,
+  LAZY_DCR,
+  LAZY_ANA,
+  LAZY_LOGIC
+};
+
+// The sign, zero, aux carry and parity flags (and bit 1) of an operation.
+static inline uint8_t zspa_flags(uint8_t op, uint8_t lhs, uint8_t rhs,
+                                 uint8_t res) {
+  switch (op) {
+  case LAZY_ADD:
+    return s_zsp_lut[res] | ((lhs ^ rhs ^ res) & FLAG_A);
+  case LAZY_INR:
+    return s_inr_lut[res];
+  case LAZY_DCR:
+    return s_dcr_lut[res];
+  case LAZY_ANA:
+    // The aux carry is bit 3 of lhs | rhs.
+    return s_zsp_lut[res] | (((lhs | rhs) << 1) & FLAG_A);
+  default:
+    return s_zsp_lut[res];
+  }
+}
+
+static inline void set_carry(adc_8080_cpu *cpu, bool c) {
+  cpu->psw = (cpu->psw & ~FLAG_C) | c;
+}
+
+// Set the sign, zero, parity and aux carry flags from an operation, leaving
+// the carry flag alone. With lazy flags the operation is only recorded.
+static inline void set_flags(adc_8080_cpu *cpu, uint8_t op, uint8_t lhs,
+                             uint8_t rhs, uint8_t res) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  cpu->lazy_op = op;
+  cpu->lazy_lhs = lhs;
+  cpu->lazy_rhs = rhs;
+  cpu->lazy_res = res;
+#else
+  cpu->psw = (cpu->psw & FLAG_C) | zspa_flags(op, lhs, rhs, res);
+#endif
+}
+
+static inline bool flag_c(const adc_8080_cpu *cpu) {
+  return cpu->psw & FLAG_C;
+}
+
+static inline bool flag_s(const adc_8080_cpu *cpu) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  if (cpu->lazy_op != LAZY_NONE)
+    return cpu->lazy_res >> 7;
+#endif
+  return cpu->psw & FLAG_S;
+}
+
+static inline bool flag_z(const adc_8080_cpu *cpu) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  if (cpu->lazy_op != LAZY_NONE)
+    return cpu->lazy_res == 0;
+#endif
+  return cpu->psw & FLAG_Z;
+}
+
+static inline bool flag_p(const adc_8080_cpu *cpu) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  if (cpu->lazy_op != LAZY_NONE)
+    return s_zsp_lut[cpu->lazy_res] & FLAG_P;
+#endif
+  return cpu->psw & FLAG_P;
+}
+
+static inline bool flag_a(const adc_8080_cpu *cpu) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  if (cpu->lazy_op != LAZY_NONE)
+    return zspa_flags(cpu->lazy_op, cpu->lazy_lhs, cpu->lazy_rhs,
+                      cpu->lazy_res) &
+           FLAG_A;
+#endif
+  return cpu->psw & FLAG_A;
+}
+
+static inline uint8_t get_psw(const adc_8080_cpu *cpu) {
+#if ADC_8080_CPU_LAZY_FLAGS
+  if (cpu->lazy_op != LAZY_NONE)
+    return (cpu->psw & FLAG_C) | zspa_flags(cpu->lazy_op, cpu->lazy_lhs,
+                                            cpu->lazy_rhs, cpu->lazy_res);
+#endif
+  return cpu->psw;
+}
+
+static inline void set_psw(adc_8080_cpu *cpu, uint8_t psw) {
+  cpu->psw = (psw & FLAG_MASK) | FLAG_ONE;
+  cpu->lazy_op = LAZY_NONE;
+}
+
+// Bus which goes through the cpu page tables and function handlers. Accesses
+// to mapped pages are served inline, and only pages which are not mapped call
+// the memory handlers.
+struct CallbackBus {
+  static inline uint8_t read(adc_8080_cpu *cpu, uint16_t addr) {
+    uint8_t *page = cpu->read_pages[addr >> ADC_8080_CPU_PAGE_SHIFT];
+    if (page)
+      return page[addr & (ADC_8080_CPU_PAGE_SIZE - 1)];
+    return cpu->read_byte(cpu->userdata, addr);
+  }
+
+  static inline void write(adc_8080_cpu *cpu, uint16_t addr, uint8_t val) {
+    uint8_t *page = cpu->write_pages[addr >> ADC_8080_CPU_PAGE_SHIFT];
+    if (page)
+      page[addr & (ADC_8080_CPU_PAGE_SIZE - 1)] = val;
+    else
+      cpu->write_byte(cpu->userdata, addr, val);
+  }
+
+  static inline uint8_t in(adc_8080_cpu *cpu, uint8_t device) {
+    return cpu->read_device(cpu->userdata, device);
+  }
+
+  static inline void out(adc_8080_cpu *cpu, uint8_t device, uint8_t val) {
+    cpu->write_device(cpu->userdata, device, val);
+  }
+};
+
+// Block cache helpers
+
+// Whether an instruction ends a block. Besides control flow this covers the
+// instructions after which an interrupt may need to be recognized: IN and OUT
+// since device handlers can request one, EI, and HLT.
+static inline bool ends_block(uint8_t opcode) {
+  switch (opcode) {
+  case 0x76: // HLT
+  case 0xD3: // OUT
+  case 0xDB: // IN
+  case 0xE9: // PCHL
+  case 0xFB: // EI
+    return true;
+  default:
+    // Every jump, call, return and restart is in the 0xC0-0xFF range with its
+    // low 3 bits in 0b000 (Rcc), 0b010 (Jcc), 0b100 (Ccc) or 0b111 (RST), or
+    // is one of JMP, RET, CALL and their undocumented aliases.
+    if (opcode < 0xC0)
+      return false;
+    switch (opcode & 0x07) {
+    case 0x00:
+    case 0x02:
+    case 0x04:
+    case 0x07:
+      return true;
+    default:
+      return opcode == 0xC3 || opcode == 0xCB || opcode == 0xC9 ||
+             opcode == 0xD9 || (opcode & 0x0F) == 0x0D;
+    }
+  }
+}
+
+// Whether an instruction can be part of an idle loop: it doesn't write memory,
+// touch the stack or devices, or change the interrupt state.
+static inline bool idle_loop_op(uint8_t opcode) {
+  if (opcode >= 0x40 && opcode < 0x80) // MOV, without MOV M,r and HLT
+    return opcode < 0x70 || opcode > 0x77;
+  if (opcode >= 0x80 && opcode < 0xC0) // ALU ops
+    return true;
+  if (opcode < 0x40) // Everything but STAX, SHLD, STA, INR M, DCR M, MVI M
+    return opcode != 0x02 && opcode != 0x12 && opcode != 0x22 &&
+           opcode != 0x32 && opcode != 0x34 && opcode != 0x35 &&
+           opcode != 0x36;
+  return (opcode & 0xC7) == 0xC6; // ALU immediate ops
+}
+
+// Whether a block can be an idle loop: it jumps back to its start, and
+// nothing in it has effects besides the registers and flags.
+static inline bool is_idle_loop(const adc_8080_cpu_block *block) {
+  const adc_8080_cpu_uop *last = &block->ops[block->count - 1];
+  if ((last->opcode != 0xC3 && (last->opcode & 0xC7) != 0xC2) ||
+      last->operand != block->pc)
+    return false;
+  for (int i = 0; i < block->count - 1; i++) {
+    if (!idle_loop_op(block->ops[i].opcode))
+      return false;
+  }
+  return true;
+}
+
+// The state an idle loop could change, compared between iterations.
+struct IdleState {
+  uint8_t ra, rb, rc, rd, re, rh, rl;
+  uint8_t psw;
+  uint16_t sp;
+};
+
+static inline IdleState idle_state(const adc_8080_cpu *cpu) {
+  IdleState state = {cpu->ra, cpu->rb, cpu->rc, cpu->rd, cpu->re,
+                     cpu->rh, cpu->rl, get_psw(cpu), cpu->sp};
+  return state;
+}
+
+static inline bool same_idle_state(const IdleState *a, const IdleState *b) {
+  return a->ra == b->ra && a->rb == b->rb && a->rc == b->rc &&
+         a->rd == b->rd && a->re == b->re && a->rh == b->rh &&
+         a->rl == b->rl && a->psw == b->psw && a->sp == b->sp;
+}
+
+#if ADC_8080_CPU_PROFILE
+// Count an executed instruction in the profile.
+static inline void profile_op(adc_8080_cpu_profile *profile, uint16_t pc,
+                              uint8_t opcode) {
+  profile->opcode_counts[opcode]++;
+  profile->opcode_cycles[opcode] += s_cycles_lut[opcode];
+  profile->pc_counts[pc]++;
+  profile->pc_cycles[pc] += s_cycles_lut[opcode];
+  profile->pc_opcodes[pc] = opcode;
+  profile->last_pc = pc;
+  profile->last_opcode = opcode;
+}
+
+// Count an interrupt by its opcode only, since it isn't fetched from memory.
+static inline void profile_interrupt(adc_8080_cpu_profile *profile,
+                                     uint8_t opcode) {
+  profile->opcode_counts[opcode]++;
+  profile->opcode_cycles[opcode] += s_cycles_lut[opcode];
+}
+
+// Count the extra cycles of the latest instruction.
+static inline void profile_extra_cycles(adc_8080_cpu_profile *profile,
+                                        int cycles) {
+  profile->opcode_cycles[profile->last_opcode] += cycles;
+  profile->pc_cycles[profile->last_pc] += cycles;
+}
+
+// Count every instruction of a block as executed the given number of times.
+static inline void profile_block(adc_8080_cpu_profile *profile,
+                                 const adc_8080_cpu_block *block,
+                                 uint64_t iterations) {
+  uint16_t pc = block->pc;
+  for (int i = 0; i < block->count; i++) {
+    uint8_t opcode = block->ops[i].opcode;
+    profile->opcode_counts[opcode] += iterations;
+    profile->opcode_cycles[opcode] += iterations * s_cycles_lut[opcode];
+    profile->pc_counts[pc] += iterations;
+    profile->pc_cycles[pc] += iterations * s_cycles_lut[opcode];
+    profile->pc_opcodes[pc] = opcode;
+    pc += block->ops[i].length;
+  }
+}
+#endif
+
+#if ADC_8080_CPU_TRACE
+// Record an instruction about to run in the trace.
+static inline void trace_op(adc_8080_cpu_trace *trace, const adc_8080_cpu *cpu,
+                            uint16_t pc, uint8_t opcode, uint16_t operand,
+                            uint8_t flags) {
+  adc_8080_cpu_trace_record *record =
+      &trace->records[trace->count++ & (trace->capacity - 1)];
+  record->cycles = trace->cycles;
+  record->pc = pc;
+  record->sp = cpu->sp;
+  record->operand = operand;
+  record->opcode = opcode;
+  record->psw = get_psw(cpu);
+  record->ra = cpu->ra, record->rb = cpu->rb, record->rc = cpu->rc,
+  record->rd = cpu->rd, record->re = cpu->re, record->rh = cpu->rh,
+  record->rl = cpu->rl;
+  record->flags = flags | (cpu->inte ? ADC_8080_CPU_TRACE_INTE : 0);
+  trace->cycles += s_cycles_lut[opcode];
+}
+#endif
+
+#if ADC_8080_CPU_COVERAGE
+// Mark the size addresses from addr as executed, wrapping past 0xFFFF. A
+// block is short enough to span at most two bitmap words.
+static inline void cover_addresses(adc_8080_cpu_coverage *coverage,
+                                   uint16_t addr, int size) {
+  uint64_t bits = (UINT64_C(1) << size) - 1;
+  int shift = addr & 63;
+  coverage->addresses[addr >> 6] |= bits << shift;
+  if (shift + size > 64)
+    coverage->addresses[((addr >> 6) + 1) & 1023] |= bits >> (64 - shift);
+}
+
+// Count a branch from the latest instruction to the given address, unless
+// there was no latest instruction to branch from. The edge map is open
+// addressed, and the branch is dropped if none of the entries it can take is
+// free.
+static inline void cover_edge(adc_8080_cpu_coverage *coverage, uint16_t to) {
+  if (coverage->next_pc > 0xFFFF)
+    return;
+  uint16_t from = coverage->last_pc;
+  uint32_t hash = ((((uint32_t)from << 16) | to) * 0x9E3779B1u) >> 16;
+  for (int i = 0; i < ADC_8080_CPU_COVERAGE_PROBES; i++) {
+    adc_8080_cpu_coverage_edge *edge =
+        &coverage->edges[(hash + i) & (ADC_8080_CPU_COVERAGE_EDGES - 1)];
+    if (edge->count == 0) {
+      edge->from = from;
+      edge->to = to;
+      edge->count = 1;
+      coverage->edge_count++;
+      return;
+    }
+    if (edge->from == from && edge->to == to) {
+      edge->count += edge->count != UINT32_MAX;
+      return;
+    }
+  }
+  coverage->edges_dropped++;
+}
+
+// Record an instruction about to run from pc.
+static inline void cover_op(adc_8080_cpu_coverage *coverage, uint16_t pc,
+                            uint8_t opcode) {
+  if (pc != coverage->next_pc)
+    cover_edge(coverage, pc);
+  int length = s_length_lut[opcode];
+  cover_addresses(coverage, pc, length);
+  coverage->last_pc = pc;
+  coverage->next_pc = (uint16_t)(pc + length);
+}
+
+// Record every instruction of a block about to run.
+static inline void cover_block(adc_8080_cpu_coverage *coverage,
+                               const adc_8080_cpu_block *block) {
+  if (block->pc != coverage->next_pc)
+    cover_edge(coverage, block->pc);
+  cover_addresses(coverage, block->pc,
+                  (uint16_t)(block->end_pc - block->pc));
+  coverage->last_pc = block->end_pc - block->ops[block->count - 1].length;
+  coverage->next_pc = block->end_pc;
+}
+#endif
+
+// Invalidate the blocks of every page mapped to the same host memory as the
+// given page is mapped to for writes.
+static inline void invalidate_code_page(adc_8080_cpu *cpu, int page) {
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  const uint8_t *mem = cpu->write_pages[page];
+  for (int i = 0; i < ADC_8080_CPU_PAGE_COUNT; i++) {
+    if (cpu->read_pages[i] == mem)
+      cache->page_generations[i]++;
+  }
+  cache->generation++;
+
+  // The page stays trapped while it holds a WRITE breakpoint.
+  uint64_t bit = (uint64_t)1 << page;
+  cpu->code_pages &= ~bit;
+  if (!cpu->breakpoints || !(cpu->breakpoints->write_traps & bit))
+    cpu->write_traps &= ~bit;
+}
+
+// Returns the index of the first breakpoint with any of the given flags on any
+// of the length bytes from addr, or -1.
+static inline int find_breakpoint(const adc_8080_cpu *cpu, uint16_t addr,
+                                  int length, int flags) {
+  const adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  if (!breakpoints)
+    return -1;
+  for (int i = 0; i < breakpoints->count; i++) {
+    const adc_8080_cpu_breakpoint *breakpoint = &breakpoints->breakpoints[i];
+    if ((breakpoint->flags & flags) && breakpoint->addr < addr + length &&
+        addr < breakpoint->addr + breakpoint->size)
+      return i;
+  }
+  return -1;
+}
+
+// Stop the cpu on a breakpoint. Only the first hit until it is resumed is
+// recorded.
+static inline void hit_breakpoint(adc_8080_cpu *cpu, int index, int flags,
+                                  uint16_t addr, uint8_t val) {
+  if (cpu->break_hit)
+    return;
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  breakpoints->hit_index = index;
+  breakpoints->hit_flags = flags;
+  breakpoints->hit_addr = addr;
+  breakpoints->hit_val = val;
+  cpu->break_hit = true;
+}
+
+// Returns true if an EXEC breakpoint is on any of the length bytes from pc,
+// which are all in one page.
+static inline bool exec_breakpoint_in(const adc_8080_cpu *cpu, uint16_t pc,
+                                      int length) {
+  return ((cpu->read_traps >> (pc >> ADC_8080_CPU_PAGE_SHIFT)) & 1) &&
+         find_breakpoint(cpu, pc, length, ADC_8080_CPU_BREAK_EXEC) >= 0;
+}
+
+// Stop before the instruction at pc if it is on an EXEC breakpoint, unless the
+// cpu is resuming from it.
+static inline bool break_at(adc_8080_cpu *cpu, uint16_t pc) {
+  int index = find_breakpoint(cpu, pc, 1, ADC_8080_CPU_BREAK_EXEC);
+  if (index < 0)
+    return false;
+  adc_8080_cpu_breakpoints *breakpoints = cpu->breakpoints;
+  if (breakpoints->resuming && breakpoints->resume_pc == pc) {
+    breakpoints->resuming = false;
+    return false;
+  }
+  hit_breakpoint(cpu, index, ADC_8080_CPU_BREAK_EXEC, pc, 0);
+  return true;
+}
+
+// Slow path of a read from a trapped page.
+static inline void trap_read(adc_8080_cpu *cpu, uint16_t addr, uint8_t val) {
+  int index = find_breakpoint(cpu, addr, 1, ADC_8080_CPU_BREAK_READ);
+  if (index >= 0)
+    hit_breakpoint(cpu, index, ADC_8080_CPU_BREAK_READ, addr, val);
+}
+
+// Slow path of a write to a trapped page, before the write. A hit stops the
+// running block after the instruction, the same as a write to cached code.
+static inline void trap_write(adc_8080_cpu *cpu, uint16_t addr, uint8_t val) {
+  int page = addr >> ADC_8080_CPU_PAGE_SHIFT;
+  if ((cpu->code_pages >> page) & 1)
+    invalidate_code_page(cpu, page);
+
+  int index = find_breakpoint(cpu, addr, 1, ADC_8080_CPU_BREAK_WRITE);
+  if (index >= 0) {
+    hit_breakpoint(cpu, index, ADC_8080_CPU_BREAK_WRITE, addr, val);
+    if (cpu->block_cache)
+      cpu->block_cache->generation++;
+  }
+}
+
+// Returns the block at pc, decoding it on a miss. Returns NULL if the code at
+// pc can't be cached.
+static inline adc_8080_cpu_block *find_block(adc_8080_cpu *cpu, uint16_t pc) {
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  int page = pc >> ADC_8080_CPU_PAGE_SHIFT;
+  adc_8080_cpu_block *block =
+      &cache->blocks[pc & (ADC_8080_CPU_BLOCK_CACHE_SIZE - 1)];
+  if (block->count && block->pc == pc &&
+      block->generation == cache->page_generations[page])
+    return block;
+
+  const uint8_t *mem = cpu->read_pages[page];
+  if (!mem)
+    return NULL;
+
+  int start = pc & (ADC_8080_CPU_PAGE_SIZE - 1);
+  int offset = start;
+  int count = 0;
+  int cycles = 0;
+  int last_cycles = 0;
+  while (count < ADC_8080_CPU_BLOCK_MAX_OPS) {
+    uint8_t opcode = mem[offset];
+    int length = s_length_lut[opcode];
+    if (offset + length > ADC_8080_CPU_PAGE_SIZE)
+      break;
+
+    adc_8080_cpu_uop *uop = &block->ops[count++];
+    uop->opcode = opcode;
+    uop->length = length;
+    uop->operand = 0;
+    if (length == 2)
+      uop->operand = mem[offset + 1];
+    else if (length == 3)
+      uop->operand = (mem[offset + 2] << 8) | mem[offset + 1];
+
+    last_cycles = s_cycles_lut[opcode];
+    cycles += last_cycles;
+    offset += length;
+    if (ends_block(opcode))
+      break;
+  }
+
+  // The first instruction crosses into the next page.
+  if (count == 0)
+    return NULL;
+
+  block->pc = pc;
+  block->end_pc = pc + (offset - start);
+  block->cycles = cycles;
+  block->last_cycles = last_cycles;
+  block->generation = cache->page_generations[page];
+  block->count = count;
+  block->hits = 0;
+  block->native = NULL;
+  block->idle_loop = is_idle_loop(block);
+
+  // Track writes through every page mapped to the same host memory.
+  for (int i = 0; i < ADC_8080_CPU_PAGE_COUNT; i++) {
+    if (cpu->write_pages[i] == mem) {
+      cpu->code_pages |= (uint64_t)1 << i;
+      cpu->write_traps |= (uint64_t)1 << i;
+    }
+  }
+
+  return block;
+}
+
+#if ADC_8080_CPU_JIT
+
+// Jit helpers
+
+// Functions of an I8080<Bus> instantiation which translated code calls.
+struct JitHelpers {
+  uint8_t (*read_byte)(adc_8080_cpu *cpu, uint16_t addr);
+  void (*write_byte)(adc_8080_cpu *cpu, uint16_t addr, uint8_t b);
+  uint16_t (*read_word)(adc_8080_cpu *cpu, uint16_t addr);
+  void (*write_word)(adc_8080_cpu *cpu, uint16_t addr, uint16_t w);
+  int (*step)(adc_8080_cpu *cpu);
+};
+
+// Native translation of a block. Sets the pc and returns the cycles to add to
+// the block total: the extra cycles of a conditional call or return, or minus
+// the cycles of the instructions skipped when the block modifies cached code.
+typedef int (*NativeBlock)(adc_8080_cpu *cpu);
+
+// Translate a block with the cpu jit. Returns NULL if the jit code memory is
+// full. Defined in adc_8080_cpu.cpp.
+NativeBlock jit_translate(adc_8080_cpu *cpu, const adc_8080_cpu_block *block,
+                          const JitHelpers *helpers);
+
+// Drop every translation and reuse the jit code memory.
+void jit_flush(adc_8080_cpu *cpu);
+
+// Bus which validates the jit. It logs the memory writes of the interpreted
+// block and of the replayed translation along with the values they replaced,
+// so each can be rolled back. Device accesses are recorded while interpreting,
+// and checked against the recording instead of repeated while replaying.
+template <typename Bus> struct ValidateBus {
+  static inline uint8_t read(adc_8080_cpu *cpu, uint16_t addr) {
+    return Bus::read(cpu, addr);
+  }
+
+  static inline void write(adc_8080_cpu *cpu, uint16_t addr, uint8_t val) {
+    adc_8080_cpu_jit *jit = cpu->jit;
+    int *count = jit->replaying ? &jit->replay_write_count : &jit->write_count;
+    if (*count == 64) {
+      jit->replay_failed = true;
+      return;
+    }
+
+    int i = (*count)++;
+    if (jit->replaying) {
+      jit->replay_writes[i].addr = addr;
+      jit->replay_writes[i].old_val = Bus::read(cpu, addr);
+      jit->replay_writes[i].val = val;
+    } else {
+      jit->writes[i].addr = addr;
+      jit->writes[i].old_val = Bus::read(cpu, addr);
+      jit->writes[i].val = val;
+    }
+    Bus::write(cpu, addr, val);
+  }
+
+  // Undo the writes logged while recording or replaying, newest first.
+  static void roll_back(adc_8080_cpu *cpu, bool replayed) {
+    adc_8080_cpu_jit *jit = cpu->jit;
+    if (replayed) {
+      for (int i = jit->replay_write_count - 1; i >= 0; i--)
+        Bus::write(cpu, jit->replay_writes[i].addr, jit->replay_writes[i].old_val);
+    } else {
+      for (int i = jit->write_count - 1; i >= 0; i--)
+        Bus::write(cpu, jit->writes[i].addr, jit->writes[i].old_val);
+    }
+  }
+
+  // Redo the writes logged while recording.
+  static void redo(adc_8080_cpu *cpu) {
+    adc_8080_cpu_jit *jit = cpu->jit;
+    for (int i = 0; i < jit->write_count; i++)
+      Bus::write(cpu, jit->writes[i].addr, jit->writes[i].val);
+  }
+
+  static inline uint8_t in(adc_8080_cpu *cpu, uint8_t device) {
+    adc_8080_cpu_jit *jit = cpu->jit;
+    if (jit->replaying) {
+      int i = jit->replay_io_count++;
+      if (i >= jit->io_count || jit->io[i].out || jit->io[i].device != device) {
+        jit->replay_failed = true;
+        return 0;
+      }
+      return jit->io[i].val;
+    }
+
+    uint8_t val = Bus::in(cpu, device);
+    if (jit->io_count == 4) {
+      jit->replay_failed = true;
+      return val;
+    }
+    jit->io[jit->io_count].device = device;
+    jit->io[jit->io_count].val = val;
+    jit->io[jit->io_count].out = false;
+    jit->io_count++;
+    return val;
+  }
+
+  static inline void out(adc_8080_cpu *cpu, uint8_t device, uint8_t val) {
+    adc_8080_cpu_jit *jit = cpu->jit;
+    if (jit->replaying) {
+      int i = jit->replay_io_count++;
+      if (i >= jit->io_count || !jit->io[i].out || jit->io[i].device != device ||
+          jit->io[i].val != val)
+        jit->replay_failed = true;
+      return;
+    }
+
+    Bus::out(cpu, device, val);
+    if (jit->io_count == 4) {
+      jit->replay_failed = true;
+      return;
+    }
+    jit->io[jit->io_count].device = device;
+    jit->io[jit->io_count].val = val;
+    jit->io[jit->io_count].out = true;
+    jit->io_count++;
+  }
+};
+
+// The validating bus for a Bus, which is itself for a validating bus so the
+// validating core doesn't wrap its bus again.
+template <typename Bus> struct Validated { typedef ValidateBus<Bus> type; };
+template <typename Bus> struct Validated<ValidateBus<Bus> > {
+  typedef ValidateBus<Bus> type;
+};
+
+// Whether two cpus have the same architectural state.
+static inline bool same_state(const adc_8080_cpu *a, const adc_8080_cpu *b) {
+  return a->ra == b->ra && a->rb == b->rb && a->rc == b->rc &&
+         a->rd == b->rd && a->re == b->re && a->rh == b->rh &&
+         a->rl == b->rl && a->pc == b->pc && a->sp == b->sp &&
+         get_psw(a) == get_psw(b) && a->halted == b->halted &&
+         a->inte == b->inte && a->interrupt_pending == b->interrupt_pending &&
+         a->interrupt_delay == b->interrupt_delay;
+}
+
+#endif // ADC_8080_CPU_JIT
+
+// Helper macros
+
+#define get_rbc() word_from_bytes(cpu->rb, cpu->rc)
+#define get_rde() word_from_bytes(cpu->rd, cpu->re)
+#define get_rhl() word_from_bytes(cpu->rh, cpu->rl)
+#define set_rbc(w) bytes_from_word(&cpu->rb, &cpu->rc, w)
+#define set_rde(w) bytes_from_word(&cpu->rd, &cpu->re, w)
+#define set_rhl(w) bytes_from_word(&cpu->rh, &cpu->rl, w)
+
+// Instrumentation helper macros
+//
+// HOOKS is set when the profile or trace hooks are compiled in. HOOK_OP()
+// hands them an instruction fetched from pc, and HOOK_UOP() one run from a
+// block, tracking its address in uop_pc. They all compile to nothing
+// otherwise.
+#define HOOKS (ADC_8080_CPU_PROFILE || ADC_8080_CPU_TRACE)
+#if HOOKS
+#define HOOK_OP(pc, op) on_op(cpu, pc, op, NULL)
+#define HOOK_UOP()                                                             \
+  {                                                                            \
+    on_op(cpu, uop_pc, uop->opcode, uop);                                      \
+    uop_pc += uop->length;                                                     \
+  }
+#define HOOK_INTERRUPT(op) on_interrupt(cpu, op)
+#define HOOK_EXTRA_CYCLES(c) on_extra_cycles(cpu, c)
+#define HOOK_IDLE_LOOP(block, iterations) on_idle_loop(cpu, block, iterations)
+#define HOOK_IDLE_CYCLES(c) on_idle_cycles(cpu, c)
+#else
+#define HOOK_OP(pc, op)
+#define HOOK_UOP()
+#define HOOK_INTERRUPT(op)
+#define HOOK_EXTRA_CYCLES(c)
+#define HOOK_IDLE_LOOP(block, iterations)
+#define HOOK_IDLE_CYCLES(c)
+#endif
+
+// COVER_OP() and COVER_BLOCK() record an instruction or block about to run in
+// the coverage. COVER_RESUME() marks the next instruction as not being a
+// branch target, after an interrupt or a block stopped early. They compile to
+// nothing without COVERAGE.
+#if ADC_8080_CPU_COVERAGE
+#define COVER_OP(pc, op)                                                       \
+  {                                                                            \
+    if (cpu->coverage)                                                         \
+      cover_op(cpu->coverage, pc, op);                                         \
+  }
+#define COVER_BLOCK(block)                                                     \
+  {                                                                            \
+    if (cpu->coverage)                                                         \
+      cover_block(cpu->coverage, block);                                       \
+  }
+#define COVER_RESUME()                                                         \
+  {                                                                            \
+    if (cpu->coverage)                                                         \
+      cpu->coverage->next_pc = 0x10000;                                        \
+  }
+#else
+#define COVER_OP(pc, op)
+#define COVER_BLOCK(block)
+#define COVER_RESUME()
+#endif
+
+template <typename Bus> struct I8080 {
+  // step() - Decode and execute the next instruction.
+  //
+  // Returns the number of cycles consumed from this step.
+  static int step(adc_8080_cpu *cpu) {
+    // A budget of a single cycle runs exactly one instruction (or interrupt).
+    int cycles = exec<false>(cpu, 1);
+    cpu->total_cycles += cycles;
+    return cycles;
+  }
+
+  // run() - Decode and execute instructions until at least cycle_budget
+  // cycles have been consumed. See adc_8080_cpu_run().
+  static int run(adc_8080_cpu *cpu, int cycle_budget) {
+    int cycles = 0;
+    if (cpu->block_cache) {
+      cycles = exec<true>(cpu, cycle_budget);
+    } else if (cpu->read_traps | cpu->write_traps) {
+      // Without blocks breakpoints are checked a step at a time.
+      while (cycles < cycle_budget) {
+        int step_cycles = exec<false>(cpu, 1);
+        if (step_cycles == 0)
+          break;
+        cycles += step_cycles;
+      }
+    } else {
+      cycles = exec<false>(cpu, cycle_budget);
+    }
+
+    // A halted cpu is idle until an interrupt, which can't be requested before
+    // this returns.
+    if (cpu->idle_skip && cpu->halted && cycles < cycle_budget) {
+      HOOK_IDLE_CYCLES(cycle_budget - cycles);
+      cycles = cycle_budget;
+    }
+    cpu->total_cycles += cycles;
+    return cycles;
+  }
+
+  // exec() - Decode and execute instructions until at least cycle_budget
+  // cycles have been consumed, or the cpu halts. With Blocks the instructions
+  // are run from the cpu block cache where possible.
+  //
+  // Returns the number of cycles consumed.
+  template <bool Blocks> static int exec(adc_8080_cpu *cpu, int cycle_budget);
+
+#if ADC_8080_CPU_JIT
+  // Jit helpers
+
+  // jit_step() - Interpret a single instruction for a translated block.
+  // Interrupts requested meanwhile are left for the end of the block, the same
+  // as when the block is interpreted, and so is a breakpoint hit earlier in the
+  // block. The block is already in the coverage.
+  static int jit_step(adc_8080_cpu *cpu) {
+    bool interrupt_pending = cpu->interrupt_pending;
+    bool break_hit = cpu->break_hit;
+    adc_8080_cpu_coverage *coverage = cpu->coverage;
+    cpu->interrupt_pending = false;
+    cpu->break_hit = false;
+    cpu->coverage = NULL;
+    int cycles = exec<false>(cpu, 1);
+    cpu->interrupt_pending |= interrupt_pending;
+    cpu->break_hit |= break_hit;
+    cpu->coverage = coverage;
+    return cycles;
+  }
+
+  static JitHelpers jit_helpers() {
+    JitHelpers helpers = {read_byte, write_byte, read_word, write_word,
+                          jit_step};
+    return helpers;
+  }
+
+  // run_native() - Run a block through the cpu jit, translating it once it is
+  // hot. Returns false if the block should be interpreted instead.
+  static bool run_native(adc_8080_cpu *cpu, adc_8080_cpu_block *block,
+                         int *cycles);
+
+  // validate_native() - Run a translated block in lockstep with the
+  // interpreter. Returns the cycles consumed.
+  static int validate_native(adc_8080_cpu *cpu,
+                             const adc_8080_cpu_block *block);
+#endif
+
+  // Instrumentation hooks
+
+  // instrumented() - Whether a profile or trace is attached and compiled in.
+  static inline bool instrumented(const adc_8080_cpu *cpu) {
+    return (ADC_8080_CPU_PROFILE && cpu->profile) ||
+           (ADC_8080_CPU_TRACE && cpu->trace);
+  }
+
+#if HOOKS
+  // on_op() - Count and record an instruction about to run from pc. The
+  // operand of an instruction not run from a block is read from memory.
+  static inline void on_op(adc_8080_cpu *cpu, uint16_t pc, uint8_t opcode,
+                           const adc_8080_cpu_uop *uop) {
+#if ADC_8080_CPU_PROFILE
+    if (cpu->profile)
+      profile_op(cpu->profile, pc, opcode);
+#endif
+#if ADC_8080_CPU_TRACE
+    if (cpu->trace) {
+      uint16_t operand = 0;
+      if (uop)
+        operand = uop->operand;
+      else if (s_length_lut[opcode] == 2)
+        operand = fetch_byte(cpu, pc + 1);
+      else if (s_length_lut[opcode] == 3)
+        operand = fetch_word(cpu, pc + 1);
+      trace_op(cpu->trace, cpu, pc, opcode, operand, 0);
+    }
+#endif
+  }
+
+  // on_interrupt() - Count and record an interrupt about to run.
+  static inline void on_interrupt(adc_8080_cpu *cpu, uint8_t opcode) {
+#if ADC_8080_CPU_PROFILE
+    if (cpu->profile)
+      profile_interrupt(cpu->profile, opcode);
+#endif
+#if ADC_8080_CPU_TRACE
+    if (cpu->trace)
+      trace_op(cpu->trace, cpu, cpu->pc, opcode, 0,
+               ADC_8080_CPU_TRACE_INTERRUPT);
+#endif
+  }
+
+  // on_extra_cycles() - Count cycles beyond those of the latest instruction.
+  static inline void on_extra_cycles(adc_8080_cpu *cpu, int cycles) {
+#if ADC_8080_CPU_PROFILE
+    if (cpu->profile)
+      profile_extra_cycles(cpu->profile, cycles);
+#endif
+#if ADC_8080_CPU_TRACE
+    if (cpu->trace)
+      cpu->trace->cycles += cycles;
+#endif
+  }
+
+  // on_idle_loop() - Count the skipped iterations of an idle loop.
+  static inline void on_idle_loop(adc_8080_cpu *cpu,
+                                  const adc_8080_cpu_block *block,
+                                  int iterations) {
+#if ADC_8080_CPU_PROFILE
+    if (cpu->profile)
+      profile_block(cpu->profile, block, iterations);
+#endif
+#if ADC_8080_CPU_TRACE
+    if (cpu->trace)
+      cpu->trace->cycles += (uint64_t)iterations * block->cycles;
+#endif
+  }
+
+  // on_idle_cycles() - Count cycles spent halted, which only the trace does.
+  static inline void on_idle_cycles(adc_8080_cpu *cpu, int cycles) {
+#if ADC_8080_CPU_TRACE
+    if (cpu->trace)
+      cpu->trace->cycles += cycles;
+#else
+    (void)cpu;
+    (void)cycles;
+#endif
+  }
+#endif
+
+  // Memory and instruction helpers
+
+  static inline uint8_t read_byte(adc_8080_cpu *cpu, uint16_t addr) {
+    uint8_t val = Bus::read(cpu, addr);
+    if ((cpu->read_traps >> (addr >> ADC_8080_CPU_PAGE_SHIFT)) & 1)
+      trap_read(cpu, addr, val);
+    return val;
+  }
+
+  static inline uint16_t read_word(adc_8080_cpu *cpu, uint16_t addr) {
+    return word_from_bytes(read_byte(cpu, addr + 1), read_byte(cpu, addr));
+  }
+
+  static inline void write_byte(adc_8080_cpu *cpu, uint16_t addr, uint8_t b) {
+    if ((cpu->write_traps >> (addr >> ADC_8080_CPU_PAGE_SHIFT)) & 1)
+      trap_write(cpu, addr, b);
+    Bus::write(cpu, addr, b);
+  }
+
+  static inline void write_word(adc_8080_cpu *cpu, uint16_t addr, uint16_t w) {
+    write_byte(cpu, addr, w & 0xFF);
+    write_byte(cpu, addr + 1, w >> 8);
+  }
+
+  // Instruction fetches aren't data reads, so aren't trapped.
+  static inline uint8_t fetch_byte(adc_8080_cpu *cpu, uint16_t addr) {
+    return Bus::read(cpu, addr);
+  }
+
+  static inline uint16_t fetch_word(adc_8080_cpu *cpu, uint16_t addr) {
+    return word_from_bytes(fetch_byte(cpu, addr + 1), fetch_byte(cpu, addr));
+  }
+
+  static inline uint8_t next_byte(adc_8080_cpu *cpu) {
+    return fetch_byte(cpu, cpu->pc++);
+  }
+
+  static inline uint16_t next_word(adc_8080_cpu *cpu) {
+    uint16_t w = fetch_word(cpu, cpu->pc);
+    cpu->pc += 2;
+    return w;
+  }
+
+  static inline uint16_t word_from_bytes(uint8_t high, uint8_t low) {
+    return (uint16_t)((high << 8) | low);
+  }
+
+  static inline void bytes_from_word(uint8_t *high, uint8_t *low, uint16_t w) {
+    *high = w >> 8;
+    *low = w & 0xFF;
+  }
+
+  static inline void stack_push(adc_8080_cpu *cpu, uint16_t w) {
+    cpu->sp -= 2;
+    write_word(cpu, cpu->sp, w);
+  }
+
+  static inline uint16_t stack_pop(adc_8080_cpu *cpu) {
+    uint16_t w = read_word(cpu, cpu->sp);
+    cpu->sp += 2;
+    return w;
+  }
+
+  static inline uint8_t op_inr(adc_8080_cpu *cpu, uint8_t val) {
+    uint8_t res = val + 1;
+    set_flags(cpu, LAZY_INR, val, 1, res);
+    return res;
+  }
+
+  static inline uint8_t op_dcr(adc_8080_cpu *cpu, uint8_t val) {
+    uint8_t res = val - 1;
+    set_flags(cpu, LAZY_DCR, val, 1, res);
+    return res;
+  }
+
+  static inline void op_add(adc_8080_cpu *cpu, uint8_t val, bool c) {
+    uint16_t sum = cpu->ra + val + c;
+#if ADC_8080_CPU_LAZY_FLAGS
+    set_carry(cpu, sum >> 8);
+    set_flags(cpu, LAZY_ADD, cpu->ra, val, sum & 0xFF);
+#else
+    cpu->psw = s_add_lut[sum] | ((cpu->ra ^ val ^ sum) & FLAG_A);
+#endif
+    cpu->ra = sum & 0xFF;
+  }
+
+  // Subtraction is an add of the negated value with the carry in and out
+  // inverted, which also gives the aux carry of the 8080.
+  static inline uint8_t op_sub_flags(adc_8080_cpu *cpu, uint8_t val, bool c) {
+    uint8_t nval = ~val;
+    uint16_t sum = cpu->ra + nval + !c;
+#if ADC_8080_CPU_LAZY_FLAGS
+    set_carry(cpu, !(sum >> 8));
+    set_flags(cpu, LAZY_ADD, cpu->ra, nval, sum & 0xFF);
+#else
+    cpu->psw = s_sub_lut[sum] | ((cpu->ra ^ nval ^ sum) & FLAG_A);
+#endif
+    return sum & 0xFF;
+  }
+
+  static inline void op_sub(adc_8080_cpu *cpu, uint8_t val, bool c) {
+    cpu->ra = op_sub_flags(cpu, val, c);
+  }
+
+  static inline void op_ana(adc_8080_cpu *cpu, uint8_t val) {
+    uint8_t result = cpu->ra & val;
+    set_carry(cpu, 0);
+    set_flags(cpu, LAZY_ANA, cpu->ra, val, result);
+    cpu->ra = result;
+  }
+
+  static inline void op_xra(adc_8080_cpu *cpu, uint8_t val) {
+    uint8_t result = cpu->ra ^ val;
+    set_carry(cpu, 0);
+    set_flags(cpu, LAZY_LOGIC, cpu->ra, val, result);
+    cpu->ra = result;
+  }
+
+  static inline void op_ora(adc_8080_cpu *cpu, uint8_t val) {
+    uint8_t result = cpu->ra | val;
+    set_carry(cpu, 0);
+    set_flags(cpu, LAZY_LOGIC, cpu->ra, val, result);
+    cpu->ra = result;
+  }
+
+  static inline void op_cmp(adc_8080_cpu *cpu, uint8_t val) {
+    // Compare is a subtraction which discards the result.
+    op_sub_flags(cpu, val, 0);
+  }
+
+  static inline void op_jmp_cond(adc_8080_cpu *cpu, uint16_t addr,
+                                 bool condition) {
+    if (condition)
+      cpu->pc = addr;
+  }
+
+  static inline void op_call(adc_8080_cpu *cpu, uint16_t addr) {
+    stack_push(cpu, cpu->pc);
+    cpu->pc = addr;
+  }
+
+  // Conditional calls and returns take 6 extra cycles when the condition is met.
+  // The extra cycles are returned so they can be added to the step total.
+  static inline int op_call_cond(adc_8080_cpu *cpu, uint16_t addr,
+                                 bool condition) {
+    if (condition) {
+      op_call(cpu, addr);
+      HOOK_EXTRA_CYCLES(6);
+      return 6;
+    }
+    return 0;
+  }
+
+  static inline int op_ret_cond(adc_8080_cpu *cpu, bool condition) {
+    if (condition) {
+      cpu->pc = stack_pop(cpu);
+      HOOK_EXTRA_CYCLES(6);
+      return 6;
+    }
+    return 0;
+  }
+
+  static inline void op_dad(adc_8080_cpu *cpu, uint16_t val) {
+    uint32_t res = get_rhl() + val;
+    set_carry(cpu, res > 0xFFFF);
+    set_rhl(res & 0xFFFF);
+  }
+
+  static inline void op_xchg(adc_8080_cpu *cpu) {
+    uint16_t tmp = get_rhl();
+    set_rhl(get_rde());
+    set_rde(tmp);
+  }
+
+  static inline void op_xthl(adc_8080_cpu *cpu) {
+    uint16_t val = read_word(cpu, cpu->sp);
+    write_word(cpu, cpu->sp, get_rhl());
+    set_rhl(val);
+  }
+
+  static inline void op_rlc(adc_8080_cpu *cpu) {
+    bool carrybit = cpu->ra >> 7;
+    set_carry(cpu, carrybit);
+    cpu->ra = (cpu->ra << 1) | carrybit;
+  }
+
+  static inline void op_rrc(adc_8080_cpu *cpu) {
+    bool carrybit = cpu->ra & 1;
+    set_carry(cpu, carrybit);
+    cpu->ra = (cpu->ra >> 1) | (carrybit << 7);
+  }
+
+  static inline void op_ral(adc_8080_cpu *cpu) {
+    bool carrybit = flag_c(cpu);
+    set_carry(cpu, cpu->ra >> 7);
+    cpu->ra = (cpu->ra << 1) | carrybit;
+  }
+
+  static inline void op_rar(adc_8080_cpu *cpu) {
+    bool carrybit = flag_c(cpu);
+    set_carry(cpu, cpu->ra & 1);
+    cpu->ra = (cpu->ra >> 1) | (carrybit << 7);
+  }
+
+  static inline void op_push_psw(adc_8080_cpu *cpu) {
+    stack_push(cpu, word_from_bytes(cpu->ra, get_psw(cpu)));
+  }
+
+  static inline void op_pop_psw(adc_8080_cpu *cpu) {
+    uint8_t a, psw;
+    bytes_from_word(&a, &psw, stack_pop(cpu));
+
+    cpu->ra = a;
+    set_psw(cpu, psw);
+  }
+
+  static inline void op_daa(adc_8080_cpu *cpu) {
+    uint8_t lownib = cpu->ra & 0x0F;
+    uint8_t highnib = cpu->ra >> 4;
+    bool carrybit = flag_c(cpu);
+    uint8_t addition = 0;
+
+    if (lownib > 9 || flag_a(cpu)) {
+      addition += 0x06;
+    }
+
+    if (highnib > 9 || carrybit || (highnib >= 9 && lownib > 9)) {
+      addition += 0x60;
+      carrybit = 1;
+    }
+
+    op_add(cpu, addition, 0);
+    set_carry(cpu, carrybit);
+  }
+};
+
+#if ADC_8080_CPU_JIT
+
+template <typename Bus>
+bool I8080<Bus>::run_native(adc_8080_cpu *cpu, adc_8080_cpu_block *block,
+                            int *cycles) {
+  adc_8080_cpu_jit *jit = cpu->jit;
+  if (!block->native) {
+    if (++block->hits < ADC_8080_CPU_JIT_THRESHOLD)
+      return false;
+
+    // Validated translations go through the validating bus.
+    JitHelpers helpers =
+        (jit->flags & ADC_8080_CPU_JIT_VALIDATE)
+            ? I8080<typename Validated<Bus>::type>::jit_helpers()
+            : jit_helpers();
+    NativeBlock native = jit_translate(cpu, block, &helpers);
+    if (!native) {
+      jit_flush(cpu);
+      native = jit_translate(cpu, block, &helpers);
+      if (!native)
+        return false;
+    }
+    block->native = (void *)native;
+  }
+
+  if (jit->flags & ADC_8080_CPU_JIT_VALIDATE)
+    *cycles = validate_native(cpu, block);
+  else
+    *cycles = block->cycles + ((NativeBlock)block->native)(cpu);
+  return true;
+}
+
+template <typename Bus>
+int I8080<Bus>::validate_native(adc_8080_cpu *cpu,
+                                const adc_8080_cpu_block *block) {
+  typedef typename Validated<Bus>::type VBus;
+  adc_8080_cpu_jit *jit = cpu->jit;
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  adc_8080_cpu start = *cpu;
+
+  // Interpret the block for real, recording its side effects. Stop early
+  // where the translation would, when the block modifies cached code.
+  jit->replaying = false;
+  jit->replay_failed = false;
+  jit->write_count = 0;
+  jit->io_count = 0;
+  uint32_t generation = cache->generation;
+  int expected_cycles = 0;
+  for (int i = 0; i < block->count && cache->generation == generation; i++)
+    expected_cycles += I8080<VBus>::jit_step(cpu);
+  adc_8080_cpu expected = *cpu;
+
+  // Replay the translation from the same state. If the recording overflowed
+  // the block can't be rolled back, and is left to the interpreter.
+  bool recorded = !jit->replay_failed;
+  int cycles = expected_cycles;
+  if (recorded) {
+    VBus::roll_back(cpu, false);
+    *cpu = start;
+    jit->replaying = true;
+    jit->replay_write_count = 0;
+    jit->replay_io_count = 0;
+    cycles = block->cycles + ((NativeBlock)block->native)(cpu);
+    jit->replaying = false;
+    VBus::roll_back(cpu, true);
+    VBus::redo(cpu);
+  }
+
+  bool same_writes = jit->replay_write_count == jit->write_count;
+  for (int i = 0; same_writes && i < jit->write_count; i++) {
+    same_writes = jit->writes[i].addr == jit->replay_writes[i].addr &&
+                  jit->writes[i].val == jit->replay_writes[i].val;
+  }
+
+  jit->validated_blocks++;
+  if (recorded &&
+      (cycles != expected_cycles || !same_state(cpu, &expected) ||
+       !same_writes || jit->replay_failed ||
+       jit->replay_io_count != jit->io_count)) {
+    jit->mismatches++;
+    jit->mismatch_pc = block->pc;
+  }
+
+  // The interpreted state is the one which matches memory.
+  *cpu = expected;
+  return expected_cycles;
+}
+
+#endif // ADC_8080_CPU_JIT
+
+// Dispatch helper macros
+//
+// OPCODE() labels an opcode handler and NEXT() ends one. With threaded
+// dispatch NEXT() fetches and jumps to the following handler directly, and
+// only goes back to the top of the loop when the cycle budget is spent, an
+// interrupt needs to be considered or the running block has ended.
+//
+// NEXT_BYTE() and NEXT_WORD() fetch the operand of an instruction, which has
+// already been decoded when running a block.
+
+#define NEXT_BYTE() (Blocks ? (uint8_t)operand : next_byte(cpu))
+#define NEXT_WORD() (Blocks ? operand : next_word(cpu))
+
+#if ADC_8080_CPU_THREADED_DISPATCH
+#define OPCODE(op) op_##op
+#define NEXT()                                                                 \
+  {                                                                            \
+    if (Blocks) {                                                              \
+      if (uop == uop_end || cache->generation != generation)                   \
+        goto next;                                                             \
+      HOOK_UOP();                                                              \
+      opcode = uop->opcode;                                                    \
+      operand = uop->operand;                                                  \
+      uop++;                                                                   \
+      goto *s_dispatch_table[opcode];                                          \
+    }                                                                          \
+    if (cycles >= cycle_budget || cpu->interrupt_pending ||                    \
+        cpu->interrupt_delay)                                                  \
+      goto next;                                                               \
+    opcode = next_byte(cpu);                                                   \
+    HOOK_OP((uint16_t)(cpu->pc - 1), opcode);                                  \
+    COVER_OP((uint16_t)(cpu->pc - 1), opcode);                                 \
+    cycles += s_cycles_lut[opcode];                                            \
+    goto *s_dispatch_table[opcode];                                            \
+  }
+#define DISPATCH_ROW(h)                                                        \
+  &&op_0x##h##0, &&op_0x##h##1, &&op_0x##h##2, &&op_0x##h##3, &&op_0x##h##4,   \
+      &&op_0x##h##5, &&op_0x##h##6, &&op_0x##h##7, &&op_0x##h##8,              \
+      &&op_0x##h##9, &&op_0x##h##A, &&op_0x##h##B, &&op_0x##h##C,              \
+      &&op_0x##h##D, &&op_0x##h##E, &&op_0x##h##F
+#else
+#define OPCODE(op) case op
+#define NEXT() goto next
+#endif
+
+template <typename Bus>
+template <bool Blocks>
+int I8080<Bus>::exec(adc_8080_cpu *cpu, int cycle_budget) {
+#if ADC_8080_CPU_THREADED_DISPATCH
+  // clang-format off
+  static void *const s_dispatch_table[256] = {
+    DISPATCH_ROW(0), DISPATCH_ROW(1), DISPATCH_ROW(2), DISPATCH_ROW(3),
+    DISPATCH_ROW(4), DISPATCH_ROW(5), DISPATCH_ROW(6), DISPATCH_ROW(7),
+    DISPATCH_ROW(8), DISPATCH_ROW(9), DISPATCH_ROW(A), DISPATCH_ROW(B),
+    DISPATCH_ROW(C), DISPATCH_ROW(D), DISPATCH_ROW(E), DISPATCH_ROW(F)
+  };
+  // clang-format on
+#endif
+
+  int cycles = 0;
+  uint8_t opcode;
+
+  // The running block.
+  adc_8080_cpu_block_cache *cache = cpu->block_cache;
+  const adc_8080_cpu_uop *uop = NULL;
+  const adc_8080_cpu_uop *uop_end = NULL;
+  uint32_t generation = 0;
+  uint16_t operand = 0;
+
+  // The running block if it may be an idle loop, and the state it started in.
+  const adc_8080_cpu_block *idle_block = NULL;
+  IdleState idle_start = {};
+
+#if HOOKS
+  // Address of the next instruction in the running block.
+  uint16_t uop_pc = 0;
+#endif
+
+next:
+  if (Blocks) {
+    if (uop != uop_end) {
+      if (cache->generation == generation) {
+        HOOK_UOP();
+        opcode = uop->opcode;
+        operand = uop->operand;
+        uop++;
+        goto dispatch;
+      }
+
+      // The block has written to cached code, possibly its own. Stop after
+      // the instruction just executed, taking back the cycles and operand
+      // bytes of the rest.
+      for (; uop != uop_end; uop++) {
+        cycles -= s_cycles_lut[uop->opcode];
+        cpu->pc -= uop->length;
+      }
+      COVER_RESUME();
+    }
+
+    if (cycles >= cycle_budget || cpu->break_hit)
+      return cycles;
+
+    // Start the next block if every instruction in it would start within the
+    // budget, and no interrupt can be recognized before it ends. The pc is set
+    // past the block up front since only its last instruction can use it.
+    if (!(cpu->interrupt_pending && cpu->inte) && !cpu->interrupt_delay &&
+        !cpu->halted) {
+      adc_8080_cpu_block *block = find_block(cpu, cpu->pc);
+
+      // Blocks on an EXEC breakpoint are stepped, to stop on it.
+      if (block && exec_breakpoint_in(cpu, block->pc,
+                                      (uint16_t)(block->end_pc - block->pc)))
+        block = NULL;
+
+      if (block && cycles + block->cycles - block->last_cycles < cycle_budget) {
+        if (block->idle_loop && cpu->idle_skip) {
+          // Once an iteration leaves the cpu as it was every iteration does,
+          // so run the iterations which start within the budget at once.
+          IdleState state = idle_state(cpu);
+          if (block == idle_block && same_idle_state(&state, &idle_start)) {
+            int remaining = cycle_budget - cycles -
+                            (block->cycles - block->last_cycles);
+            int iterations = (remaining + block->cycles - 1) / block->cycles;
+            cycles += iterations * block->cycles;
+            HOOK_IDLE_LOOP(block, iterations);
+            idle_block = NULL;
+            goto next;
+          }
+          idle_block = block;
+          idle_start = state;
+        } else {
+          idle_block = NULL;
+        }
+
+        COVER_BLOCK(block);
+#if ADC_8080_CPU_JIT
+        // Instrumentation sees every instruction, so translations aren't run.
+        int native_cycles;
+        if (cpu->jit && !instrumented(cpu) &&
+            run_native(cpu, block, &native_cycles)) {
+          cycles += native_cycles;
+          goto next;
+        }
+#endif
+        cycles += block->cycles;
+        cpu->pc = block->end_pc;
+        uop = block->ops;
+        uop_end = uop + block->count;
+        generation = cache->generation;
+#if HOOKS
+        uop_pc = block->pc;
+#endif
+        goto next;
+      }
+    }
+
+    // Otherwise step a single instruction or interrupt.
+    idle_block = NULL;
+    int step_cycles = exec<false>(cpu, 1);
+    if (step_cycles == 0)
+      return cycles;
+    cycles += step_cycles;
+    goto next;
+  }
+
+  // Stay stopped on a breakpoint until adc_8080_cpu_resume().
+  if (cycles >= cycle_budget || cpu->break_hit)
+    return cycles;
+
+  // Recognize a interrupt request when all of the following
+  // conditions are met:
+  // - There is an interrupt pending.
+  // - The INTE flip-flop is enabled.
+  // - The last instruction being executed has complete.
+  if (cpu->interrupt_pending && cpu->inte && !cpu->interrupt_delay) {
+    // The following states are reset once an interrupt
+    // request is recognized.
+    cpu->interrupt_pending = false;
+    cpu->inte = false;
+    cpu->halted = false;
+
+    // The pc is not incremented here because interrupt
+    // opcodes are not read from memory.
+    opcode = cpu->interrupt_opcode;
+    HOOK_INTERRUPT(opcode);
+    COVER_RESUME();
+  } else if (cpu->halted) {
+    return cycles;
+  } else if (((cpu->read_traps >> (cpu->pc >> ADC_8080_CPU_PAGE_SHIFT)) & 1) &&
+             break_at(cpu, cpu->pc)) {
+    return cycles;
+  } else {
+    opcode = next_byte(cpu);
+    HOOK_OP((uint16_t)(cpu->pc - 1), opcode);
+    COVER_OP((uint16_t)(cpu->pc - 1), opcode);
+  }
+
+  cpu->interrupt_delay = false;
+  cycles += s_cycles_lut[opcode];
+
+dispatch:
+#if ADC_8080_CPU_THREADED_DISPATCH
+  goto *s_dispatch_table[opcode];
+#else
+  switch (opcode) {
+#endif
+  // Carry bit ops
+  OPCODE(0x37): // STC
+    cpu->psw |= FLAG_C;
+    NEXT();
+  OPCODE(0x3F): // CMC
+    cpu->psw ^= FLAG_C;
+    NEXT();
+
+  // Single register ops
+  OPCODE(0x04): // INR B
+    cpu->rb = op_inr(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0x05): // DCR B
+    cpu->rb = op_dcr(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0x0C): // INR C
+    cpu->rc = op_inr(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0x0D): // DCR C
+    cpu->rc = op_dcr(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0x14): // INR D
+    cpu->rd = op_inr(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0x15): // DCR D
+    cpu->rd = op_dcr(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0x1C): // INR E
+    cpu->re = op_inr(cpu, cpu->re);
+    NEXT();
+  OPCODE(0x1D): // DCR E
+    cpu->re = op_dcr(cpu, cpu->re);
+    NEXT();
+  OPCODE(0x24): // INR H
+    cpu->rh = op_inr(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0x25): // DCR H
+    cpu->rh = op_dcr(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0x2C): // INR L
+    cpu->rl = op_inr(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0x2D): // DCR L
+    cpu->rl = op_dcr(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0x34): // INR M
+    write_byte(cpu, get_rhl(), op_inr(cpu, read_byte(cpu, get_rhl())));
+    NEXT();
+  OPCODE(0x35): // DCR M
+    write_byte(cpu, get_rhl(), op_dcr(cpu, read_byte(cpu, get_rhl())));
+    NEXT();
+  OPCODE(0x3C): // INR A
+    cpu->ra = op_inr(cpu, cpu->ra);
+    NEXT();
+  OPCODE(0x3D): // DCR A
+    cpu->ra = op_dcr(cpu, cpu->ra);
+    NEXT();
+  OPCODE(0x2F): // CMA
+    cpu->ra = ~cpu->ra;
+    NEXT();
+  OPCODE(0x27): // DAA
+    op_daa(cpu);
+    NEXT();
+
+  // NOP ops
+  OPCODE(0x00): // NOP
+  OPCODE(0x08): // *NOP
+  OPCODE(0x10): // *NOP
+  OPCODE(0x18): // *NOP
+  OPCODE(0x20): // *NOP
+  OPCODE(0x28): // *NOP
+  OPCODE(0x30): // *NOP
+  OPCODE(0x38): // *NOP
+    NEXT();
+
+  // Data transfer ops
+  OPCODE(0x40): // MOV B,B
+    NEXT();
+  OPCODE(0x41): // MOV B,C
+    cpu->rb = cpu->rc;
+    NEXT();
+  OPCODE(0x42): // MOV B,D
+    cpu->rb = cpu->rd;
+    NEXT();
+  OPCODE(0x43): // MOV B,E
+    cpu->rb = cpu->re;
+    NEXT();
+  OPCODE(0x44): // MOV B,H
+    cpu->rb = cpu->rh;
+    NEXT();
+  OPCODE(0x45): // MOV B,L
+    cpu->rb = cpu->rl;
+    NEXT();
+  OPCODE(0x46): // MOV B,M
+    cpu->rb = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x47): // MOV B,A
+    cpu->rb = cpu->ra;
+    NEXT();
+  OPCODE(0x48): // MOV C,B
+    cpu->rc = cpu->rb;
+    NEXT();
+  OPCODE(0x49): // MOV C,C
+    NEXT();
+  OPCODE(0x4A): // MOV C,D
+    cpu->rc = cpu->rd;
+    NEXT();
+  OPCODE(0x4B): // MOV C,E
+    cpu->rc = cpu->re;
+    NEXT();
+  OPCODE(0x4C): // MOV C,H
+    cpu->rc = cpu->rh;
+    NEXT();
+  OPCODE(0x4D): // MOV C,L
+    cpu->rc = cpu->rl;
+    NEXT();
+  OPCODE(0x4E): // MOV C,M
+    cpu->rc = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x4F): // MOV C,A
+    cpu->rc = cpu->ra;
+    NEXT();
+  OPCODE(0x50): // MOV D,B
+    cpu->rd = cpu->rb;
+    NEXT();
+  OPCODE(0x51): // MOV D,C
+    cpu->rd = cpu->rc;
+    NEXT();
+  OPCODE(0x52): // MOV D,D
+    NEXT();
+  OPCODE(0x53): // MOV D,E
+    cpu->rd = cpu->re;
+    NEXT();
+  OPCODE(0x54): // MOV D,H
+    cpu->rd = cpu->rh;
+    NEXT();
+  OPCODE(0x55): // MOV D,L
+    cpu->rd = cpu->rl;
+    NEXT();
+  OPCODE(0x56): // MOV D,M
+    cpu->rd = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x57): // MOV D,A
+    cpu->rd = cpu->ra;
+    NEXT();
+  OPCODE(0x58): // MOV E,B
+    cpu->re = cpu->rb;
+    NEXT();
+  OPCODE(0x59): // MOV E,C
+    cpu->re = cpu->rc;
+    NEXT();
+  OPCODE(0x5A): // MOV E,D
+    cpu->re = cpu->rd;
+    NEXT();
+  OPCODE(0x5B): // MOV E,E
+    NEXT();
+  OPCODE(0x5C): // MOV E,H
+    cpu->re = cpu->rh;
+    NEXT();
+  OPCODE(0x5D): // MOV E,L
+    cpu->re = cpu->rl;
+    NEXT();
+  OPCODE(0x5E): // MOV E,M
+    cpu->re = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x5F): // MOV E,A
+    cpu->re = cpu->ra;
+    NEXT();
+  OPCODE(0x60): // MOV H,B
+    cpu->rh = cpu->rb;
+    NEXT();
+  OPCODE(0x61): // MOV H,C
+    cpu->rh = cpu->rc;
+    NEXT();
+  OPCODE(0x62): // MOV H,D
+    cpu->rh = cpu->rd;
+    NEXT();
+  OPCODE(0x63): // MOV H,E
+    cpu->rh = cpu->re;
+    NEXT();
+  OPCODE(0x64): // MOV H,H
+    NEXT();
+  OPCODE(0x65): // MOV H,L
+    cpu->rh = cpu->rl;
+    NEXT();
+  OPCODE(0x66): // MOV H,M
+    cpu->rh = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x67): // MOV H,A
+    cpu->rh = cpu->ra;
+    NEXT();
+  OPCODE(0x68): // MOV L,B
+    cpu->rl = cpu->rb;
+    NEXT();
+  OPCODE(0x69): // MOV L,C
+    cpu->rl = cpu->rc;
+    NEXT();
+  OPCODE(0x6A): // MOV L,D
+    cpu->rl = cpu->rd;
+    NEXT();
+  OPCODE(0x6B): // MOV L,E
+    cpu->rl = cpu->re;
+    NEXT();
+  OPCODE(0x6C): // MOV L,H
+    cpu->rl = cpu->rh;
+    NEXT();
+  OPCODE(0x6D): // MOV L,L
+    NEXT();
+  OPCODE(0x6E): // MOV L,M
+    cpu->rl = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x6F): // MOV L,A
+    cpu->rl = cpu->ra;
+    NEXT();
+  OPCODE(0x70): // MOV M,B
+    write_byte(cpu, get_rhl(), cpu->rb);
+    NEXT();
+  OPCODE(0x71): // MOV M,C
+    write_byte(cpu, get_rhl(), cpu->rc);
+    NEXT();
+  OPCODE(0x72): // MOV M,D
+    write_byte(cpu, get_rhl(), cpu->rd);
+    NEXT();
+  OPCODE(0x73): // MOV M,E
+    write_byte(cpu, get_rhl(), cpu->re);
+    NEXT();
+  OPCODE(0x74): // MOV M,H
+    write_byte(cpu, get_rhl(), cpu->rh);
+    NEXT();
+  OPCODE(0x75): // MOV M,L
+    write_byte(cpu, get_rhl(), cpu->rl);
+    NEXT();
+  OPCODE(0x77): // MOV M,A
+    write_byte(cpu, get_rhl(), cpu->ra);
+    NEXT();
+  OPCODE(0x78): // MOV A,B
+    cpu->ra = cpu->rb;
+    NEXT();
+  OPCODE(0x79): // MOV A,C
+    cpu->ra = cpu->rc;
+    NEXT();
+  OPCODE(0x7A): // MOV A,D
+    cpu->ra = cpu->rd;
+    NEXT();
+  OPCODE(0x7B): // MOV A,E
+    cpu->ra = cpu->re;
+    NEXT();
+  OPCODE(0x7C): // MOV A,H
+    cpu->ra = cpu->rh;
+    NEXT();
+  OPCODE(0x7D): // MOV A,L
+    cpu->ra = cpu->rl;
+    NEXT();
+  OPCODE(0x7E): // MOV A,M
+    cpu->ra = read_byte(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x7F): // MOV A,A
+    NEXT();
+
+  // Register or memory to accumulator ops
+  OPCODE(0x80): // ADD B
+    op_add(cpu, cpu->rb, 0);
+    NEXT();
+  OPCODE(0x81): // ADD C
+    op_add(cpu, cpu->rc, 0);
+    NEXT();
+  OPCODE(0x82): // ADD D
+    op_add(cpu, cpu->rd, 0);
+    NEXT();
+  OPCODE(0x83): // ADD E
+    op_add(cpu, cpu->re, 0);
+    NEXT();
+  OPCODE(0x84): // ADD H
+    op_add(cpu, cpu->rh, 0);
+    NEXT();
+  OPCODE(0x85): // ADD L
+    op_add(cpu, cpu->rl, 0);
+    NEXT();
+  OPCODE(0x86): // ADD M
+    op_add(cpu, read_byte(cpu, get_rhl()), 0);
+    NEXT();
+  OPCODE(0x87): // ADD A
+    op_add(cpu, cpu->ra, 0);
+    NEXT();
+  OPCODE(0x88): // ADC B
+    op_add(cpu, cpu->rb, flag_c(cpu));
+    NEXT();
+  OPCODE(0x89): // ADC C
+    op_add(cpu, cpu->rc, flag_c(cpu));
+    NEXT();
+  OPCODE(0x8A): // ADC D
+    op_add(cpu, cpu->rd, flag_c(cpu));
+    NEXT();
+  OPCODE(0x8B): // ADC E
+    op_add(cpu, cpu->re, flag_c(cpu));
+    NEXT();
+  OPCODE(0x8C): // ADC H
+    op_add(cpu, cpu->rh, flag_c(cpu));
+    NEXT();
+  OPCODE(0x8D): // ADC L
+    op_add(cpu, cpu->rl, flag_c(cpu));
+    NEXT();
+  OPCODE(0x8E): // ADC M
+    op_add(cpu, read_byte(cpu, get_rhl()), flag_c(cpu));
+    NEXT();
+  OPCODE(0x8F): // ADC A
+    op_add(cpu, cpu->ra, flag_c(cpu));
+    NEXT();
+  OPCODE(0x90): // SUB B
+    op_sub(cpu, cpu->rb, 0);
+    NEXT();
+  OPCODE(0x91): // SUB C
+    op_sub(cpu, cpu->rc, 0);
+    NEXT();
+  OPCODE(0x92): // SUB D
+    op_sub(cpu, cpu->rd, 0);
+    NEXT();
+  OPCODE(0x93): // SUB E
+    op_sub(cpu, cpu->re, 0);
+    NEXT();
+  OPCODE(0x94): // SUB H
+    op_sub(cpu, cpu->rh, 0);
+    NEXT();
+  OPCODE(0x95): // SUB L
+    op_sub(cpu, cpu->rl, 0);
+    NEXT();
+  OPCODE(0x96): // SUB M
+    op_sub(cpu, read_byte(cpu, get_rhl()), 0);
+    NEXT();
+  OPCODE(0x97): // SUB A
+    op_sub(cpu, cpu->ra, 0);
+    NEXT();
+  OPCODE(0x98): // SBB B
+    op_sub(cpu, cpu->rb, flag_c(cpu));
+    NEXT();
+  OPCODE(0x99): // SBB C
+    op_sub(cpu, cpu->rc, flag_c(cpu));
+    NEXT();
+  OPCODE(0x9A): // SBB D
+    op_sub(cpu, cpu->rd, flag_c(cpu));
+    NEXT();
+  OPCODE(0x9B): // SBB E
+    op_sub(cpu, cpu->re, flag_c(cpu));
+    NEXT();
+  OPCODE(0x9C): // SBB H
+    op_sub(cpu, cpu->rh, flag_c(cpu));
+    NEXT();
+  OPCODE(0x9D): // SBB L
+    op_sub(cpu, cpu->rl, flag_c(cpu));
+    NEXT();
+  OPCODE(0x9E): // SBB M
+    op_sub(cpu, read_byte(cpu, get_rhl()), flag_c(cpu));
+    NEXT();
+  OPCODE(0x9F): // SBB A
+    op_sub(cpu, cpu->ra, flag_c(cpu));
+    NEXT();
+  OPCODE(0xA0): // ANA B
+    op_ana(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0xA1): // ANA C
+    op_ana(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0xA2): // ANA D
+    op_ana(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0xA3): // ANA E
+    op_ana(cpu, cpu->re);
+    NEXT();
+  OPCODE(0xA4): // ANA H
+    op_ana(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0xA5): // ANA L
+    op_ana(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0xA6): // ANA M
+    op_ana(cpu, read_byte(cpu, get_rhl()));
+    NEXT();
+  OPCODE(0xA7): // ANA A
+    op_ana(cpu, cpu->ra);
+    NEXT();
+  OPCODE(0xA8): // XRA B
+    op_xra(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0xA9): // XRA C
+    op_xra(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0xAA): // XRA D
+    op_xra(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0xAB): // XRA E
+    op_xra(cpu, cpu->re);
+    NEXT();
+  OPCODE(0xAC): // XRA H
+    op_xra(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0xAD): // XRA L
+    op_xra(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0xAE): // XRA M
+    op_xra(cpu, read_byte(cpu, get_rhl()));
+    NEXT();
+  OPCODE(0xAF): // XRA A
+    op_xra(cpu, cpu->ra);
+    NEXT();
+  OPCODE(0xB0): // ORA B
+    op_ora(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0xB1): // ORA C
+    op_ora(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0xB2): // ORA D
+    op_ora(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0xB3): // ORA E
+    op_ora(cpu, cpu->re);
+    NEXT();
+  OPCODE(0xB4): // ORA H
+    op_ora(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0xB5): // ORA L
+    op_ora(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0xB6): // ORA M
+    op_ora(cpu, read_byte(cpu, get_rhl()));
+    NEXT();
+  OPCODE(0xB7): // ORA A
+    op_ora(cpu, cpu->ra);
+    NEXT();
+  OPCODE(0xB8): // CMP B
+    op_cmp(cpu, cpu->rb);
+    NEXT();
+  OPCODE(0xB9): // CMP C
+    op_cmp(cpu, cpu->rc);
+    NEXT();
+  OPCODE(0xBA): // CMP D
+    op_cmp(cpu, cpu->rd);
+    NEXT();
+  OPCODE(0xBB): // CMP E
+    op_cmp(cpu, cpu->re);
+    NEXT();
+  OPCODE(0xBC): // CMP H
+    op_cmp(cpu, cpu->rh);
+    NEXT();
+  OPCODE(0xBD): // CMP L
+    op_cmp(cpu, cpu->rl);
+    NEXT();
+  OPCODE(0xBE): // CMP M
+    op_cmp(cpu, read_byte(cpu, get_rhl()));
+    NEXT();
+  OPCODE(0xBF): // CMP A
+    op_cmp(cpu, cpu->ra);
+    NEXT();
+
+  // Rotate accumulator opts
+  OPCODE(0x07): // RLC
+    op_rlc(cpu);
+    NEXT();
+  OPCODE(0x0F): // RRC
+    op_rrc(cpu);
+    NEXT();
+  OPCODE(0x17): // RAL
+    op_ral(cpu);
+    NEXT();
+  OPCODE(0x1F): // RAR
+    op_rar(cpu);
+    NEXT();
+
+  // Register pair ops
+  OPCODE(0xC5): // PUSH B
+    stack_push(cpu, get_rbc());
+    NEXT();
+  OPCODE(0xD5): // PUSH D
+    stack_push(cpu, get_rde());
+    NEXT();
+  OPCODE(0xE5): // PUSH H
+    stack_push(cpu, get_rhl());
+    NEXT();
+  OPCODE(0xF5): // PUSH PSW
+    op_push_psw(cpu);
+    NEXT();
+  OPCODE(0xC1): // POP B
+    set_rbc(stack_pop(cpu));
+    NEXT();
+  OPCODE(0xD1): // POP D
+    set_rde(stack_pop(cpu));
+    NEXT();
+  OPCODE(0xE1): // POP H
+    set_rhl(stack_pop(cpu));
+    NEXT();
+  OPCODE(0xF1): // POP PSW
+    op_pop_psw(cpu);
+    NEXT();
+  OPCODE(0x09): // DAD B
+    op_dad(cpu, get_rbc());
+    NEXT();
+  OPCODE(0x19): // DAD D
+    op_dad(cpu, get_rde());
+    NEXT();
+  OPCODE(0x29): // DAD H
+    op_dad(cpu, get_rhl());
+    NEXT();
+  OPCODE(0x39): // DAD SP
+    op_dad(cpu, cpu->sp);
+    NEXT();
+  OPCODE(0x03): // INX B
+    set_rbc(get_rbc() + 1);
+    NEXT();
+  OPCODE(0x13): // INX D
+    set_rde(get_rde() + 1);
+    NEXT();
+  OPCODE(0x23): // INX H
+    set_rhl(get_rhl() + 1);
+    NEXT();
+  OPCODE(0x33): // INX SP
+    cpu->sp++;
+    NEXT();
+  OPCODE(0x0B): // DCX B
+    set_rbc(get_rbc() - 1);
+    NEXT();
+  OPCODE(0x1B): // DCX D
+    set_rde(get_rde() - 1);
+    NEXT();
+  OPCODE(0x2B): // DCX H
+    set_rhl(get_rhl() - 1);
+    NEXT();
+  OPCODE(0x3B): // DCX SP
+    cpu->sp--;
+    NEXT();
+  OPCODE(0xEB): // XCHG
+    op_xchg(cpu);
+    NEXT();
+  OPCODE(0xE3): // XTHL
+    op_xthl(cpu);
+    NEXT();
+  OPCODE(0xF9): // SPHL
+    cpu->sp = get_rhl();
+    NEXT();
+
+  // Immediate ops
+  OPCODE(0x01): // LXI B
+    set_rbc(NEXT_WORD());
+    NEXT();
+  OPCODE(0x11): // LXI D
+    set_rde(NEXT_WORD());
+    NEXT();
+  OPCODE(0x21): // LXI H
+    set_rhl(NEXT_WORD());
+    NEXT();
+  OPCODE(0x31): // LXI SP
+    cpu->sp = NEXT_WORD();
+    NEXT();
+  OPCODE(0x06): // MVI B
+    cpu->rb = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x0E): // MVI C
+    cpu->rc = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x16): // MVI D
+    cpu->rd = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x1E): // MVI E
+    cpu->re = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x26): // MVI H
+    cpu->rh = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x2E): // MVI L
+    cpu->rl = NEXT_BYTE();
+    NEXT();
+  OPCODE(0x36): // MVI M
+    write_byte(cpu, get_rhl(), NEXT_BYTE());
+    NEXT();
+  OPCODE(0x3E): // MVI A
+    cpu->ra = NEXT_BYTE();
+    NEXT();
+  OPCODE(0xC6): // ADI
+    op_add(cpu, NEXT_BYTE(), 0);
+    NEXT();
+  OPCODE(0xCE): // ACI
+    op_add(cpu, NEXT_BYTE(), flag_c(cpu));
+    NEXT();
+  OPCODE(0xD6): // SUI
+    op_sub(cpu, NEXT_BYTE(), 0);
+    NEXT();
+  OPCODE(0xDE): // SBI
+    op_sub(cpu, NEXT_BYTE(), flag_c(cpu));
+    NEXT();
+  OPCODE(0xE6): // ANI
+    op_ana(cpu, NEXT_BYTE());
+    NEXT();
+  OPCODE(0xEE): // XRI
+    op_xra(cpu, NEXT_BYTE());
+    NEXT();
+  OPCODE(0xF6): // ORI
+    op_ora(cpu, NEXT_BYTE());
+    NEXT();
+  OPCODE(0xFE): // CPI
+    op_cmp(cpu, NEXT_BYTE());
+    NEXT();
+
+  // Direct addressing ops
+  OPCODE(0x02): // STAX B
+    write_byte(cpu, get_rbc(), cpu->ra);
+    NEXT();
+  OPCODE(0x12): // STAX D
+    write_byte(cpu, get_rde(), cpu->ra);
+    NEXT();
+  OPCODE(0x32): // STA
+    write_byte(cpu, NEXT_WORD(), cpu->ra);
+    NEXT();
+  OPCODE(0x0A): // LDAX B
+    cpu->ra = read_byte(cpu, get_rbc());
+    NEXT();
+  OPCODE(0x1A): // LDAX D
+    cpu->ra = read_byte(cpu, get_rde());
+    NEXT();
+  OPCODE(0x3A): // LDA
+    cpu->ra = read_byte(cpu, NEXT_WORD());
+    NEXT();
+  OPCODE(0x22): // SHLD
+    write_word(cpu, NEXT_WORD(), get_rhl());
+    NEXT();
+  OPCODE(0x2A): // LHLD
+    set_rhl(read_word(cpu, NEXT_WORD()));
+    NEXT();
+
+  // Jump ops
+  OPCODE(0xE9): // PCHL
+    cpu->pc = get_rhl();
+    NEXT();
+  OPCODE(0xC2): // JNZ
+    op_jmp_cond(cpu, NEXT_WORD(), !flag_z(cpu));
+    NEXT();
+  OPCODE(0xC3): // JMP
+  OPCODE(0xCB): // *JMP
+    cpu->pc = NEXT_WORD();
+    NEXT();
+  OPCODE(0xCA): // JZ
+    op_jmp_cond(cpu, NEXT_WORD(), flag_z(cpu));
+    NEXT();
+  OPCODE(0xD2): // JNC
+    op_jmp_cond(cpu, NEXT_WORD(), !flag_c(cpu));
+    NEXT();
+  OPCODE(0xDA): // JC
+    op_jmp_cond(cpu, NEXT_WORD(), flag_c(cpu));
+    NEXT();
+  OPCODE(0xE2): // JPO
+    op_jmp_cond(cpu, NEXT_WORD(), !flag_p(cpu));
+    NEXT();
+  OPCODE(0xEA): // JPE
+    op_jmp_cond(cpu, NEXT_WORD(), flag_p(cpu));
+    NEXT();
+  OPCODE(0xF2): // JP
+    op_jmp_cond(cpu, NEXT_WORD(), !flag_s(cpu));
+    NEXT();
+  OPCODE(0xFA): // JM
+    op_jmp_cond(cpu, NEXT_WORD(), flag_s(cpu));
+    NEXT();
+
+  // Call ops
+  OPCODE(0xCD): // CALL
+  OPCODE(0xDD): // *CALL
+  OPCODE(0xED): // *CALL
+  OPCODE(0xFD): // *CALL
+    op_call(cpu, NEXT_WORD());
+    NEXT();
+  OPCODE(0xDC): // CC
+    cycles += op_call_cond(cpu, NEXT_WORD(), flag_c(cpu));
+    NEXT();
+  OPCODE(0xD4): // CNC
+    cycles += op_call_cond(cpu, NEXT_WORD(), !flag_c(cpu));
+    NEXT();
+  OPCODE(0xCC): // CZ
+    cycles += op_call_cond(cpu, NEXT_WORD(), flag_z(cpu));
+    NEXT();
+  OPCODE(0xC4): // CNZ
+    cycles += op_call_cond(cpu, NEXT_WORD(), !flag_z(cpu));
+    NEXT();
+  OPCODE(0xF4): // CP
+    cycles += op_call_cond(cpu, NEXT_WORD(), !flag_s(cpu));
+    NEXT();
+  OPCODE(0xFC): // CM
+    cycles += op_call_cond(cpu, NEXT_WORD(), flag_s(cpu));
+    NEXT();
+  OPCODE(0xEC): // CPE
+    cycles += op_call_cond(cpu, NEXT_WORD(), flag_p(cpu));
+    NEXT();
+  OPCODE(0xE4): // CPO
+    cycles += op_call_cond(cpu, NEXT_WORD(), !flag_p(cpu));
+    NEXT();
+
+  // Return ops
+  OPCODE(0xC9): // RET
+  OPCODE(0xD9): // *RET
+    cpu->pc = stack_pop(cpu);
+    NEXT();
+  OPCODE(0xD8): // RC
+    cycles += op_ret_cond(cpu, flag_c(cpu));
+    NEXT();
+  OPCODE(0xD0): // RNC
+    cycles += op_ret_cond(cpu, !flag_c(cpu));
+    NEXT();
+  OPCODE(0xC8): // RZ
+    cycles += op_ret_cond(cpu, flag_z(cpu));
+    NEXT();
+  OPCODE(0xC0): // RNZ
+    cycles += op_ret_cond(cpu, !flag_z(cpu));
+    NEXT();
+  OPCODE(0xF8): // RM
+    cycles += op_ret_cond(cpu, flag_s(cpu));
+    NEXT();
+  OPCODE(0xF0): // RP
+    cycles += op_ret_cond(cpu, !flag_s(cpu));
+    NEXT();
+  OPCODE(0xE8): // RPE
+    cycles += op_ret_cond(cpu, flag_p(cpu));
+    NEXT();
+  OPCODE(0xE0): // RPO
+    cycles += op_ret_cond(cpu, !flag_p(cpu));
+    NEXT();
+
+  // RST ops
+  OPCODE(0xC7): // RST 0
+    op_call(cpu, 0x00);
+    NEXT();
+  OPCODE(0xCF): // RST 1
+    op_call(cpu, 0x08);
+    NEXT();
+  OPCODE(0xD7): // RST 2
+    op_call(cpu, 0x10);
+    NEXT();
+  OPCODE(0xDF): // RST 3
+    op_call(cpu, 0x18);
+    NEXT();
+  OPCODE(0xE7): // RST 4
+    op_call(cpu, 0x20);
+    NEXT();
+  OPCODE(0xEF): // RST 5
+    op_call(cpu, 0x28);
+    NEXT();
+  OPCODE(0xF7): // RST 6
+    op_call(cpu, 0x30);
+    NEXT();
+  OPCODE(0xFF): // RST 7
+    op_call(cpu, 0x38);
+    NEXT();
+
+  // INTE flip-flop ops
+  OPCODE(0xFB): // EI
+    cpu->inte = true;
+    cpu->interrupt_delay = true;
+    NEXT();
+  OPCODE(0xF3): // DI
+    cpu->inte = false;
+    NEXT();
+
+  // Device read/write ops
+  OPCODE(0xDB): // IN
+    cpu->ra = Bus::in(cpu, NEXT_BYTE());
+    NEXT();
+  OPCODE(0xD3): // OUT
+    Bus::out(cpu, NEXT_BYTE(), cpu->ra);
+    NEXT();
+
+  // HLT ops
+  OPCODE(0x76): // HLT
+    cpu->halted = true;
+    goto next;
+
+#if !ADC_8080_CPU_THREADED_DISPATCH
+  }
+#endif
+}
+
+#undef get_rbc
+#undef get_rde
+#undef get_rhl
+#undef set_rbc
+#undef set_rde
+#undef set_rhl
+#undef OPCODE
+#undef NEXT
+#undef NEXT_BYTE
+#undef NEXT_WORD
+#undef DISPATCH_ROW
+#undef HOOKS
+#undef HOOK_OP
+#undef HOOK_UOP
+#undef HOOK_INTERRUPT
+#undef HOOK_EXTRA_CYCLES
+#undef HOOK_IDLE_LOOP
+#undef HOOK_IDLE_CYCLES
+#undef COVER_OP
+#undef COVER_BLOCK
+#undef COVER_RESUME
+
+} // namespace adc
+
+#endif // __cplusplus
+
+// End C++ template core
+
 #endif // _ADC_8080_CPU_H_
@@ -1,5 +1,4 @@
 // SDL2 platform layer implementation.
-#define ADC_LOG_IMPLEMENTATION
 
 #include <glad/glad.h>
 
@@ -15,6 +15,13 @@
 #define DRAWT_CRT_H 224 * 3
 
 struct SpaceInvaders {
+  Machine *machine;
+  uint32_t *display_pixels;
+  uint32_t display_frame_count;
+  Texture tex_display;
+  // Quick save slot for Emulation > Save State and Load State.
+  MachineState saved_state;
+  bool has_saved_state;
   Texture tex_background;
   Texture tex_overlay;
   Texture drawt_machinefb_with_overlay;
@@ -35,6 +42,12 @@ int load_texture_from_file(Texture *texture, const char *filepath);
 int setup_upscale_draw_target(int device_width, int device_height);
 void setup_upscale_dest_rect(int device_width, int device_height);
 
+// Machine output utilities
+//
+
+void update_display_texture();
+void play_sound_events(uint32_t events);
+
 // Space Invaders implementation
 //
 
@@ -55,8 +68,24 @@ int spinvaders_setup() {
   }
 
   // Setup the machine.
-  if (machine_setup() != 0) {
-    adc_log_error("Failed to setup the spinvaders_machine!");
+  s_spinvaders.machine = machine_create();
+  if (!s_spinvaders.machine) {
+    adc_log_error("Failed to create the spinvaders_machine!");
+    return -1;
+  }
+
+  // Create the texture the machine frames are drawn from.
+  s_spinvaders.display_pixels =
+      (uint32_t *)calloc(MACHINE_DISPLAY_WIDTH * MACHINE_DISPLAY_HEIGHT, 4);
+  if (!s_spinvaders.display_pixels) {
+    adc_log_error("Failed to malloc() machine display stencil pixels!");
+    return -1;
+  }
+  TextureParams pxparams = {TEXTURE_TYPE_PIXEL_ACCESS};
+  if (renderer_create_texture(&s_spinvaders.tex_display, MACHINE_DISPLAY_WIDTH,
+                              MACHINE_DISPLAY_HEIGHT, s_spinvaders.display_pixels,
+                              pxparams) != 0) {
+    adc_log_error("Failed to create tex_display!");
     return -1;
   }
 
@@ -118,21 +147,120 @@ void spinvaders_shutdown() {
   renderer_destroy_texture(&s_spinvaders.drawt_final_upscale);
   renderer_destroy_texture(&s_spinvaders.drawt_main);
   renderer_destroy_texture(&s_spinvaders.drawt_machinefb_with_overlay);
+  renderer_destroy_texture(&s_spinvaders.tex_display);
+  free(s_spinvaders.display_pixels);
+  s_spinvaders.display_pixels = nullptr;
 
-  machine_shutdown();
+  machine_destroy(s_spinvaders.machine);
+  s_spinvaders.machine = nullptr;
   renderer_shutdown();
 }
 
 void spinvaders_tick(const InputState *input) {
-  machine_tick(input);
+  machine_tick(s_spinvaders.machine, input);
+  play_sound_events(machine_sound_events(s_spinvaders.machine));
+  update_display_texture();
 }
 
 bool spinvaders_paused() {
-  return machine_paused();
+  return machine_paused(s_spinvaders.machine);
 }
 
 void spinvaders_set_pause(bool pause) {
-  machine_set_pause(pause);
+  machine_set_pause(s_spinvaders.machine, pause);
+}
+
+bool spinvaders_jit_available() {
+  return machine_jit_available(s_spinvaders.machine);
+}
+
+bool spinvaders_jit_enabled() {
+  return machine_jit_enabled(s_spinvaders.machine);
+}
+
+void spinvaders_set_jit(bool enable) {
+  machine_set_jit(s_spinvaders.machine, enable);
+}
+
+void spinvaders_save_state() {
+  machine_save_state(s_spinvaders.machine, &s_spinvaders.saved_state);
+  s_spinvaders.has_saved_state = true;
+}
+
+void spinvaders_load_state() {
+  if (!s_spinvaders.has_saved_state ||
+      machine_load_state(s_spinvaders.machine, &s_spinvaders.saved_state) != 0) {
+    return;
+  }
+
+  // Show the frame of the state straight away, even when paused.
+  s_spinvaders.display_frame_count = machine_frame_count(s_spinvaders.machine);
+  machine_frame_pixels(s_spinvaders.machine, s_spinvaders.display_pixels);
+  renderer_update_texture(&s_spinvaders.tex_display, s_spinvaders.display_pixels);
+}
+
+bool spinvaders_has_saved_state() {
+  return s_spinvaders.has_saved_state;
+}
+
+bool spinvaders_profile_available() {
+  return machine_profile_available(s_spinvaders.machine);
+}
+
+int spinvaders_profile_hot_spots(adc_8080_cpu_hot_spot *hot_spots, int max) {
+  return machine_profile_hot_spots(s_spinvaders.machine, hot_spots, max);
+}
+
+uint64_t spinvaders_profile_cycles() {
+  return machine_profile_cycles(s_spinvaders.machine);
+}
+
+void spinvaders_reset_profile() {
+  machine_reset_profile(s_spinvaders.machine);
+}
+
+int spinvaders_write_profile(const char *filepath) {
+  return machine_write_profile(s_spinvaders.machine, filepath);
+}
+
+bool spinvaders_trace_available() {
+  return machine_trace_available(s_spinvaders.machine);
+}
+
+int spinvaders_write_trace(const char *filepath) {
+  return machine_write_trace(s_spinvaders.machine, filepath);
+}
+
+bool spinvaders_coverage_available() {
+  return machine_coverage_available(s_spinvaders.machine);
+}
+
+int spinvaders_coverage_addresses() {
+  return machine_coverage_addresses(s_spinvaders.machine);
+}
+
+void spinvaders_reset_coverage() {
+  machine_reset_coverage(s_spinvaders.machine);
+}
+
+int spinvaders_write_coverage(const char *filepath) {
+  return machine_write_coverage(s_spinvaders.machine, filepath);
+}
+
+int spinvaders_add_breakpoint(uint16_t addr, uint16_t size, int flags) {
+  return machine_add_breakpoint(s_spinvaders.machine, addr, size, flags);
+}
+
+void spinvaders_remove_breakpoint(int index) {
+  machine_remove_breakpoint(s_spinvaders.machine, index);
+}
+
+const adc_8080_cpu_breakpoints *spinvaders_breakpoints() {
+  return machine_breakpoints(s_spinvaders.machine);
+}
+
+bool spinvaders_break_hit() {
+  return machine_break_hit(s_spinvaders.machine);
 }
 
 void spinvaders_draw() {
@@ -145,7 +273,7 @@ void spinvaders_draw() {
   // Draw the machine framebuffer with color overlay at 1024x672.
   renderer_set_draw_target(drawt_machinefb_with_overlay);
   renderer_clear();
-  renderer_draw_texture_with_colormap(machine_get_display_texture(), tex_overlay);
+  renderer_draw_texture_with_colormap(&s_spinvaders.tex_display, tex_overlay);
 
   // Draw the display with crt scanlines and barrel distortion.
   const Texture *display_with_crt = effects_crt_draw(drawt_machinefb_with_overlay);
@@ -331,3 +459,47 @@ static int get_upscale(int *sx, int *sy, int device_width, int device_height) {
 
   return limit_upscale(sx, sy);
 }
+
+// Machine output utilities implementation
+//
+
+void update_display_texture() {
+  // Only expand the frame when the machine has latched a new one.
+  uint32_t frame_count = machine_frame_count(s_spinvaders.machine);
+  if (frame_count == s_spinvaders.display_frame_count) {
+    return;
+  }
+  s_spinvaders.display_frame_count = frame_count;
+
+  machine_frame_pixels(s_spinvaders.machine, s_spinvaders.display_pixels);
+  renderer_update_texture(&s_spinvaders.tex_display, s_spinvaders.display_pixels);
+}
+
+void play_sound_events(uint32_t events) {
+  static const struct {
+    uint32_t event;
+    Sound sound;
+  } sounds[] = {
+      {MACHINE_SOUND_UFO_HIT, SOUND_UFO_HIT},
+      {MACHINE_SOUND_FIRE, SOUND_FIRE},
+      {MACHINE_SOUND_EXPLOSION, SOUND_EXPLOSION},
+      {MACHINE_SOUND_INVADER_DIE, SOUND_INVADER_DIE},
+      {MACHINE_SOUND_FLEET_MOVE_1, SOUND_FLEET_MOVE_1},
+      {MACHINE_SOUND_FLEET_MOVE_2, SOUND_FLEET_MOVE_2},
+      {MACHINE_SOUND_FLEET_MOVE_3, SOUND_FLEET_MOVE_3},
+      {MACHINE_SOUND_FLEET_MOVE_4, SOUND_FLEET_MOVE_4},
+      {MACHINE_SOUND_COIN_INSERTED, SOUND_COIN_INSERTED},
+  };
+
+  if (events & MACHINE_SOUND_UFO_START) {
+    sound_play(SOUND_UFO, true);
+  }
+  if (events & MACHINE_SOUND_UFO_STOP) {
+    sound_stop(SOUND_UFO);
+  }
+  for (size_t i = 0; i < sizeof(sounds) / sizeof(sounds[0]); i++) {
+    if (events & sounds[i].event) {
+      sound_play(sounds[i].sound);
+    }
+  }
+}
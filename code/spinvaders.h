@@ -1,6 +1,8 @@
 #ifndef _SPINVADERS_H_
 #define _SPINVADERS_H_
 
+#include "lib/adc_8080_cpu.h"
+#include "spinvaders_machine.h"
 #include "spinvaders_shared.h"
 
 // Space Invaders application service interface.
@@ -12,23 +14,6 @@
 // The platform layer will consume this service to get the application running
 // on the target plaform.
 
-enum Button
-{
-  BUTTON_LEFT = 0,
-  BUTTON_RIGHT,
-  BUTTON_FIRE,
-  BUTTON_START_1P,
-  BUTTON_START_2P,
-  BUTTON_INSERT_CREDIT,
-  BUTTON_TILT
-};
-
-#define BUTTON_DOWN(input, btn) (((input)->buttons >> (btn)) & 1)
-
-struct InputState {
-  uint32_t buttons;
-};
-
 int spinvaders_setup();
 
 void spinvaders_shutdown();
@@ -39,6 +24,48 @@ bool spinvaders_paused();
 
 void spinvaders_set_pause(bool pause);
 
+bool spinvaders_jit_available();
+
+bool spinvaders_jit_enabled();
+
+void spinvaders_set_jit(bool enable);
+
+void spinvaders_save_state();
+
+void spinvaders_load_state();
+
+bool spinvaders_has_saved_state();
+
+bool spinvaders_profile_available();
+
+int spinvaders_profile_hot_spots(adc_8080_cpu_hot_spot *hot_spots, int max);
+
+uint64_t spinvaders_profile_cycles();
+
+void spinvaders_reset_profile();
+
+int spinvaders_write_profile(const char *filepath);
+
+bool spinvaders_trace_available();
+
+int spinvaders_write_trace(const char *filepath);
+
+bool spinvaders_coverage_available();
+
+int spinvaders_coverage_addresses();
+
+void spinvaders_reset_coverage();
+
+int spinvaders_write_coverage(const char *filepath);
+
+int spinvaders_add_breakpoint(uint16_t addr, uint16_t size, int flags);
+
+void spinvaders_remove_breakpoint(int index);
+
+const adc_8080_cpu_breakpoints *spinvaders_breakpoints();
+
+bool spinvaders_break_hit();
+
 void spinvaders_draw();
 
 void spinvaders_resize(int device_width, int device_height);
@@ -0,0 +1,39 @@
+#ifdef SPINVADERS_AOT
+
+#include "spinvaders_aot.h"
+
+int aot_run(adc_8080_cpu *cpu, int cycle_budget) {
+  int cycles = 0;
+  while (cycles < cycle_budget && !cpu->break_hit) {
+    // Call the block at the pc if every instruction in it would start within
+    // the budget, and no interrupt can be recognized before it ends. Pages
+    // which may hold a breakpoint are stepped to stop on it. Every instruction
+    // of a block starts in the page of the pc, so only that page is checked.
+    if (cpu->pc < AOT_ROM_SIZE && !(cpu->interrupt_pending && cpu->inte) &&
+        !cpu->interrupt_delay && !cpu->halted &&
+        !((cpu->read_traps >> (cpu->pc >> ADC_8080_CPU_PAGE_SHIFT)) & 1)) {
+      const AotBlock *block = &aot_blocks[cpu->pc];
+      if (block->run && cycles + block->cycles - block->last_cycles < cycle_budget) {
+        cycles += block->run(cpu);
+        continue;
+      }
+    }
+
+    // Otherwise step a single instruction or interrupt, e.g. after an indirect
+    // jump to code which wasn't found ahead of time.
+    int step_cycles = AotCore::exec<false>(cpu, 1);
+    if (step_cycles == 0) {
+      break;
+    }
+    cycles += step_cycles;
+  }
+
+  // A halted cpu is idle until the next interrupt, the same as the other cores.
+  if (cpu->idle_skip && cpu->halted && cycles < cycle_budget) {
+    cycles = cycle_budget;
+  }
+  cpu->total_cycles += cycles;
+  return cycles;
+}
+
+#endif // SPINVADERS_AOT
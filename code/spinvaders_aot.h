@@ -0,0 +1,38 @@
+#ifndef _SPINVADERS_AOT_H_
+#define _SPINVADERS_AOT_H_
+
+// Space Invaders ahead of time recompiled core. The blocks are generated from
+// the roms by tools/spinvaders_aot.cpp (make aot), and only built in with
+// SPINVADERS_AOT defined (make aot=1).
+
+#include "lib/adc_8080_cpu.h"
+
+#define AOT_ROM_SIZE 0x2000
+
+// The core the recompiled blocks are written against, and which runs the code
+// that wasn't recompiled.
+typedef adc::I8080<adc::CallbackBus> AotCore;
+
+// A recompiled block. Runs every instruction in the block with the pc set past
+// it up front, the same as the block cache, and returns the cycles consumed.
+typedef int (*AotBlockFunc)(adc_8080_cpu *cpu);
+
+struct AotBlock {
+  AotBlockFunc run;
+  uint16_t cycles;      // Cycles of the block, without taken conditionals.
+  uint16_t last_cycles; // Cycles of the last instruction.
+};
+
+// Recompiled blocks by the address they start at. Defined in the generated
+// translation unit.
+extern const AotBlock aot_blocks[AOT_ROM_SIZE];
+
+// aot_run() - Run the cpu for at least cycle_budget cycles, calling the
+// recompiled block at the pc where there is one. The cycles and interrupt
+// timing are the same as adc::I8080<Bus>::run() with a block cache.
+//
+// Returns the number of cycles consumed, which are also added to
+// cpu->total_cycles.
+int aot_run(adc_8080_cpu *cpu, int cycle_budget);
+
+#endif // _SPINVADERS_AOT_H_
@@ -0,0 +1,219 @@
+#include "spinvaders_env.h"
+
+#include "spinvaders_shared.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+// The machines a worker owns during a step, taken from the front by the worker
+// and by the workers stealing from it. Padded to a cache line so the workers
+// don't contend on each other's counters.
+struct Worker {
+  std::atomic<int> next;
+  int end;
+  char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+};
+
+struct EnvBatch {
+  Machine **machines;
+  // Score of each machine at the end of the previous step.
+  int *scores;
+  int count;
+
+  Worker *workers;
+  std::thread *threads;
+  int thread_count;
+
+  // The pool threads wait on start for the generation to change, and the
+  // calling thread waits on done for the running count to reach 0.
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  uint64_t generation;
+  int running;
+  bool quit;
+
+  // Arguments of the current step.
+  const InputState *actions;
+  uint8_t *obs_out;
+  float *rewards_out;
+};
+
+// Worker helpers
+//
+
+static void step_machine(EnvBatch *batch, int index);
+static void run_worker(EnvBatch *batch, int worker);
+static void worker_thread(EnvBatch *batch, int worker);
+
+// Env implementation
+//
+
+EnvBatch *env_create(int count, int threads) {
+  assert(count > 0);
+
+  if (threads <= 0) {
+    threads = MAX((int)std::thread::hardware_concurrency(), 1);
+  }
+
+  EnvBatch *batch = new EnvBatch();
+  batch->count = count;
+  batch->thread_count = MIN(threads, count);
+  batch->machines = new Machine *[count]();
+  batch->scores = new int[count]();
+  batch->workers = new Worker[batch->thread_count]();
+  for (int i = 0; i < count; i++) {
+    batch->machines[i] = machine_create();
+    if (!batch->machines[i]) {
+      adc_log_error("Failed to create machine %d of the env batch!", i);
+      env_destroy(batch);
+      return NULL;
+    }
+  }
+
+  // The calling thread is worker 0.
+  batch->threads = new std::thread[batch->thread_count];
+  for (int i = 1; i < batch->thread_count; i++) {
+    batch->threads[i] = std::thread(worker_thread, batch, i);
+  }
+
+  adc_log_info("Env batch of %d machines on %d threads", count, batch->thread_count);
+  return batch;
+}
+
+void env_destroy(EnvBatch *batch) {
+  if (!batch) {
+    return;
+  }
+
+  if (batch->threads) {
+    {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->quit = true;
+    }
+    batch->start.notify_all();
+    for (int i = 1; i < batch->thread_count; i++) {
+      batch->threads[i].join();
+    }
+    delete[] batch->threads;
+  }
+
+  for (int i = 0; i < batch->count; i++) {
+    machine_destroy(batch->machines[i]);
+  }
+  delete[] batch->workers;
+  delete[] batch->scores;
+  delete[] batch->machines;
+  delete batch;
+}
+
+int env_count(EnvBatch *batch) {
+  return batch->count;
+}
+
+int env_threads(EnvBatch *batch) {
+  return batch->thread_count;
+}
+
+Machine *env_machine(EnvBatch *batch, int index) {
+  assert(index >= 0 && index < batch->count);
+  return batch->machines[index];
+}
+
+void env_step(EnvBatch *batch, const InputState *actions, uint8_t *obs_out, float *rewards_out) {
+  assert(actions);
+
+  batch->actions = actions;
+  batch->obs_out = obs_out;
+  batch->rewards_out = rewards_out;
+
+  // Hand each worker an even share of the machines, published to the pool
+  // threads by the mutex.
+  int thread_count = batch->thread_count;
+  for (int i = 0; i < thread_count; i++) {
+    Worker *worker = &batch->workers[i];
+    worker->next.store((int)((int64_t)batch->count * i / thread_count),
+                       std::memory_order_relaxed);
+    worker->end = (int)((int64_t)batch->count * (i + 1) / thread_count);
+  }
+
+  if (thread_count > 1) {
+    {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->running = thread_count - 1;
+      batch->generation++;
+    }
+    batch->start.notify_all();
+  }
+
+  run_worker(batch, 0);
+
+  if (thread_count > 1) {
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->done.wait(lock, [batch] { return batch->running == 0; });
+  }
+}
+
+// Worker helpers implementation
+//
+
+static void step_machine(EnvBatch *batch, int index) {
+  Machine *machine = batch->machines[index];
+  machine_tick(machine, &batch->actions[index]);
+
+  if (batch->obs_out) {
+    memcpy(batch->obs_out + (size_t)index * MACHINE_FRAME_SIZE, machine_frame(machine),
+           MACHINE_FRAME_SIZE);
+  }
+
+  // The score goes back to 0 when a new game starts, which isn't a penalty.
+  int score = machine_score(machine);
+  if (batch->rewards_out) {
+    int last_score = batch->scores[index];
+    batch->rewards_out[index] = score > last_score ? (float)(score - last_score) : 0.0f;
+  }
+  batch->scores[index] = score;
+}
+
+static void run_worker(EnvBatch *batch, int worker) {
+  // Run the worker's own machines, then steal from the other workers in turn.
+  // The counters only hand out indices, the results are published by the
+  // mutex at the end of the step.
+  int thread_count = batch->thread_count;
+  for (int i = 0; i < thread_count; i++) {
+    Worker *victim = &batch->workers[(worker + i) % thread_count];
+    for (;;) {
+      int index = victim->next.fetch_add(1, std::memory_order_relaxed);
+      if (index >= victim->end) {
+        break;
+      }
+      step_machine(batch, index);
+    }
+  }
+}
+
+static void worker_thread(EnvBatch *batch, int worker) {
+  uint64_t generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(batch->mutex);
+      batch->start.wait(lock, [batch, generation] {
+        return batch->quit || batch->generation != generation;
+      });
+      if (batch->quit) {
+        return;
+      }
+      generation = batch->generation;
+    }
+
+    run_worker(batch, worker);
+
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    if (--batch->running == 0) {
+      batch->done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef _SPINVADERS_ENV_H_
+#define _SPINVADERS_ENV_H_
+
+// Space Invaders environment batch: many independent machines stepped a frame
+// at a time together, e.g. for reinforcement learning or replay evaluation.
+// Part of libspinvaders_core, see spinvaders_machine.h.
+//
+// The machines are spread over a pool of threads. Each thread owns an even
+// share of the machines every step and steals from the others once its own
+// share is done, so machines running slower frames don't hold up the step.
+
+#include "spinvaders_machine.h"
+
+struct EnvBatch;
+
+// Returns a new batch of count machines stepped on the given number of threads,
+// including the calling thread, or NULL on failure. With threads 0 every
+// hardware thread is used.
+EnvBatch *env_create(int count, int threads);
+
+void env_destroy(EnvBatch *batch);
+
+int env_count(EnvBatch *batch);
+
+int env_threads(EnvBatch *batch);
+
+// Returns machine index of the batch, e.g. to read its sound events. It must
+// not be used while the batch is stepping.
+Machine *env_machine(EnvBatch *batch, int index);
+
+// env_step() - Advance every machine of the batch one frame, each with its
+// own action from actions[count], and wait for them all.
+//
+// The observation of machine i, its latest frame (see machine_frame()), is
+// written to obs_out + i * MACHINE_FRAME_SIZE, and its reward, the points it
+// scored during the frame, to rewards_out[i]. Either can be NULL to skip it.
+void env_step(EnvBatch *batch, const InputState *actions, uint8_t *obs_out, float *rewards_out);
+
+#endif // _SPINVADERS_ENV_H_
@@ -4,13 +4,34 @@
 #include "spinvaders_shared.h"
 #include "widgets/log.h"
 
+#include <inttypes.h>
+
+// Number of hot spots listed by the profiler, and how many frames apart they
+// are sorted again.
+#define PROFILER_HOT_SPOTS 64
+#define PROFILER_REFRESH_FRAMES 30
+#define PROFILER_CSV_PATH "profile.csv"
+#define TRACE_PATH "trace.bin"
+#define COVERAGE_PATH "coverage.bin"
+
 struct UI_State {
   ImGuiIO *io;
 
   bool show_log;
+  bool show_profiler;
+  bool show_breakpoints;
   bool emulation_paused;
 
   LogWidget log_widget;
+
+  adc_8080_cpu_hot_spot hot_spots[PROFILER_HOT_SPOTS];
+  int hot_spot_count;
+  int profiler_frames;
+
+  // The breakpoint about to be added.
+  uint16_t breakpoint_addr;
+  uint16_t breakpoint_size;
+  int breakpoint_flags;
 };
 
 static UI_State s_ui_state = {};
@@ -19,6 +40,10 @@ void imgui_setup() {
   ImGuiIO *io = &ImGui::GetIO();
   s_ui_state.io = io;
   s_ui_state.show_log = false;
+  s_ui_state.show_profiler = false;
+  s_ui_state.show_breakpoints = false;
+  s_ui_state.breakpoint_size = 1;
+  s_ui_state.breakpoint_flags = ADC_8080_CPU_BREAK_EXEC;
   ImGui::StyleColorsDark();
 
   adc_log_add_callback(log_handler, &s_ui_state.log_widget, ADC_LOG_DEBUG);
@@ -34,12 +59,34 @@ static void draw_menu() {
       if (ImGui::MenuItem("Pause", nullptr, spinvaders_paused())) {
         spinvaders_set_pause(!spinvaders_paused());
       }
+      if (ImGui::MenuItem("JIT", nullptr, spinvaders_jit_enabled(), spinvaders_jit_available())) {
+        spinvaders_set_jit(!spinvaders_jit_enabled());
+      }
+      ImGui::Separator();
+      if (ImGui::MenuItem("Save State")) {
+        spinvaders_save_state();
+      }
+      if (ImGui::MenuItem("Load State", nullptr, false, spinvaders_has_saved_state())) {
+        spinvaders_load_state();
+      }
 
       ImGui::EndMenu();
     }
 
     if (ImGui::BeginMenu("Debug")) {
       ImGui::MenuItem("Log", nullptr, &s_ui_state.show_log);
+      ImGui::MenuItem("Profiler", nullptr, &s_ui_state.show_profiler,
+                      spinvaders_profile_available());
+      ImGui::MenuItem("Breakpoints", nullptr, &s_ui_state.show_breakpoints);
+      if (ImGui::MenuItem("Save Trace", nullptr, false, spinvaders_trace_available())) {
+        spinvaders_write_trace(TRACE_PATH);
+      }
+      if (ImGui::MenuItem("Save Coverage", nullptr, false, spinvaders_coverage_available())) {
+        spinvaders_write_coverage(COVERAGE_PATH);
+      }
+      if (ImGui::MenuItem("Reset Coverage", nullptr, false, spinvaders_coverage_available())) {
+        spinvaders_reset_coverage();
+      }
       ImGui::EndMenu();
     }
 
@@ -57,12 +104,167 @@ static void draw_log() {
   s_ui_state.log_widget.draw("Log", &s_ui_state.show_log);
 }
 
+static void draw_profiler() {
+  ImGui::SetNextWindowSize(ImVec2(500, 600), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Profiler", &s_ui_state.show_profiler)) {
+    ImGui::End();
+    return;
+  }
+
+  bool reset_selected = ImGui::Button("Reset");
+  ImGui::SameLine();
+  if (ImGui::Button("Export CSV")) {
+    spinvaders_write_profile(PROFILER_CSV_PATH);
+  }
+
+  // Sorting every address is too slow to do each frame.
+  if (reset_selected) {
+    spinvaders_reset_profile();
+    s_ui_state.profiler_frames = 0;
+  }
+  if (s_ui_state.profiler_frames-- <= 0) {
+    s_ui_state.hot_spot_count =
+        spinvaders_profile_hot_spots(s_ui_state.hot_spots, PROFILER_HOT_SPOTS);
+    s_ui_state.profiler_frames = PROFILER_REFRESH_FRAMES;
+  }
+
+  uint64_t total_cycles = spinvaders_profile_cycles();
+  ImGui::SameLine();
+  ImGui::Text("%" PRIu64 " cycles", total_cycles);
+  ImGui::Separator();
+
+  ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV |
+                          ImGuiTableFlags_ScrollY;
+  if (ImGui::BeginTable("hot_spots", 5, flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Address");
+    ImGui::TableSetupColumn("Opcode");
+    ImGui::TableSetupColumn("Count");
+    ImGui::TableSetupColumn("Cycles");
+    ImGui::TableSetupColumn("%");
+    ImGui::TableHeadersRow();
+
+    for (int i = 0; i < s_ui_state.hot_spot_count; i++) {
+      const adc_8080_cpu_hot_spot *hot_spot = &s_ui_state.hot_spots[i];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("0x%04X", hot_spot->pc);
+      ImGui::TableNextColumn();
+      ImGui::Text("0x%02X", hot_spot->opcode);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, hot_spot->count);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, hot_spot->cycles);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", total_cycles ? hot_spot->cycles * 100.0 / total_cycles : 0.0);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
+
+// Names of the accesses in breakpoint flags, e.g. "RW".
+static const char *access_name(int flags, char *buf) {
+  int length = 0;
+  if (flags & ADC_8080_CPU_BREAK_EXEC) {
+    buf[length++] = 'X';
+  }
+  if (flags & ADC_8080_CPU_BREAK_READ) {
+    buf[length++] = 'R';
+  }
+  if (flags & ADC_8080_CPU_BREAK_WRITE) {
+    buf[length++] = 'W';
+  }
+  buf[length] = '\0';
+  return buf;
+}
+
+static void draw_breakpoints() {
+  ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Breakpoints", &s_ui_state.show_breakpoints)) {
+    ImGui::End();
+    return;
+  }
+
+  ImGui::SetNextItemWidth(60);
+  ImGui::InputScalar("Address", ImGuiDataType_U16, &s_ui_state.breakpoint_addr, nullptr, nullptr,
+                     "%04X", ImGuiInputTextFlags_CharsHexadecimal);
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(60);
+  ImGui::InputScalar("Size", ImGuiDataType_U16, &s_ui_state.breakpoint_size);
+  ImGui::CheckboxFlags("Exec", &s_ui_state.breakpoint_flags, ADC_8080_CPU_BREAK_EXEC);
+  ImGui::SameLine();
+  ImGui::CheckboxFlags("Read", &s_ui_state.breakpoint_flags, ADC_8080_CPU_BREAK_READ);
+  ImGui::SameLine();
+  ImGui::CheckboxFlags("Write", &s_ui_state.breakpoint_flags, ADC_8080_CPU_BREAK_WRITE);
+  ImGui::SameLine();
+  if (ImGui::Button("Add")) {
+    spinvaders_add_breakpoint(s_ui_state.breakpoint_addr, s_ui_state.breakpoint_size,
+                              s_ui_state.breakpoint_flags);
+  }
+
+  char access[4];
+  const adc_8080_cpu_breakpoints *breakpoints = spinvaders_breakpoints();
+  if (spinvaders_break_hit()) {
+    ImGui::Text("Breakpoint %d hit by %s of 0x%04X (0x%02X)", breakpoints->hit_index,
+                access_name(breakpoints->hit_flags, access), breakpoints->hit_addr,
+                breakpoints->hit_val);
+    ImGui::SameLine();
+    if (ImGui::Button("Continue")) {
+      spinvaders_set_pause(false);
+    }
+  }
+  ImGui::Separator();
+
+  // Removing a breakpoint moves the later ones down, so wait for the end of
+  // the list.
+  int remove_index = -1;
+  ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV |
+                          ImGuiTableFlags_ScrollY;
+  if (ImGui::BeginTable("breakpoints", 4, flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Address");
+    ImGui::TableSetupColumn("Size");
+    ImGui::TableSetupColumn("Access");
+    ImGui::TableSetupColumn("");
+    ImGui::TableHeadersRow();
+
+    for (int i = 0; i < breakpoints->count; i++) {
+      const adc_8080_cpu_breakpoint *breakpoint = &breakpoints->breakpoints[i];
+      ImGui::PushID(i);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("0x%04X", breakpoint->addr);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", breakpoint->size);
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", access_name(breakpoint->flags, access));
+      ImGui::TableNextColumn();
+      if (ImGui::SmallButton("Remove")) {
+        remove_index = i;
+      }
+      ImGui::PopID();
+    }
+    ImGui::EndTable();
+  }
+  if (remove_index >= 0) {
+    spinvaders_remove_breakpoint(remove_index);
+  }
+
+  ImGui::End();
+}
+
 void imgui_draw() {
   ImGui::NewFrame();
 
   draw_menu();
   if (s_ui_state.show_log)
     draw_log();
+  if (s_ui_state.show_profiler)
+    draw_profiler();
+  if (s_ui_state.show_breakpoints)
+    draw_breakpoints();
 
   ImGui::Render();
 }
@@ -0,0 +1,3 @@
+// Log implementation, shared by the application and libspinvaders_core.
+#define ADC_LOG_IMPLEMENTATION
+#include "lib/adc_log.h"
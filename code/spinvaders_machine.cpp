@@ -2,10 +2,12 @@
 
 #include "lib/adc_8080_cpu.h"
 
-#include "spinvaders.h"
-#include "spinvaders_renderer.h"
+#include "spinvaders_aot.h"
 #include "spinvaders_shared.h"
-#include "spinvaders_sound.h"
+
+#include <new>      // For placement new
+#include <stddef.h> // For offsetof
+#include <string.h>
 
 #define CYCLES_HZ 2000000UL
 #define CYCLES_PER_TICK (CYCLES_HZ / 60)
@@ -19,19 +21,64 @@
 #define MEMORY_VIDEO_RAM_START 0x2400
 #define MEMORY_MIRROR_RAM_START 0x4000
 #define MEMORY_MIRROR_RAM_END 0x5FFF
+// The game keeps the player one score as 4 bcd digits, the low two first.
+#define MEMORY_P1_SCORE 0x20F8
 
 #define ROM_SIZE 0x0800
 
+// Allow selecting the cpu core. By default the machine runs the template core
+// specialized on InvadersBus. Define SPINVADERS_CALLBACK_CPU to run the C api
+// core with the page tables and handlers instead, e.g. to benchmark the two.
+// #define SPINVADERS_CALLBACK_CPU
+// SPINVADERS_AOT (make aot=1) runs the roms recompiled ahead of time instead,
+// see spinvaders_aot.h.
+
+// Size of the code memory for the cpu jit, where it is supported. Define
+// SPINVADERS_JIT_VALIDATE to check every translated block against the
+// interpreter and log the blocks which differ.
+#define JIT_CODE_SIZE (1024 * 1024)
+// #define SPINVADERS_JIT_VALIDATE
+
+// Instructions held by the cpu trace when it is built with ADC_8080_CPU_TRACE
+// (make trace=1), about 40 frames of the game.
+#define TRACE_CAPACITY (1 << 21)
+
+// Most timed events pending in the scheduler at once.
+#define SCHEDULER_MAX_EVENTS 8
+
 #define DIP_SHIPS_3 0x00
 #define DIP_SHIPS_4 0x01
 #define DIP_SHIPS_5 0x02
 #define DIP_SHIPS_6 0x03
 
 struct Processor {
-  adc_8080_cpu cpu;
-  uint64_t cycles_this_tick;
-  bool vblank_start_triggered;
-  bool vblank_end_triggered;
+  // Aligned so the hot cpu state takes a single cache line.
+  alignas(64) adc_8080_cpu cpu;
+  adc_8080_cpu_block_cache block_cache;
+  adc_8080_cpu_jit *jit;
+  uint32_t jit_mismatches;
+  adc_8080_cpu_profile *profile;
+  adc_8080_cpu_trace trace;
+  adc_8080_cpu_trace_record *trace_records;
+  adc_8080_cpu_coverage *coverage;
+  adc_8080_cpu_breakpoints breakpoints;
+};
+
+// Called when the cpu of a machine reaches the cycle count an event was
+// scheduled at, which is passed in so periodic events can schedule themselves
+// again without drift.
+typedef void (*EventHandler)(Machine *machine, uint64_t cycles);
+
+struct Event {
+  uint64_t cycles;
+  EventHandler handler;
+};
+
+// Timed events sorted by their cycle counts, latest first so the next event is
+// always taken from the end.
+struct Scheduler {
+  Event events[SCHEDULER_MAX_EVENTS];
+  int count;
 };
 
 struct ShiftRegister {
@@ -40,30 +87,46 @@ struct ShiftRegister {
   uint8_t offset;
 };
 
+// The video ram latched at the end of each screen, so the frame handed out is
+// never one the game is partway through drawing.
 struct Display {
-  const int width = 256;
-  const int height = 224;
-  uint32_t *pixels;
-  Texture texture;
+  uint8_t frame[MACHINE_FRAME_SIZE];
+  uint32_t frame_count;
 };
 
 struct Machine {
   Processor processor;
-  uint8_t *memory;
+  Scheduler scheduler;
+  // Cycle count the current tick runs up to.
+  uint64_t tick_end;
+  uint8_t memory[MEMORY_SIZE];
   ShiftRegister shift_register;
   Display display;
   const InputState *input;
   uint8_t device1_last_read;
   uint8_t device3_last_write;
   uint8_t device5_last_write;
+  // MachineSound events raised during the current tick.
+  uint32_t sound_events;
   bool paused;
   // Dip switch settings.
   uint8_t dip_ships;
   bool dip_extra_ship;
   bool dip_display_coin;
+  // Allocation the machine is aligned within.
+  void *allocation;
 };
 
-static Machine s_machine = {};
+// The state holds the ram and frame as they are laid out in memory, and every
+// event the scheduler can hold. Changing its layout needs a new version.
+static_assert(MACHINE_RAM_SIZE == MEMORY_SIZE - MEMORY_WORK_RAM_START,
+              "MachineState ram size must match the machine");
+static_assert(MACHINE_FRAME_SIZE == MEMORY_SIZE - MEMORY_VIDEO_RAM_START,
+              "MachineState frame size must match the video ram");
+static_assert(SCHEDULER_MAX_EVENTS <= MACHINE_STATE_MAX_EVENTS,
+              "MachineState must hold every scheduled event");
+static_assert(sizeof(MachineState) == 15496 && offsetof(MachineState, tick_end) == 64,
+              "MachineState layout changed, bump MACHINE_STATE_VERSION");
 
 // CPU and display handlers
 //
@@ -73,121 +136,658 @@ static void handle_memory_write(void *userdata, uint16_t addr, uint8_t value);
 static uint8_t handle_device_read(void *userdata, uint8_t device);
 static void handle_device_write(void *userdata, uint8_t device, uint8_t output);
 
-static void handle_vsync();
+static void handle_vblank_start(Machine *machine, uint64_t cycles);
+static void handle_vblank_end(Machine *machine, uint64_t cycles);
+static void handle_vsync(Machine *machine);
+
+// Handlers of the events which can be scheduled, indexed by the ids saved in a
+// MachineState.
+static const EventHandler s_event_handlers[] = {handle_vblank_start, handle_vblank_end};
+
+// Returns the machine a cpu is embedded in. The handlers are passed the
+// machine as userdata, but the bus finds it this way to save loading userdata
+// on every memory access.
+static inline Machine *cpu_machine(adc_8080_cpu *cpu) {
+  return (Machine *)((char *)cpu - offsetof(Machine, processor.cpu));
+}
+
+// Bus for the template cpu core, with the memory map inlined into the opcode
+// handlers. Rom, ram and vram are read and written directly, and everything
+// else (mirror ram, rom writes, out of bounds) goes through the handlers.
+struct InvadersBus {
+  static inline uint8_t read(adc_8080_cpu *cpu, uint16_t addr) {
+    if (addr < MEMORY_SIZE) {
+      return cpu_machine(cpu)->memory[addr];
+    }
+    return handle_memory_read(cpu->userdata, addr);
+  }
+
+  static inline void write(adc_8080_cpu *cpu, uint16_t addr, uint8_t value) {
+    if (addr >= MEMORY_WORK_RAM_START && addr < MEMORY_SIZE) {
+      cpu_machine(cpu)->memory[addr] = value;
+    } else {
+      handle_memory_write(cpu->userdata, addr, value);
+    }
+  }
+
+  static inline uint8_t in(adc_8080_cpu *cpu, uint8_t device) {
+    return handle_device_read(cpu->userdata, device);
+  }
+
+  static inline void out(adc_8080_cpu *cpu, uint8_t device, uint8_t output) {
+    handle_device_write(cpu->userdata, device, output);
+  }
+};
+
+// Processor helpers
+//
+
+static void run_processor(Processor *processor, uint64_t cycles_target);
+
+// Scheduler helpers
+//
+
+static void schedule_event(Scheduler *scheduler, uint64_t cycles, EventHandler handler);
+static void run_scheduled(Machine *machine, uint64_t cycles_target);
 
 // Rom helpers
 //
 
-static int load_roms();
-static int load_rom(const char *filepath, uint16_t addr);
+static int load_roms(Machine *machine);
+static int load_rom(Machine *machine, const char *filepath, uint16_t addr);
 
 // Machine implementation
 //
 
-int machine_setup() {
+static int setup_machine(Machine *machine) {
   adc_log_info("Machine cycles_per_scanline %f, cycles_vblank_start %d, cycles_vblank_end %d",
                CYCLES_PER_SCANLINE, CYCLES_VBLANK_START, CYCLES_VBLANK_END);
 
-  // Setup the memory and load roms.
-  s_machine.memory = (uint8_t *)calloc(MEMORY_SIZE, 1);
-  if (!s_machine.memory) {
-    adc_log_error("Failed to malloc() machine memory!");
-    return -1;
-  }
-  if (load_roms() != 0) {
+  // Load the roms.
+  if (load_roms(machine) != 0) {
     adc_log_error("Failed to load roms into machine memory!");
     return -1;
   }
 
   // Default dip switch values.
-  s_machine.dip_ships = DIP_SHIPS_3;
-  s_machine.dip_extra_ship = 0;
-  s_machine.dip_display_coin = 0;
+  machine->dip_ships = DIP_SHIPS_3;
+  machine->dip_extra_ship = 0;
+  machine->dip_display_coin = 0;
 
-  // Setup the 8080 processor.
-  Processor *processor = &s_machine.processor;
+  // Setup the 8080 processor, which passes the machine to the handlers.
+  Processor *processor = &machine->processor;
   adc_8080_cpu_init(&processor->cpu);
+  processor->cpu.userdata = machine;
   processor->cpu.read_byte = handle_memory_read;
   processor->cpu.write_byte = handle_memory_write;
   processor->cpu.read_device = handle_device_read;
   processor->cpu.write_device = handle_device_write;
 
-  // Setup the display.
-  Display *display = &s_machine.display;
-  display->pixels = (uint32_t *)calloc(display->width * display->height, 4);
-  if (!display->pixels) {
-    adc_log_error("Failed to malloc() machine display stencil pixels!");
+  // Map the rom, ram and ram mirror straight into the cpu address space so the
+  // memory handlers are only called for writes to rom and out of bounds access.
+  uint8_t *ram = machine->memory + MEMORY_WORK_RAM_START;
+  int ram_size = MEMORY_SIZE - MEMORY_WORK_RAM_START;
+  adc_8080_cpu_map_memory(&processor->cpu, 0x0000, MEMORY_WORK_RAM_START, machine->memory,
+                          ADC_8080_CPU_MAP_READ);
+  adc_8080_cpu_map_memory(&processor->cpu, MEMORY_WORK_RAM_START, ram_size, ram,
+                          ADC_8080_CPU_MAP_READ | ADC_8080_CPU_MAP_WRITE);
+  adc_8080_cpu_map_memory(&processor->cpu, MEMORY_MIRROR_RAM_START, ram_size, ram,
+                          ADC_8080_CPU_MAP_READ | ADC_8080_CPU_MAP_WRITE);
+
+  // The whole program runs from rom, which is mapped read only so its decoded
+  // blocks are never invalidated.
+  adc_8080_cpu_set_block_cache(&processor->cpu, &processor->block_cache);
+
+  // Breakpoints are always attached, and only cost anything on the pages
+  // holding them.
+  processor->breakpoints = {};
+  adc_8080_cpu_set_breakpoints(&processor->cpu, &processor->breakpoints);
+
+  // The game spends most of each frame polling ram for the vblank interrupt
+  // handlers, so skip ahead to the next interrupt instead of emulating it.
+  adc_8080_cpu_set_idle_skip(&processor->cpu, true);
+
+  // Create the jit, which stays disabled until machine_set_jit().
+#ifdef SPINVADERS_JIT_VALIDATE
+  processor->jit = adc_8080_cpu_jit_create(JIT_CODE_SIZE, ADC_8080_CPU_JIT_VALIDATE);
+#else
+  processor->jit = adc_8080_cpu_jit_create(JIT_CODE_SIZE, 0);
+#endif
+  if (!processor->jit) {
+    adc_log_info("The cpu jit is not available on this platform");
+  }
+
+  // Profile the cpu when it is built with ADC_8080_CPU_PROFILE (make profile=1).
+#if ADC_8080_CPU_PROFILE
+  processor->profile = (adc_8080_cpu_profile *)calloc(1, sizeof(adc_8080_cpu_profile));
+  if (!processor->profile) {
+    adc_log_error("Failed to malloc() cpu profile!");
     return -1;
   }
-  TextureParams params = {TEXTURE_TYPE_PIXEL_ACCESS};
-  renderer_create_texture(&display->texture, display->width, display->height, display->pixels,
-                          params);
+  adc_8080_cpu_set_profile(&processor->cpu, processor->profile);
+#endif
+
+  // Trace the cpu when it is built with ADC_8080_CPU_TRACE (make trace=1).
+#if ADC_8080_CPU_TRACE
+  processor->trace_records = (adc_8080_cpu_trace_record *)malloc(
+      TRACE_CAPACITY * sizeof(adc_8080_cpu_trace_record));
+  if (!processor->trace_records) {
+    adc_log_error("Failed to malloc() cpu trace records!");
+    return -1;
+  }
+  adc_8080_cpu_trace_init(&processor->trace, processor->trace_records, TRACE_CAPACITY);
+  adc_8080_cpu_set_trace(&processor->cpu, &processor->trace);
+#endif
+
+  // Record the rom coverage when it is built with ADC_8080_CPU_COVERAGE
+  // (make coverage=1).
+#if ADC_8080_CPU_COVERAGE
+  processor->coverage = (adc_8080_cpu_coverage *)malloc(sizeof(adc_8080_cpu_coverage));
+  if (!processor->coverage) {
+    adc_log_error("Failed to malloc() cpu coverage!");
+    return -1;
+  }
+  adc_8080_cpu_reset_coverage(processor->coverage);
+  adc_8080_cpu_set_coverage(&processor->cpu, processor->coverage);
+#endif
+
+  // The game is driven by the mid screen and end of screen interrupts, which
+  // are sent at the same point in every tick.
+  Scheduler *scheduler = &machine->scheduler;
+  scheduler->count = 0;
+  schedule_event(scheduler, CYCLES_VBLANK_START, handle_vblank_start);
+  schedule_event(scheduler, CYCLES_VBLANK_END, handle_vblank_end);
 
   return 0;
 }
 
-void machine_shutdown() {
-  Display *display = &s_machine.display;
-  if (display->pixels) {
-    free(display->pixels);
+Machine *machine_create() {
+  // The cpu is aligned to a cache line, which malloc() doesn't guarantee.
+  void *allocation = malloc(sizeof(Machine) + alignof(Machine) - 1);
+  if (!allocation) {
+    adc_log_error("Failed to malloc() machine!");
+    return NULL;
   }
-  renderer_destroy_texture(&display->texture);
+  uintptr_t aligned = ((uintptr_t)allocation + alignof(Machine) - 1) & ~(alignof(Machine) - 1);
+  Machine *machine = new ((void *)aligned) Machine();
+  machine->allocation = allocation;
 
-  if (s_machine.memory) {
-    free(s_machine.memory);
+  if (setup_machine(machine) != 0) {
+    machine_destroy(machine);
+    return NULL;
+  }
+  return machine;
+}
+
+void machine_destroy(Machine *machine) {
+  if (!machine) {
+    return;
+  }
+
+  Processor *processor = &machine->processor;
+  adc_8080_cpu_set_jit(&processor->cpu, NULL);
+  adc_8080_cpu_jit_destroy(processor->jit);
+  processor->jit = NULL;
+  adc_8080_cpu_set_profile(&processor->cpu, NULL);
+  if (processor->profile) {
+    free(processor->profile);
+    processor->profile = NULL;
+  }
+  adc_8080_cpu_set_trace(&processor->cpu, NULL);
+  if (processor->trace_records) {
+    free(processor->trace_records);
+    processor->trace_records = NULL;
   }
+  adc_8080_cpu_set_coverage(&processor->cpu, NULL);
+  if (processor->coverage) {
+    free(processor->coverage);
+    processor->coverage = NULL;
+  }
+
+  void *allocation = machine->allocation;
+  machine->~Machine();
+  free(allocation);
 }
 
-void machine_tick(const InputState *input) {
+void machine_tick(Machine *machine, const InputState *input) {
+  assert(machine);
   assert(input);
 
-  if (s_machine.paused) {
+  machine->sound_events = 0;
+  if (machine->paused) {
     return;
   }
 
-  s_machine.input = input;
+  machine->input = input;
+
+  // Execute correct number of cycles per tick, stopping to handle the timed
+  // events (e.g. the vblank interrupts) as their cycle counts are reached.
+  Processor *processor = &machine->processor;
+  machine->tick_end += CYCLES_PER_TICK;
+  run_scheduled(machine, machine->tick_end);
+
+  // Pause on a breakpoint until the emulation is resumed.
+  if (processor->cpu.break_hit) {
+    const adc_8080_cpu_breakpoints *breakpoints = &processor->breakpoints;
+    int flags = breakpoints->hit_flags;
+    const char *access = (flags & ADC_8080_CPU_BREAK_EXEC)   ? "exec"
+                         : (flags & ADC_8080_CPU_BREAK_READ) ? "read"
+                                                             : "write";
+    adc_log_info("Breakpoint %d hit by %s of 0x%04X (0x%02X), stopped at pc 0x%04X",
+                 breakpoints->hit_index, access, breakpoints->hit_addr, breakpoints->hit_val,
+                 processor->cpu.pc);
+    machine->paused = true;
+  }
+
+  if (processor->jit && processor->jit->mismatches != processor->jit_mismatches) {
+    processor->jit_mismatches = processor->jit->mismatches;
+    adc_log_warn("Jit block at 0x%04X does not match the interpreter (%u mismatches)",
+                 processor->jit->mismatch_pc, processor->jit_mismatches);
+  }
+}
+
+bool machine_paused(Machine *machine) {
+  return machine->paused;
+}
+
+void machine_set_pause(Machine *machine, bool pause) {
+  machine->paused = pause;
+  if (!pause && machine->processor.cpu.break_hit) {
+    adc_8080_cpu_resume(&machine->processor.cpu);
+  }
+}
 
-  // Execute correct number of cycles per tick.
-  Processor *processor = &s_machine.processor;
-  while (processor->cycles_this_tick <= CYCLES_PER_TICK) {
-    uint64_t cycles = adc_8080_cpu_step(&processor->cpu);
-    processor->cycles_this_tick += cycles;
+bool machine_jit_available(Machine *machine) {
+  return machine->processor.jit != NULL;
+}
 
-    // Send cpu the start and end vblank interrupts.
-    if (processor->cycles_this_tick >= CYCLES_VBLANK_START && !processor->vblank_start_triggered) {
-      adc_8080_cpu_interrupt(&processor->cpu, 0xCF);
-      processor->vblank_start_triggered = true;
+bool machine_jit_enabled(Machine *machine) {
+  return machine->processor.cpu.jit != NULL;
+}
+
+void machine_set_jit(Machine *machine, bool enable) {
+  Processor *processor = &machine->processor;
+  adc_8080_cpu_set_jit(&processor->cpu, enable ? processor->jit : NULL);
+}
+
+bool machine_profile_available(Machine *machine) {
+  return machine->processor.profile != NULL;
+}
+
+int machine_profile_hot_spots(Machine *machine, adc_8080_cpu_hot_spot *hot_spots, int max) {
+  const adc_8080_cpu_profile *profile = machine->processor.profile;
+  if (!profile) {
+    return 0;
+  }
+  return adc_8080_cpu_profile_hot_spots(profile, hot_spots, max);
+}
+
+uint64_t machine_profile_cycles(Machine *machine) {
+  const adc_8080_cpu_profile *profile = machine->processor.profile;
+  uint64_t cycles = 0;
+  if (profile) {
+    for (int i = 0; i < 256; i++) {
+      cycles += profile->opcode_cycles[i];
     }
-    if (processor->cycles_this_tick >= CYCLES_VBLANK_END && !processor->vblank_end_triggered) {
-      adc_8080_cpu_interrupt(&processor->cpu, 0xD7);
-      handle_vsync();
-      processor->vblank_end_triggered = true;
+  }
+  return cycles;
+}
+
+void machine_reset_profile(Machine *machine) {
+  if (machine->processor.profile) {
+    adc_8080_cpu_reset_profile(machine->processor.profile);
+  }
+}
+
+int machine_write_profile(Machine *machine, const char *filepath) {
+  const adc_8080_cpu_profile *profile = machine->processor.profile;
+  if (!profile) {
+    return -1;
+  }
+
+  FILE *file = fopen(filepath, "w");
+  if (!file) {
+    adc_log_error("Failed to open %s for writing the cpu profile!", filepath);
+    return -1;
+  }
+  adc_8080_cpu_write_profile(profile, file, 0);
+  fclose(file);
+
+  adc_log_info("Wrote the cpu profile to %s", filepath);
+  return 0;
+}
+
+bool machine_trace_available(Machine *machine) {
+  return machine->processor.trace_records != NULL;
+}
+
+int machine_write_trace(Machine *machine, const char *filepath) {
+  Processor *processor = &machine->processor;
+  if (!processor->trace_records) {
+    return -1;
+  }
+
+  FILE *file = fopen(filepath, "wb");
+  if (!file) {
+    adc_log_error("Failed to open %s for writing the cpu trace!", filepath);
+    return -1;
+  }
+  int result = adc_8080_cpu_write_trace(&processor->trace, file);
+  fclose(file);
+  if (result != 0) {
+    adc_log_error("Failed to write the cpu trace to %s!", filepath);
+    return -1;
+  }
+
+  adc_log_info("Wrote the cpu trace to %s", filepath);
+  return 0;
+}
+
+bool machine_coverage_available(Machine *machine) {
+  return machine->processor.coverage != NULL;
+}
+
+int machine_coverage_addresses(Machine *machine) {
+  const adc_8080_cpu_coverage *coverage = machine->processor.coverage;
+  if (!coverage) {
+    return 0;
+  }
+  return adc_8080_cpu_coverage_addresses(coverage);
+}
+
+void machine_reset_coverage(Machine *machine) {
+  if (machine->processor.coverage) {
+    adc_8080_cpu_reset_coverage(machine->processor.coverage);
+  }
+}
+
+int machine_write_coverage(Machine *machine, const char *filepath) {
+  const adc_8080_cpu_coverage *coverage = machine->processor.coverage;
+  if (!coverage) {
+    return -1;
+  }
+
+  FILE *file = fopen(filepath, "wb");
+  if (!file) {
+    adc_log_error("Failed to open %s for writing the cpu coverage!", filepath);
+    return -1;
+  }
+  int result = adc_8080_cpu_write_coverage(coverage, file);
+  fclose(file);
+  if (result != 0) {
+    adc_log_error("Failed to write the cpu coverage to %s!", filepath);
+    return -1;
+  }
+
+  adc_log_info("Wrote the cpu coverage of %d addresses to %s",
+               adc_8080_cpu_coverage_addresses(coverage), filepath);
+  return 0;
+}
+
+int machine_add_breakpoint(Machine *machine, uint16_t addr, uint16_t size, int flags) {
+  if (size == 0 || addr + size > 0x10000 || !flags) {
+    adc_log_error("Invalid breakpoint at 0x%04X of %d bytes!", addr, size);
+    return -1;
+  }
+
+  int index = adc_8080_cpu_add_breakpoint(&machine->processor.cpu, addr, size, flags);
+  if (index < 0) {
+    adc_log_error("No room for more than %d breakpoints!", ADC_8080_CPU_MAX_BREAKPOINTS);
+  }
+  return index;
+}
+
+void machine_remove_breakpoint(Machine *machine, int index) {
+  if (index >= 0 && index < machine->processor.breakpoints.count) {
+    adc_8080_cpu_remove_breakpoint(&machine->processor.cpu, index);
+  }
+}
+
+const adc_8080_cpu_breakpoints *machine_breakpoints(Machine *machine) {
+  return &machine->processor.breakpoints;
+}
+
+bool machine_break_hit(Machine *machine) {
+  return machine->processor.cpu.break_hit;
+}
+
+const uint8_t *machine_frame(Machine *machine) {
+  return machine->display.frame;
+}
+
+uint32_t machine_frame_count(Machine *machine) {
+  return machine->display.frame_count;
+}
+
+void machine_frame_pixels(Machine *machine, uint32_t *pixels) {
+  const uint8_t *frame = machine->display.frame;
+  for (int i = 0; i < MACHINE_FRAME_SIZE; i++) {
+    uint8_t dispbit = frame[i];
+    for (int b = 0; b < 8; b++) {
+      pixels[i * 8 + b] = (dispbit & (1 << b)) ? 0xFFFFFFFF : 0;
     }
   }
-  // Adjust the amount of cycles run next tick if we exceeded the maximum.
-  if (processor->cycles_this_tick >= CYCLES_PER_TICK) {
-    processor->cycles_this_tick -= CYCLES_PER_TICK;
+}
+
+uint32_t machine_sound_events(Machine *machine) {
+  return machine->sound_events;
+}
+
+void machine_save_state(Machine *machine, MachineState *state) {
+  adc_8080_cpu *cpu = &machine->processor.cpu;
+  const Scheduler *scheduler = &machine->scheduler;
+
+  state->magic = MACHINE_STATE_MAGIC;
+  state->version = MACHINE_STATE_VERSION;
+  state->event_count = (uint16_t)scheduler->count;
+  state->size = sizeof(MachineState);
+  state->frame_count = machine->display.frame_count;
+
+  state->total_cycles = cpu->total_cycles;
+  state->pc = cpu->pc;
+  state->sp = cpu->sp;
+  state->ra = cpu->ra;
+  state->rb = cpu->rb;
+  state->rc = cpu->rc;
+  state->rd = cpu->rd;
+  state->re = cpu->re;
+  state->rh = cpu->rh;
+  state->rl = cpu->rl;
+  state->psw = adc_8080_cpu_get_psw(cpu);
+  state->halted = cpu->halted;
+  state->inte = cpu->inte;
+  state->interrupt_pending = cpu->interrupt_pending;
+  state->interrupt_opcode = cpu->interrupt_opcode;
+  state->interrupt_delay = cpu->interrupt_delay;
+
+  state->shift_low = machine->shift_register.low;
+  state->shift_high = machine->shift_register.high;
+  state->shift_offset = machine->shift_register.offset;
+  state->device1_last_read = machine->device1_last_read;
+  state->device3_last_write = machine->device3_last_write;
+  state->device5_last_write = machine->device5_last_write;
+
+  state->dip_ships = machine->dip_ships;
+  state->dip_extra_ship = machine->dip_extra_ship;
+  state->dip_display_coin = machine->dip_display_coin;
+
+  // Unused slots are cleared so equal states compare equal as memory.
+  for (int i = 0; i < MACHINE_STATE_MAX_EVENTS; i++) {
+    state->event_ids[i] = 0;
+    state->event_cycles[i] = 0;
+  }
+  int handler_count = (int)(sizeof(s_event_handlers) / sizeof(s_event_handlers[0]));
+  for (int i = 0; i < scheduler->count; i++) {
+    int id = 0;
+    while (id < handler_count && s_event_handlers[id] != scheduler->events[i].handler) {
+      id++;
+    }
+    // Every handler scheduled must be listed in s_event_handlers.
+    assert(id < handler_count);
+    state->event_ids[i] = (uint8_t)id;
+    state->event_cycles[i] = scheduler->events[i].cycles;
   }
-  processor->vblank_start_triggered = false;
-  processor->vblank_end_triggered = false;
+  memset(state->padding, 0, sizeof(state->padding));
+  state->tick_end = machine->tick_end;
+
+  memcpy(state->ram, &machine->memory[MEMORY_WORK_RAM_START], MACHINE_RAM_SIZE);
+  memcpy(state->frame, machine->display.frame, MACHINE_FRAME_SIZE);
 }
 
-bool machine_paused() {
-  return s_machine.paused;
+int machine_load_state(Machine *machine, const MachineState *state) {
+  int handler_count = (int)(sizeof(s_event_handlers) / sizeof(s_event_handlers[0]));
+  if (state->magic != MACHINE_STATE_MAGIC) {
+    adc_log_error("Machine state has magic 0x%08X, expected 0x%08X!", state->magic,
+                  MACHINE_STATE_MAGIC);
+    return -1;
+  }
+  if (state->version != MACHINE_STATE_VERSION) {
+    adc_log_error("Machine state has version %d, expected %d!", state->version,
+                  MACHINE_STATE_VERSION);
+    return -1;
+  }
+  if (state->size != sizeof(MachineState)) {
+    adc_log_error("Machine state has size %u, expected %u!", state->size,
+                  (uint32_t)sizeof(MachineState));
+    return -1;
+  }
+  if (state->event_count > SCHEDULER_MAX_EVENTS) {
+    adc_log_error("Machine state has %d events, at most %d are supported!", state->event_count,
+                  SCHEDULER_MAX_EVENTS);
+    return -1;
+  }
+  for (int i = 0; i < state->event_count; i++) {
+    if (state->event_ids[i] >= handler_count) {
+      adc_log_error("Machine state has an unknown event %d!", state->event_ids[i]);
+      return -1;
+    }
+  }
+
+  adc_8080_cpu *cpu = &machine->processor.cpu;
+  cpu->total_cycles = state->total_cycles;
+  cpu->pc = state->pc;
+  cpu->sp = state->sp;
+  cpu->ra = state->ra;
+  cpu->rb = state->rb;
+  cpu->rc = state->rc;
+  cpu->rd = state->rd;
+  cpu->re = state->re;
+  cpu->rh = state->rh;
+  cpu->rl = state->rl;
+  adc_8080_cpu_set_psw(cpu, state->psw);
+  cpu->halted = state->halted;
+  cpu->inte = state->inte;
+  cpu->interrupt_pending = state->interrupt_pending;
+  cpu->interrupt_opcode = state->interrupt_opcode;
+  cpu->interrupt_delay = state->interrupt_delay;
+
+  // A breakpoint hit before the load isn't part of the state, so drop it and
+  // the pause it caused, along with any pending resume.
+  if (cpu->break_hit) {
+    cpu->break_hit = false;
+    machine->paused = false;
+  }
+  machine->processor.breakpoints.resuming = false;
+
+  machine->shift_register.low = state->shift_low;
+  machine->shift_register.high = state->shift_high;
+  machine->shift_register.offset = state->shift_offset;
+  machine->device1_last_read = state->device1_last_read;
+  machine->device3_last_write = state->device3_last_write;
+  machine->device5_last_write = state->device5_last_write;
+
+  machine->dip_ships = state->dip_ships;
+  machine->dip_extra_ship = state->dip_extra_ship;
+  machine->dip_display_coin = state->dip_display_coin;
+
+  Scheduler *scheduler = &machine->scheduler;
+  scheduler->count = state->event_count;
+  for (int i = 0; i < scheduler->count; i++) {
+    scheduler->events[i].cycles = state->event_cycles[i];
+    scheduler->events[i].handler = s_event_handlers[state->event_ids[i]];
+  }
+  machine->tick_end = state->tick_end;
+
+  // Only blocks decoded from ram can be stale, the rom never changes.
+  memcpy(&machine->memory[MEMORY_WORK_RAM_START], state->ram, MACHINE_RAM_SIZE);
+  adc_8080_cpu_invalidate_memory(cpu, MEMORY_WORK_RAM_START, MACHINE_RAM_SIZE);
+  adc_8080_cpu_invalidate_memory(cpu, MEMORY_MIRROR_RAM_START, MACHINE_RAM_SIZE);
+
+  memcpy(machine->display.frame, state->frame, MACHINE_FRAME_SIZE);
+  machine->display.frame_count = state->frame_count;
+  return 0;
+}
+
+int machine_score(Machine *machine) {
+  const uint8_t *score = &machine->memory[MEMORY_P1_SCORE];
+#define bcd(v) (((v) >> 4) * 10 + ((v) & 0x0F))
+  return bcd(score[1]) * 100 + bcd(score[0]);
+#undef bcd
 }
 
-void machine_set_pause(bool pause) {
-  s_machine.paused = pause;
+// Processor helpers implementation
+//
+
+static void run_processor(Processor *processor, uint64_t cycles_target) {
+  // Run the cpu in a single batch until its cycle count reaches the target.
+  // Idle loops and halts run until the target at once.
+  adc_8080_cpu *cpu = &processor->cpu;
+  if (cpu->total_cycles < cycles_target) {
+    int budget = (int)(cycles_target - cpu->total_cycles);
+#if defined(SPINVADERS_AOT)
+    aot_run(cpu, budget);
+#elif defined(SPINVADERS_CALLBACK_CPU)
+    adc_8080_cpu_run(cpu, budget);
+#else
+    adc::I8080<InvadersBus>::run(cpu, budget);
+#endif
+  }
+}
+
+// Scheduler helpers implementation
+//
+
+static void schedule_event(Scheduler *scheduler, uint64_t cycles, EventHandler handler) {
+  assert(scheduler->count < SCHEDULER_MAX_EVENTS);
+
+  // Shift the later events up to keep them sorted, events due at the same
+  // cycle count run in the order they were scheduled.
+  int i = scheduler->count++;
+  for (; i > 0 && scheduler->events[i - 1].cycles <= cycles; i--) {
+    scheduler->events[i] = scheduler->events[i - 1];
+  }
+  scheduler->events[i].cycles = cycles;
+  scheduler->events[i].handler = handler;
 }
 
-const Texture *machine_get_display_texture() {
-  return &s_machine.display.texture;
+static void run_scheduled(Machine *machine, uint64_t cycles_target) {
+  Scheduler *scheduler = &machine->scheduler;
+  Processor *processor = &machine->processor;
+
+  // Run the cpu straight up to each event due before the target, so it is
+  // only stopped when there is something to handle. An instruction can run
+  // past the deadline, in which case the event is handled just after it.
+  while (scheduler->count > 0 &&
+         scheduler->events[scheduler->count - 1].cycles <= cycles_target) {
+    Event event = scheduler->events[scheduler->count - 1];
+    run_processor(processor, event.cycles);
+
+    // A breakpoint stops the cpu short, and the event stays due until it is
+    // resumed.
+    if (processor->cpu.break_hit && processor->cpu.total_cycles < event.cycles) {
+      return;
+    }
+    scheduler->count--;
+    event.handler(machine, event.cycles);
+  }
+  run_processor(processor, cycles_target);
 }
 
 // CPU handlers implementation
 //
 
 static uint8_t handle_memory_read(void *userdata, uint16_t addr) {
+  Machine *machine = (Machine *)userdata;
   if (addr > MEMORY_MIRROR_RAM_END) {
     adc_log_warn("Attempt to read beyond memory bounds!");
     return 0;
@@ -197,10 +797,11 @@ static uint8_t handle_memory_read(void *userdata, uint16_t addr) {
     addr -= 0x2000;
   }
 
-  return s_machine.memory[addr];
+  return machine->memory[addr];
 }
 
 static void handle_memory_write(void *userdata, uint16_t addr, uint8_t value) {
+  Machine *machine = (Machine *)userdata;
   if (addr > MEMORY_MIRROR_RAM_END) {
     adc_log_warn("Attempt to write beyond memory bounds!");
     return;
@@ -215,10 +816,12 @@ static void handle_memory_write(void *userdata, uint16_t addr, uint8_t value) {
     addr -= 0x2000;
   }
 
-  s_machine.memory[addr] = value;
+  machine->memory[addr] = value;
 }
 
 static uint8_t handle_device_read(void *userdata, uint8_t device) {
+  Machine *machine = (Machine *)userdata;
+
   // Read controls.
   //
 
@@ -226,7 +829,7 @@ static uint8_t handle_device_read(void *userdata, uint8_t device) {
     return 0x70; // 0b01110000;
   }
 
-  const InputState *input = s_machine.input;
+  const InputState *input = machine->input;
   if (device == 1) {
     uint8_t res = 0;
     res |= BUTTON_DOWN(input, BUTTON_INSERT_CREDIT) << 0;
@@ -237,28 +840,28 @@ static uint8_t handle_device_read(void *userdata, uint8_t device) {
     res |= BUTTON_DOWN(input, BUTTON_LEFT) << 5;
     res |= BUTTON_DOWN(input, BUTTON_RIGHT) << 6;
 
-    if (BUTTON_DOWN(input, BUTTON_INSERT_CREDIT) && !((s_machine.device1_last_read >> 0) & 1)) {
-      sound_play(SOUND_COIN_INSERTED);
+    if (BUTTON_DOWN(input, BUTTON_INSERT_CREDIT) && !((machine->device1_last_read >> 0) & 1)) {
+      machine->sound_events |= MACHINE_SOUND_COIN_INSERTED;
     }
 
-    s_machine.device1_last_read = res;
+    machine->device1_last_read = res;
     return res;
   }
   if (device == 2) {
     uint8_t res = 0;
-    res |= s_machine.dip_ships;
+    res |= machine->dip_ships;
     res |= BUTTON_DOWN(input, BUTTON_TILT) << 2;
-    res |= s_machine.dip_extra_ship << 3;
+    res |= machine->dip_extra_ship << 3;
     res |= BUTTON_DOWN(input, BUTTON_FIRE) << 4;
     res |= BUTTON_DOWN(input, BUTTON_LEFT) << 5;
     res |= BUTTON_DOWN(input, BUTTON_RIGHT) << 6;
-    res |= s_machine.dip_display_coin << 7;
+    res |= machine->dip_display_coin << 7;
     return res;
   }
 
   // Read the 8-bit result from the shift register.
   if (device == 3) {
-    ShiftRegister *shiftreg = &s_machine.shift_register;
+    ShiftRegister *shiftreg = &machine->shift_register;
     uint16_t shift_word = (uint16_t)((shiftreg->high << 8) | shiftreg->low);
     return (shift_word >> (8 - shiftreg->offset)) & 0xFF;
   }
@@ -267,10 +870,12 @@ static uint8_t handle_device_read(void *userdata, uint8_t device) {
 }
 
 static void handle_device_write(void *userdata, uint8_t device, uint8_t output) {
+  Machine *machine = (Machine *)userdata;
+
   // Write to shift register.
   //
 
-  ShiftRegister *shiftreg = &s_machine.shift_register;
+  ShiftRegister *shiftreg = &machine->shift_register;
   // Shift high into low, and the new value into high.
   if (device == 4) {
     shiftreg->low = shiftreg->high;
@@ -282,107 +887,105 @@ static void handle_device_write(void *userdata, uint8_t device, uint8_t output)
   }
 
   // Handle sounds.
-  // Play a sound if the bit flag is toggled to 1.
+  // Raise a sound event if the bit flag is toggled to 1.
   //
 
 #define on(v, b) (((v) & (1 << (b))) != 0)
 #define off(v, b) !on(v, b)
   else if (device == 3) {
-    uint8_t last_write = s_machine.device3_last_write;
+    uint8_t last_write = machine->device3_last_write;
     if (output != last_write) {
+      // The ufo loops until its bit is toggled back to 0, and only the latest
+      // of a start and stop in the same tick is kept.
       if (on(output, 0) && off(last_write, 0)) {
-        sound_play(SOUND_UFO, true);
+        machine->sound_events &= ~MACHINE_SOUND_UFO_STOP;
+        machine->sound_events |= MACHINE_SOUND_UFO_START;
       }
       if (off(output, 0) && on(last_write, 0)) {
-        sound_stop(SOUND_UFO);
+        machine->sound_events &= ~MACHINE_SOUND_UFO_START;
+        machine->sound_events |= MACHINE_SOUND_UFO_STOP;
       }
       if (on(output, 1) && off(last_write, 1)) {
-        sound_play(SOUND_FIRE);
+        machine->sound_events |= MACHINE_SOUND_FIRE;
       }
       if (on(output, 2) && off(last_write, 2)) {
-        sound_play(SOUND_EXPLOSION);
+        machine->sound_events |= MACHINE_SOUND_EXPLOSION;
       }
       if (on(output, 3) && off(last_write, 3)) {
-        sound_play(SOUND_INVADER_DIE);
+        machine->sound_events |= MACHINE_SOUND_INVADER_DIE;
       }
-      s_machine.device3_last_write = output;
+      machine->device3_last_write = output;
     }
   } else if (device == 5) {
-    uint8_t last_write = s_machine.device5_last_write;
+    uint8_t last_write = machine->device5_last_write;
     if (output != last_write) {
       if (on(output, 0) && off(last_write, 0)) {
-        sound_play(SOUND_FLEET_MOVE_1);
+        machine->sound_events |= MACHINE_SOUND_FLEET_MOVE_1;
       }
       if (on(output, 1) && off(last_write, 1)) {
-        sound_play(SOUND_FLEET_MOVE_2);
+        machine->sound_events |= MACHINE_SOUND_FLEET_MOVE_2;
       }
       if (on(output, 2) && off(last_write, 2)) {
-        sound_play(SOUND_FLEET_MOVE_3);
+        machine->sound_events |= MACHINE_SOUND_FLEET_MOVE_3;
       }
       if (on(output, 3) && off(last_write, 3)) {
-        sound_play(SOUND_FLEET_MOVE_4);
+        machine->sound_events |= MACHINE_SOUND_FLEET_MOVE_4;
       }
       if (on(output, 4) && off(last_write, 4)) {
-        sound_play(SOUND_UFO_HIT);
+        machine->sound_events |= MACHINE_SOUND_UFO_HIT;
       }
-      s_machine.device5_last_write = output;
+      machine->device5_last_write = output;
     }
   }
 #undef on
 #undef off
 }
 
-static void handle_vsync() {
-  uint8_t *vram = &s_machine.memory[MEMORY_VIDEO_RAM_START];
-  Display *display = &s_machine.display;
-  uint32_t *pixels = display->pixels;
-  int w = display->width;
-  int h = display->height;
-
-  // Update the pixels with vram framebuffer.
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x += 8) {
-      unsigned int idx = y * w + x;
-      uint8_t dispbit = vram[idx >> 3];
-      for (int i = 0; i < 8; i++) {
-        if (dispbit & (0x80 >> i)) {
-          pixels[idx + (7 - i)] = 0xFFFFFFFF;
-        } else {
-          pixels[idx + (7 - i)] = 0;
-        }
-      }
-    }
-  }
+// Send the mid screen interrupt (RST 1) and the end of screen interrupt (RST 2)
+// every tick, latching the frame at the end of the screen.
+static void handle_vblank_start(Machine *machine, uint64_t cycles) {
+  adc_8080_cpu_interrupt(&machine->processor.cpu, 0xCF);
+  schedule_event(&machine->scheduler, cycles + CYCLES_PER_TICK, handle_vblank_start);
+}
+
+static void handle_vblank_end(Machine *machine, uint64_t cycles) {
+  adc_8080_cpu_interrupt(&machine->processor.cpu, 0xD7);
+  handle_vsync(machine);
+  schedule_event(&machine->scheduler, cycles + CYCLES_PER_TICK, handle_vblank_end);
+}
 
-  // Update the texture with new pixels.
-  renderer_update_texture(&display->texture, pixels);
+static void handle_vsync(Machine *machine) {
+  // Latch the vram framebuffer, which is in the frame layout already.
+  Display *display = &machine->display;
+  memcpy(display->frame, &machine->memory[MEMORY_VIDEO_RAM_START], MACHINE_FRAME_SIZE);
+  display->frame_count++;
 }
 
 // Rom helpers implementation
 //
 
-static int load_roms() {
+static int load_roms(Machine *machine) {
   // Load the space invaders roms into the correct parts of memory.
   // invaders.h 0x0000 - 0x07FF
   // invaders.g 0x0800 - 0x0FFF
   // invaders.f 0x1000 - 0x17FF
   // invaders.e 0x1800 - 0x1FFF
-  if (load_rom("data/invaders.h", 0x0000) != 0) {
+  if (load_rom(machine, "data/invaders.h", 0x0000) != 0) {
     return -1;
   }
-  if (load_rom("data/invaders.g", 0x0800) != 0) {
+  if (load_rom(machine, "data/invaders.g", 0x0800) != 0) {
     return -1;
   }
-  if (load_rom("data/invaders.f", 0x1000) != 0) {
+  if (load_rom(machine, "data/invaders.f", 0x1000) != 0) {
     return -1;
   }
-  if (load_rom("data/invaders.e", 0x1800) != 0) {
+  if (load_rom(machine, "data/invaders.e", 0x1800) != 0) {
     return -1;
   }
   return 0;
 }
 
-static int load_rom(const char *filepath, uint16_t addr) {
+static int load_rom(Machine *machine, const char *filepath, uint16_t addr) {
   assert(filepath);
   assert(addr < MEMORY_SIZE);
 
@@ -403,7 +1006,7 @@ static int load_rom(const char *filepath, uint16_t addr) {
     return -1;
   }
 
-  size_t bytes_read = fread(s_machine.memory + addr, 1, size, file);
+  size_t bytes_read = fread(machine->memory + addr, 1, size, file);
   if (bytes_read != size) {
     fprintf(stderr,
             "Failed to read the rom file into memory! Read %zu "
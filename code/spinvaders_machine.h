@@ -1,19 +1,174 @@
 #ifndef _SPINVADERS_MACHINE_H_
 #define _SPINVADERS_MACHINE_H_
 
-struct InputState;
-struct Texture;
+#include "lib/adc_8080_cpu.h"
 
-int machine_setup();
+// Space Invaders emulation core: the cpu, memory, shift register and devices.
+// It has no dependencies on SDL, OpenGL or audio, and builds on its own as
+// libspinvaders_core (make core) to run headless, e.g. on a server. The frames
+// and sound events are handed to the caller, which draws and plays them.
+//
+// The core logs through adc_log.h, whose implementation is compiled into
+// spinvaders_log.cpp.
 
-void machine_shutdown();
+enum Button
+{
+  BUTTON_LEFT = 0,
+  BUTTON_RIGHT,
+  BUTTON_FIRE,
+  BUTTON_START_1P,
+  BUTTON_START_2P,
+  BUTTON_INSERT_CREDIT,
+  BUTTON_TILT
+};
 
-void machine_tick(const InputState *input);
+#define BUTTON_DOWN(input, btn) (((input)->buttons >> (btn)) & 1)
 
-bool machine_paused();
+struct InputState {
+  uint32_t buttons;
+};
 
-void machine_set_pause(bool pause);
+// The display is 256x224 pixels, mounted rotated by 90 degrees
+// in the cabinet. The frame is held as 1 bit per pixel, a row of 32 bytes per
+// line with the lowest bit of each byte the leftmost pixel.
+#define MACHINE_DISPLAY_WIDTH 256
+#define MACHINE_DISPLAY_HEIGHT 224
+#define MACHINE_FRAME_SIZE (MACHINE_DISPLAY_WIDTH * MACHINE_DISPLAY_HEIGHT / 8)
 
-const Texture *machine_get_display_texture();
+// Sound events reported by machine_sound_events(). The ufo sound loops from
+// MACHINE_SOUND_UFO_START until MACHINE_SOUND_UFO_STOP, the others play once.
+enum MachineSound
+{
+  MACHINE_SOUND_UFO_START = 1 << 0,
+  MACHINE_SOUND_UFO_STOP = 1 << 1,
+  MACHINE_SOUND_UFO_HIT = 1 << 2,
+  MACHINE_SOUND_FIRE = 1 << 3,
+  MACHINE_SOUND_EXPLOSION = 1 << 4,
+  MACHINE_SOUND_INVADER_DIE = 1 << 5,
+  MACHINE_SOUND_FLEET_MOVE_1 = 1 << 6,
+  MACHINE_SOUND_FLEET_MOVE_2 = 1 << 7,
+  MACHINE_SOUND_FLEET_MOVE_3 = 1 << 8,
+  MACHINE_SOUND_FLEET_MOVE_4 = 1 << 9,
+  MACHINE_SOUND_COIN_INSERTED = 1 << 10
+};
+
+// Snapshot of everything a machine needs to carry on from where it was saved:
+// the cpu, ram, devices, dip switches, scheduled events and the latched frame.
+// It has a fixed layout and holds no pointers, so it can be copied, compared or
+// written out as plain memory, and is loaded by machines of the same version.
+#define MACHINE_STATE_MAGIC 0x53535653 // "SVSS"
+#define MACHINE_STATE_VERSION 1
+#define MACHINE_STATE_MAX_EVENTS 8
+#define MACHINE_RAM_SIZE 0x2000
+
+struct MachineState {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t event_count;
+  uint32_t size;
+  uint32_t frame_count;
+
+  // Cpu registers, flags in the PUSH PSW layout, and interrupt state.
+  uint64_t total_cycles;
+  uint16_t pc, sp;
+  uint8_t ra, rb, rc, rd, re, rh, rl, psw;
+  uint8_t halted, inte, interrupt_pending, interrupt_opcode, interrupt_delay;
+
+  // Shift register and the port latches.
+  uint8_t shift_low, shift_high, shift_offset;
+  uint8_t device1_last_read, device3_last_write, device5_last_write;
+
+  // Dip switch settings.
+  uint8_t dip_ships, dip_extra_ship, dip_display_coin;
+
+  // Scheduler position: the end of the current tick and the pending events,
+  // each by the cycle count it is due at and an id for its handler.
+  uint8_t event_ids[MACHINE_STATE_MAX_EVENTS];
+  uint8_t padding[6];
+  uint64_t tick_end;
+  uint64_t event_cycles[MACHINE_STATE_MAX_EVENTS];
+
+  // Work ram and video ram, and the latched frame.
+  uint8_t ram[MACHINE_RAM_SIZE];
+  uint8_t frame[MACHINE_FRAME_SIZE];
+};
+
+// A Space Invaders machine. Machines are independent of each other and can run
+// on separate threads.
+struct Machine;
+
+// Returns a new machine with the roms loaded, or NULL on failure.
+Machine *machine_create();
+
+void machine_destroy(Machine *machine);
+
+// Runs the machine for a frame (1/60th of a second) with the given input.
+void machine_tick(Machine *machine, const InputState *input);
+
+bool machine_paused(Machine *machine);
+
+void machine_set_pause(Machine *machine, bool pause);
+
+bool machine_jit_available(Machine *machine);
+
+bool machine_jit_enabled(Machine *machine);
+
+void machine_set_jit(Machine *machine, bool enable);
+
+bool machine_profile_available(Machine *machine);
+
+int machine_profile_hot_spots(Machine *machine, adc_8080_cpu_hot_spot *hot_spots, int max);
+
+uint64_t machine_profile_cycles(Machine *machine);
+
+void machine_reset_profile(Machine *machine);
+
+int machine_write_profile(Machine *machine, const char *filepath);
+
+bool machine_trace_available(Machine *machine);
+
+int machine_write_trace(Machine *machine, const char *filepath);
+
+bool machine_coverage_available(Machine *machine);
+
+int machine_coverage_addresses(Machine *machine);
+
+void machine_reset_coverage(Machine *machine);
+
+int machine_write_coverage(Machine *machine, const char *filepath);
+
+int machine_add_breakpoint(Machine *machine, uint16_t addr, uint16_t size, int flags);
+
+void machine_remove_breakpoint(Machine *machine, int index);
+
+const adc_8080_cpu_breakpoints *machine_breakpoints(Machine *machine);
+
+bool machine_break_hit(Machine *machine);
+
+// Returns the frame latched at the end of the latest screen, MACHINE_FRAME_SIZE
+// bytes in the layout described above.
+const uint8_t *machine_frame(Machine *machine);
+
+// Returns the number of frames latched so far, which changes whenever
+// machine_frame() does.
+uint32_t machine_frame_count(Machine *machine);
+
+// Expands the latest frame into MACHINE_DISPLAY_WIDTH * MACHINE_DISPLAY_HEIGHT
+// pixels, 0xFFFFFFFF where lit and 0 where not.
+void machine_frame_pixels(Machine *machine, uint32_t *pixels);
+
+// Returns the MachineSound events raised during the latest machine_tick().
+uint32_t machine_sound_events(Machine *machine);
+
+// Returns the player one score, as shown on screen.
+int machine_score(Machine *machine);
+
+// Writes the state of the machine between ticks into state.
+void machine_save_state(Machine *machine, MachineState *state);
+
+// Restores the machine to a state saved by machine_save_state(), dropping any
+// breakpoint hit and the pause it caused. Returns 0 on success, -1 if the
+// state is from another version or is invalid.
+int machine_load_state(Machine *machine, const MachineState *state);
 
 #endif // _SPINVADERS_MACHINE_H_
@@ -35,6 +35,8 @@ set src_files=..\code\lib\glad\src\glad.cpp^
               ..\code\opengl_spinvaders_shaders.cpp^
               ..\code\opengl_spinvaders_renderer.cpp^
               ..\code\spinvaders_effects.cpp^
+              ..\code\spinvaders_aot.cpp^
+              ..\code\spinvaders_log.cpp^
               ..\code\spinvaders_machine.cpp^
               ..\code\spinvaders_imgui.cpp^
               ..\code\spinvaders.cpp^
@@ -0,0 +1,287 @@
+// Conformance and throughput harness running CP/M 8080 test programs.
+//
+// Usage: cpm_test [-m step|run|jit] <program.com>...
+//
+// Runs each program (e.g. TST8080.COM, 8080PRE.COM, CPUTEST.COM and
+// 8080EXM.COM) headlessly on the C api core and prints its output. Only the
+// BDOS console calls the test programs use are provided, through a device
+// write trapped at the BDOS entry point. A program fails if it prints an error
+// or doesn't return to CP/M.
+//
+// Each program is first stepped an instruction at a time, which counts the
+// instructions it runs. With -m run (the default) or -m jit it is then run
+// again with adc_8080_cpu_run() and the block cache, without or with the jit,
+// and must print exactly the same output. The instructions per second and
+// emulated MHz are reported for the last run.
+
+#include "lib/adc_8080_cpu.h"
+
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMORY_SIZE 0x10000
+#define PROGRAM_START 0x0100
+#define BDOS_ADDR 0x0005
+#define BDOS_DEVICE 0x00
+
+// Cycles run between checks for the end of the program, and the most cycles a
+// program can run before it is considered stuck.
+#define RUN_BUDGET 1000000
+#define MAX_CYCLES UINT64_C(100000000000)
+
+#define OUTPUT_SIZE (256 * 1024)
+#define JIT_CODE_SIZE (1024 * 1024)
+
+enum Mode { MODE_STEP, MODE_RUN, MODE_JIT };
+
+struct Output {
+  char text[OUTPUT_SIZE];
+  int length;
+  bool echo;
+  // Set when the program made a BDOS call the harness can't complete, which
+  // fails it.
+  bool failed;
+};
+
+struct Result {
+  bool finished;
+  uint64_t instructions;
+  uint64_t cycles;
+  double seconds;
+};
+
+static uint8_t s_memory[MEMORY_SIZE];
+static uint8_t s_program[MEMORY_SIZE - PROGRAM_START];
+static int s_program_size;
+static Output s_output;
+
+static void output_char(char c) {
+  if (s_output.length < OUTPUT_SIZE - 1) {
+    s_output.text[s_output.length++] = c;
+    s_output.text[s_output.length] = '\0';
+  }
+  if (s_output.echo) {
+    putchar(c);
+  }
+}
+
+// CPU handlers
+//
+
+static uint8_t handle_memory_read(void *userdata, uint16_t addr) {
+  (void)userdata;
+  return s_memory[addr];
+}
+
+static void handle_memory_write(void *userdata, uint16_t addr, uint8_t val) {
+  (void)userdata;
+  s_memory[addr] = val;
+}
+
+static uint8_t handle_device_read(void *userdata, uint8_t device) {
+  (void)userdata;
+  (void)device;
+  return 0x00;
+}
+
+// The BDOS entry point writes to BDOS_DEVICE, and the function in register C
+// is run here before returning to the program. The cpu is the userdata, set
+// up in run_program(), so its registers can be read.
+static void handle_device_write(void *userdata, uint8_t device, uint8_t val) {
+  (void)val;
+  adc_8080_cpu *cpu = (adc_8080_cpu *)userdata;
+  if (device != BDOS_DEVICE) {
+    return;
+  }
+
+  switch (cpu->rc) {
+  case 0: // System reset
+    cpu->halted = true;
+    break;
+  case 2: // Console output
+    output_char((char)cpu->re);
+    break;
+  case 9: { // Print string
+    uint16_t addr = (cpu->rd << 8) | cpu->re;
+    int length = 0;
+    while (length < MEMORY_SIZE && s_memory[(uint16_t)(addr + length)] != '$') {
+      length++;
+    }
+    // A string without a terminator ends the program instead of wrapping
+    // around memory forever.
+    if (length == MEMORY_SIZE) {
+      fprintf(stderr, "Print string at 0x%04X has no '$' terminator\n", addr);
+      s_output.failed = true;
+      cpu->halted = true;
+      break;
+    }
+    for (int i = 0; i < length; i++) {
+      output_char((char)s_memory[(uint16_t)(addr + i)]);
+    }
+    break;
+  }
+  default:
+    fprintf(stderr, "Unsupported BDOS function %d\n", cpu->rc);
+    break;
+  }
+}
+
+// Harness helpers
+//
+
+static int load_program(const char *filepath) {
+  FILE *file = fopen(filepath, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to fopen() the program at %s!\n", filepath);
+    return -1;
+  }
+
+  s_program_size = (int)fread(s_program, 1, sizeof(s_program), file);
+  bool at_end = fgetc(file) == EOF;
+  fclose(file);
+  if (s_program_size == 0 || !at_end) {
+    fprintf(stderr, "Program %s is empty or too large!\n", filepath);
+    return -1;
+  }
+  return 0;
+}
+
+// Reset the memory to the program and a minimal CP/M: a HLT at the warm boot
+// address and the BDOS trap.
+static void reset_memory() {
+  memset(s_memory, 0, sizeof(s_memory));
+  memcpy(s_memory + PROGRAM_START, s_program, s_program_size);
+  s_memory[0x0000] = 0x76; // HLT
+  s_memory[BDOS_ADDR + 0] = 0xD3; // OUT BDOS_DEVICE
+  s_memory[BDOS_ADDR + 1] = BDOS_DEVICE;
+  s_memory[BDOS_ADDR + 2] = 0xC9; // RET
+}
+
+static Result run_program(Mode mode) {
+  reset_memory();
+  s_output.length = 0;
+  s_output.text[0] = '\0';
+  s_output.failed = false;
+
+  adc_8080_cpu cpu;
+  adc_8080_cpu_init(&cpu);
+  // The BDOS handler reads the registers, so the cpu is its own userdata.
+  cpu.userdata = &cpu;
+  cpu.read_byte = handle_memory_read;
+  cpu.write_byte = handle_memory_write;
+  cpu.read_device = handle_device_read;
+  cpu.write_device = handle_device_write;
+  cpu.pc = PROGRAM_START;
+
+  static adc_8080_cpu_block_cache block_cache;
+  adc_8080_cpu_jit *jit = NULL;
+  if (mode != MODE_STEP) {
+    adc_8080_cpu_map_memory(&cpu, 0x0000, MEMORY_SIZE, s_memory,
+                            ADC_8080_CPU_MAP_READ | ADC_8080_CPU_MAP_WRITE);
+    adc_8080_cpu_set_block_cache(&cpu, &block_cache);
+  }
+  if (mode == MODE_JIT) {
+    jit = adc_8080_cpu_jit_create(JIT_CODE_SIZE, 0);
+    if (!jit) {
+      fprintf(stderr, "The cpu jit is not available on this platform\n");
+    }
+    adc_8080_cpu_set_jit(&cpu, jit);
+  }
+
+  Result result = {};
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  while (!cpu.halted && cpu.total_cycles < MAX_CYCLES) {
+    if (mode == MODE_STEP) {
+      adc_8080_cpu_step(&cpu);
+      result.instructions++;
+    } else {
+      adc_8080_cpu_run(&cpu, RUN_BUDGET);
+    }
+  }
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  result.cycles = cpu.total_cycles;
+
+  // Both a system reset and a jump to the warm boot address end the program.
+  result.finished = cpu.halted;
+
+  adc_8080_cpu_set_jit(&cpu, NULL);
+  adc_8080_cpu_jit_destroy(jit);
+  return result;
+}
+
+static bool output_has_error(const char *text) {
+  return strstr(text, "ERROR") || strstr(text, "FAIL") || strstr(text, "Error") ||
+         strstr(text, "fail");
+}
+
+// Returns true if the program passes.
+static bool test_program(const char *filepath, Mode mode) {
+  printf("==== %s\n", filepath);
+  if (load_program(filepath) != 0) {
+    return false;
+  }
+
+  s_output.echo = true;
+  Result result = run_program(MODE_STEP);
+  s_output.echo = false;
+  bool passed = result.finished && !s_output.failed && !output_has_error(s_output.text);
+  if (!result.finished) {
+    printf("\nDid not finish within %" PRIu64 " cycles\n", MAX_CYCLES);
+  }
+
+  uint64_t instructions = result.instructions;
+  if (mode != MODE_STEP) {
+    static char step_output[OUTPUT_SIZE];
+    memcpy(step_output, s_output.text, s_output.length + 1);
+    result = run_program(mode);
+    if (s_output.failed) {
+      passed = false;
+    } else if (!result.finished || strcmp(step_output, s_output.text) != 0) {
+      printf("\nOutput with -m %s differs from stepping:\n%s\n", mode == MODE_JIT ? "jit" : "run",
+             s_output.text);
+      passed = false;
+    }
+  }
+
+  double seconds = result.seconds > 0.0 ? result.seconds : 1e-9;
+  printf("\n%s: %" PRIu64 " instructions, %" PRIu64 " cycles in %.3f s (%.1f MIPS, %.1f MHz)\n",
+         passed ? "PASS" : "FAIL", instructions, result.cycles, result.seconds,
+         instructions / seconds / 1e6, result.cycles / seconds / 1e6);
+  return passed;
+}
+
+int main(int argc, char *argv[]) {
+  Mode mode = MODE_RUN;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-m") == 0) {
+    if (strcmp(argv[2], "step") == 0) {
+      mode = MODE_STEP;
+    } else if (strcmp(argv[2], "run") == 0) {
+      mode = MODE_RUN;
+    } else if (strcmp(argv[2], "jit") == 0) {
+      mode = MODE_JIT;
+    } else {
+      first = argc;
+    }
+    first += 2;
+  }
+  if (first >= argc) {
+    fprintf(stderr, "Usage: %s [-m step|run|jit] <program.com>...\n", argv[0]);
+    return 1;
+  }
+
+  int failed = 0;
+  for (int i = first; i < argc; i++) {
+    if (!test_program(argv[i], mode)) {
+      failed++;
+    }
+  }
+
+  printf("==== %d of %d programs passed\n", argc - first - failed, argc - first);
+  return failed ? 1 : 0;
+}
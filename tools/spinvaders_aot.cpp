@@ -0,0 +1,474 @@
+// Ahead of time recompiler for the Space Invaders roms.
+//
+// Usage: spinvaders_aot [-a] <output.cpp> <invaders.h> <invaders.g> <invaders.f> <invaders.e>
+//
+// Finds the code reachable from the reset and restart vectors, and writes a
+// C++ translation unit with a function for each basic block found, along with
+// the aot_blocks table the machine looks them up in (see spinvaders_aot.h).
+// Blocks end at the same instructions as the cpu block cache, and before an
+// instruction starting in the next 1 KB page. Indirect jumps (PCHL, RET) end a
+// block with the pc set from the cpu state, and the machine falls back to the
+// interpreter if no block starts at the address they reach.
+//
+// With -a a block is written for every address in the roms instead, which is
+// only useful for testing the recompiled code against the interpreter.
+
+#include "lib/adc_8080_cpu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ROM_SIZE 0x0800
+#define ROM_COUNT 4
+#define CODE_SIZE (ROM_SIZE * ROM_COUNT)
+
+// The most instructions in a block. Longer than the block cache since the
+// roms are never modified.
+#define BLOCK_MAX_OPS 64
+
+struct Op {
+  uint8_t opcode;
+  uint8_t length;
+  uint16_t operand;
+};
+
+struct Block {
+  uint16_t pc;
+  uint16_t end_pc;
+  int cycles;
+  int last_cycles;
+  int count;
+  Op ops[BLOCK_MAX_OPS];
+};
+
+static uint8_t s_code[CODE_SIZE];
+
+// Registers by their encoding in opcodes, M has no register.
+static const char *s_regs[8] = {"cpu->rb", "cpu->rc", "cpu->rd", "cpu->re",
+                                "cpu->rh", "cpu->rl", NULL,      "cpu->ra"};
+
+// Register pairs by their encoding in opcodes, without SP.
+static const char *s_pair_high[3] = {"cpu->rb", "cpu->rd", "cpu->rh"};
+static const char *s_pair_low[3] = {"cpu->rc", "cpu->re", "cpu->rl"};
+
+// Conditions of the conditional jumps, calls and returns by their encoding.
+static const char *s_conds[8] = {"!adc::flag_z(cpu)", "adc::flag_z(cpu)",
+                                 "!adc::flag_c(cpu)", "adc::flag_c(cpu)",
+                                 "!adc::flag_p(cpu)", "adc::flag_p(cpu)",
+                                 "!adc::flag_s(cpu)", "adc::flag_s(cpu)"};
+
+// ALU helpers by their encoding (ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP).
+static const char *s_alu_ops[8] = {"op_add(cpu, %s, 0)",
+                                   "op_add(cpu, %s, adc::flag_c(cpu))",
+                                   "op_sub(cpu, %s, 0)",
+                                   "op_sub(cpu, %s, adc::flag_c(cpu))",
+                                   "op_ana(cpu, %s)",
+                                   "op_xra(cpu, %s)",
+                                   "op_ora(cpu, %s)",
+                                   "op_cmp(cpu, %s)"};
+
+static int load_rom(const char *filepath, uint8_t *dest) {
+  FILE *file = fopen(filepath, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to fopen() the rom file at %s!\n", filepath);
+    return -1;
+  }
+
+  size_t size = fread(dest, 1, ROM_SIZE, file);
+  bool at_end = fgetc(file) == EOF;
+  fclose(file);
+  if (size != ROM_SIZE || !at_end) {
+    fprintf(stderr, "Rom %s size is incorrect! Expected %d bytes\n", filepath, ROM_SIZE);
+    return -1;
+  }
+  return 0;
+}
+
+// Decode the block at pc. Returns false if its first instruction doesn't fit
+// in the roms.
+//
+// Every instruction of a block starts in the page of the first, so aot_run()
+// only has to check that page for breakpoints.
+static bool decode_block(uint16_t pc, Block *block) {
+  int offset = pc;
+  int page_end = (pc | (ADC_8080_CPU_PAGE_SIZE - 1)) + 1;
+  block->pc = pc;
+  block->cycles = 0;
+  block->last_cycles = 0;
+  block->count = 0;
+  while (block->count < BLOCK_MAX_OPS && offset < page_end) {
+    uint8_t opcode = s_code[offset];
+    int length = adc::s_length_lut[opcode];
+    if (offset + length > CODE_SIZE) {
+      break;
+    }
+
+    Op *op = &block->ops[block->count++];
+    op->opcode = opcode;
+    op->length = length;
+    op->operand = 0;
+    if (length == 2) {
+      op->operand = s_code[offset + 1];
+    } else if (length == 3) {
+      op->operand = (s_code[offset + 2] << 8) | s_code[offset + 1];
+    }
+
+    block->last_cycles = adc::s_cycles_lut[opcode];
+    block->cycles += block->last_cycles;
+    offset += length;
+    if (adc::ends_block(opcode)) {
+      break;
+    }
+  }
+  block->end_pc = offset;
+  return block->count > 0;
+}
+
+// Find every block reachable from the vectors, marking where they start.
+static void find_blocks(bool *starts) {
+  uint16_t worklist[CODE_SIZE];
+  int count = 0;
+
+  // The reset vector and the restarts, which the interrupts are sent as.
+  for (int vector = 0x00; vector <= 0x38; vector += 0x08) {
+    starts[vector] = true;
+    worklist[count++] = vector;
+  }
+
+  while (count > 0) {
+    Block block;
+    if (!decode_block(worklist[--count], &block)) {
+      continue;
+    }
+
+    // Where the last instruction can go. Calls and restarts return past
+    // themselves, and PCHL and RET can only be followed at runtime.
+    const Op *last = &block.ops[block.count - 1];
+    uint8_t opcode = last->opcode;
+    int targets[2] = {-1, -1};
+    if (opcode == 0xC3 || opcode == 0xCB) { // JMP
+      targets[0] = last->operand;
+    } else if (opcode == 0xC9 || opcode == 0xD9 || opcode == 0xE9) { // RET, PCHL
+    } else if ((opcode & 0xC7) == 0xC7) { // RST
+      targets[0] = opcode & 0x38;
+      targets[1] = block.end_pc;
+    } else if ((opcode & 0xC7) == 0xC2 || (opcode & 0xC7) == 0xC4 ||
+               (opcode & 0x0F) == 0x0D) { // Jcc, Ccc, CALL
+      targets[0] = last->operand;
+      targets[1] = block.end_pc;
+    } else {
+      targets[0] = block.end_pc;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      if (targets[i] >= 0 && targets[i] < CODE_SIZE && !starts[targets[i]]) {
+        starts[targets[i]] = true;
+        worklist[count++] = targets[i];
+      }
+    }
+  }
+}
+
+// Write the statements for a single instruction, in the same terms as the
+// opcode handlers of adc::I8080<Bus>.
+static void write_op(FILE *out, const Op *op) {
+  char src[128];
+  uint8_t opcode = op->opcode;
+  uint16_t operand = op->operand;
+  int dst = (opcode >> 3) & 7;
+  int reg = opcode & 7;
+  int rp = (opcode >> 4) & 3;
+  const char *hl = "AotCore::word_from_bytes(cpu->rh, cpu->rl)";
+
+  // MOV and HLT.
+  if (opcode >= 0x40 && opcode < 0x80) {
+    if (opcode == 0x76) {
+      fprintf(out, "  cpu->halted = true;\n");
+    } else if (dst == 6) {
+      fprintf(out, "  AotCore::write_byte(cpu, %s, %s);\n", hl, s_regs[reg]);
+    } else if (reg == 6) {
+      fprintf(out, "  %s = AotCore::read_byte(cpu, %s);\n", s_regs[dst], hl);
+    } else if (reg != dst) {
+      fprintf(out, "  %s = %s;\n", s_regs[dst], s_regs[reg]);
+    }
+    return;
+  }
+
+  // ALU ops on registers, memory and immediates.
+  if ((opcode >= 0x80 && opcode < 0xC0) || (opcode & 0xC7) == 0xC6) {
+    if (opcode >= 0xC0) {
+      snprintf(src, sizeof(src), "0x%02X", operand);
+    } else if (reg == 6) {
+      snprintf(src, sizeof(src), "AotCore::read_byte(cpu, %s)", hl);
+    } else {
+      snprintf(src, sizeof(src), "%s", s_regs[reg]);
+    }
+    fprintf(out, "  AotCore::");
+    fprintf(out, s_alu_ops[dst], src);
+    fprintf(out, ";\n");
+    return;
+  }
+
+  // INR, DCR and MVI.
+  if (opcode < 0x40 && (reg == 4 || reg == 5 || reg == 6)) {
+    const char *helper = reg == 4 ? "op_inr" : "op_dcr";
+    if (dst == 6 && reg == 6) {
+      fprintf(out, "  AotCore::write_byte(cpu, %s, 0x%02X);\n", hl, operand);
+    } else if (dst == 6) {
+      fprintf(out, "  AotCore::write_byte(cpu, %s, AotCore::%s(cpu, AotCore::read_byte(cpu, %s)));\n",
+              hl, helper, hl);
+    } else if (reg == 6) {
+      fprintf(out, "  %s = 0x%02X;\n", s_regs[dst], operand);
+    } else {
+      fprintf(out, "  %s = AotCore::%s(cpu, %s);\n", s_regs[dst], helper, s_regs[dst]);
+    }
+    return;
+  }
+
+  switch (opcode) {
+  case 0x00: // NOP
+  case 0x08: // *NOP
+  case 0x10: // *NOP
+  case 0x18: // *NOP
+  case 0x20: // *NOP
+  case 0x28: // *NOP
+  case 0x30: // *NOP
+  case 0x38: // *NOP
+    return;
+
+  case 0x01: // LXI B
+  case 0x11: // LXI D
+  case 0x21: // LXI H
+    fprintf(out, "  %s = 0x%02X;\n", s_pair_high[rp], operand >> 8);
+    fprintf(out, "  %s = 0x%02X;\n", s_pair_low[rp], operand & 0xFF);
+    return;
+  case 0x31: // LXI SP
+    fprintf(out, "  cpu->sp = 0x%04X;\n", operand);
+    return;
+
+  case 0x03: // INX B
+  case 0x13: // INX D
+  case 0x23: // INX H
+  case 0x0B: // DCX B
+  case 0x1B: // DCX D
+  case 0x2B: // DCX H
+    fprintf(out, "  AotCore::bytes_from_word(&%s, &%s, AotCore::word_from_bytes(%s, %s) %s 1);\n",
+            s_pair_high[rp], s_pair_low[rp], s_pair_high[rp], s_pair_low[rp],
+            (opcode & 0x08) ? "-" : "+");
+    return;
+  case 0x33: // INX SP
+    fprintf(out, "  cpu->sp++;\n");
+    return;
+  case 0x3B: // DCX SP
+    fprintf(out, "  cpu->sp--;\n");
+    return;
+
+  case 0x09: // DAD B
+  case 0x19: // DAD D
+  case 0x29: // DAD H
+    fprintf(out, "  AotCore::op_dad(cpu, AotCore::word_from_bytes(%s, %s));\n", s_pair_high[rp],
+            s_pair_low[rp]);
+    return;
+  case 0x39: // DAD SP
+    fprintf(out, "  AotCore::op_dad(cpu, cpu->sp);\n");
+    return;
+
+  case 0x02: // STAX B
+  case 0x12: // STAX D
+    fprintf(out, "  AotCore::write_byte(cpu, AotCore::word_from_bytes(%s, %s), cpu->ra);\n",
+            s_pair_high[rp], s_pair_low[rp]);
+    return;
+  case 0x0A: // LDAX B
+  case 0x1A: // LDAX D
+    fprintf(out, "  cpu->ra = AotCore::read_byte(cpu, AotCore::word_from_bytes(%s, %s));\n",
+            s_pair_high[rp], s_pair_low[rp]);
+    return;
+  case 0x32: // STA
+    fprintf(out, "  AotCore::write_byte(cpu, 0x%04X, cpu->ra);\n", operand);
+    return;
+  case 0x3A: // LDA
+    fprintf(out, "  cpu->ra = AotCore::read_byte(cpu, 0x%04X);\n", operand);
+    return;
+  case 0x22: // SHLD
+    fprintf(out, "  AotCore::write_word(cpu, 0x%04X, %s);\n", operand, hl);
+    return;
+  case 0x2A: // LHLD
+    fprintf(out, "  AotCore::bytes_from_word(&cpu->rh, &cpu->rl, AotCore::read_word(cpu, 0x%04X));\n",
+            operand);
+    return;
+
+  case 0x07: // RLC
+    fprintf(out, "  AotCore::op_rlc(cpu);\n");
+    return;
+  case 0x0F: // RRC
+    fprintf(out, "  AotCore::op_rrc(cpu);\n");
+    return;
+  case 0x17: // RAL
+    fprintf(out, "  AotCore::op_ral(cpu);\n");
+    return;
+  case 0x1F: // RAR
+    fprintf(out, "  AotCore::op_rar(cpu);\n");
+    return;
+  case 0x27: // DAA
+    fprintf(out, "  AotCore::op_daa(cpu);\n");
+    return;
+  case 0x2F: // CMA
+    fprintf(out, "  cpu->ra = ~cpu->ra;\n");
+    return;
+  case 0x37: // STC
+    fprintf(out, "  cpu->psw |= adc::FLAG_C;\n");
+    return;
+  case 0x3F: // CMC
+    fprintf(out, "  cpu->psw ^= adc::FLAG_C;\n");
+    return;
+
+  case 0xC5: // PUSH B
+  case 0xD5: // PUSH D
+  case 0xE5: // PUSH H
+    fprintf(out, "  AotCore::stack_push(cpu, AotCore::word_from_bytes(%s, %s));\n",
+            s_pair_high[rp], s_pair_low[rp]);
+    return;
+  case 0xF5: // PUSH PSW
+    fprintf(out, "  AotCore::op_push_psw(cpu);\n");
+    return;
+  case 0xC1: // POP B
+  case 0xD1: // POP D
+  case 0xE1: // POP H
+    fprintf(out, "  AotCore::bytes_from_word(&%s, &%s, AotCore::stack_pop(cpu));\n",
+            s_pair_high[rp], s_pair_low[rp]);
+    return;
+  case 0xF1: // POP PSW
+    fprintf(out, "  AotCore::op_pop_psw(cpu);\n");
+    return;
+  case 0xEB: // XCHG
+    fprintf(out, "  AotCore::op_xchg(cpu);\n");
+    return;
+  case 0xE3: // XTHL
+    fprintf(out, "  AotCore::op_xthl(cpu);\n");
+    return;
+  case 0xF9: // SPHL
+    fprintf(out, "  cpu->sp = %s;\n", hl);
+    return;
+
+  case 0xE9: // PCHL
+    fprintf(out, "  cpu->pc = %s;\n", hl);
+    return;
+  case 0xC3: // JMP
+  case 0xCB: // *JMP
+    fprintf(out, "  cpu->pc = 0x%04X;\n", operand);
+    return;
+  case 0xCD: // CALL
+  case 0xDD: // *CALL
+  case 0xED: // *CALL
+  case 0xFD: // *CALL
+    fprintf(out, "  AotCore::op_call(cpu, 0x%04X);\n", operand);
+    return;
+  case 0xC9: // RET
+  case 0xD9: // *RET
+    fprintf(out, "  cpu->pc = AotCore::stack_pop(cpu);\n");
+    return;
+
+  case 0xFB: // EI
+    fprintf(out, "  cpu->inte = true;\n");
+    fprintf(out, "  cpu->interrupt_delay = true;\n");
+    return;
+  case 0xF3: // DI
+    fprintf(out, "  cpu->inte = false;\n");
+    return;
+  case 0xDB: // IN
+    fprintf(out, "  cpu->ra = adc::CallbackBus::in(cpu, 0x%02X);\n", operand);
+    return;
+  case 0xD3: // OUT
+    fprintf(out, "  adc::CallbackBus::out(cpu, 0x%02X, cpu->ra);\n", operand);
+    return;
+  }
+
+  switch (opcode & 0xC7) {
+  case 0xC2: // Jcc
+    fprintf(out, "  AotCore::op_jmp_cond(cpu, 0x%04X, %s);\n", operand, s_conds[dst]);
+    return;
+  case 0xC4: // Ccc
+    fprintf(out, "  cycles += AotCore::op_call_cond(cpu, 0x%04X, %s);\n", operand, s_conds[dst]);
+    return;
+  case 0xC0: // Rcc
+    fprintf(out, "  cycles += AotCore::op_ret_cond(cpu, %s);\n", s_conds[dst]);
+    return;
+  case 0xC7: // RST
+    fprintf(out, "  AotCore::op_call(cpu, 0x%02X);\n", opcode & 0x38);
+    return;
+  }
+}
+
+static void write_block(FILE *out, const Block *block) {
+  fprintf(out, "static int block_%04X(adc_8080_cpu *cpu) {\n", block->pc);
+  fprintf(out, "  int cycles = %d;\n", block->cycles);
+  fprintf(out, "  cpu->pc = 0x%04X;\n", block->end_pc & 0xFFFF);
+  for (int i = 0; i < block->count; i++) {
+    write_op(out, &block->ops[i]);
+  }
+  fprintf(out, "  return cycles;\n");
+  fprintf(out, "}\n\n");
+}
+
+static int write_translation_unit(FILE *out, const bool *starts) {
+  fprintf(out, "// Generated by tools/spinvaders_aot.cpp from the Space Invaders roms, do not\n");
+  fprintf(out, "// edit.\n\n");
+  fprintf(out, "#ifdef SPINVADERS_AOT\n\n");
+  fprintf(out, "#include \"spinvaders_aot.h\"\n\n");
+
+  int count = 0;
+  static Block blocks[CODE_SIZE];
+  for (int pc = 0; pc < CODE_SIZE; pc++) {
+    if (starts[pc] && decode_block(pc, &blocks[pc])) {
+      write_block(out, &blocks[pc]);
+      count++;
+    }
+  }
+
+  fprintf(out, "const AotBlock aot_blocks[AOT_ROM_SIZE] = {\n");
+  for (int pc = 0; pc < CODE_SIZE; pc++) {
+    if (starts[pc] && blocks[pc].count > 0) {
+      fprintf(out, "    {block_%04X, %d, %d},\n", pc, blocks[pc].cycles, blocks[pc].last_cycles);
+    } else {
+      fprintf(out, "    {NULL, 0, 0},\n");
+    }
+  }
+  fprintf(out, "};\n\n");
+  fprintf(out, "#endif // SPINVADERS_AOT\n");
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  bool all = argc > 1 && strcmp(argv[1], "-a") == 0;
+  if (argc != 2 + ROM_COUNT + all) {
+    fprintf(stderr, "Usage: %s [-a] <output.cpp> <invaders.h> <invaders.g> <invaders.f> "
+                    "<invaders.e>\n",
+            argv[0]);
+    return 1;
+  }
+
+  const char *output_path = argv[1 + all];
+  for (int i = 0; i < ROM_COUNT; i++) {
+    if (load_rom(argv[2 + all + i], s_code + i * ROM_SIZE) != 0) {
+      return 1;
+    }
+  }
+
+  static bool starts[CODE_SIZE];
+  if (all) {
+    memset(starts, 1, sizeof(starts));
+  } else {
+    find_blocks(starts);
+  }
+
+  FILE *out = fopen(output_path, "w");
+  if (!out) {
+    fprintf(stderr, "Failed to fopen() the output file at %s!\n", output_path);
+    return 1;
+  }
+  int count = write_translation_unit(out, starts);
+  fclose(out);
+
+  printf("Recompiled %d blocks into %s\n", count, output_path);
+  return 0;
+}
@@ -0,0 +1,305 @@
+// Headless runner and benchmark for libspinvaders_core.
+//
+// Usage: spinvaders_headless [-f <frames>] [-o <frame.pbm>] [-p]
+//        spinvaders_headless -n <machines> [-j <threads>] [-f <frames>]
+//
+// Runs a machine for the given number of frames (3600 by default, a minute of
+// the game) as fast as it can, with no display or sound device. A credit is
+// inserted and a one player game started after the attract mode, and the
+// player then fires and moves back and forth. Prints the frames per second,
+// the speed relative to real time, the sound events raised and a hash of the
+// final frame, which is the same on every run. With -o the final frame is
+// written upright as a pbm image.
+//
+// With -p, in a build with the profiler (make headless profile=1), the runs of
+// 2 and 3 instructions executed most are printed too, the candidates for
+// fusing into superinstructions.
+//
+// With -n the given number of machines are stepped together with env_step()
+// on -j threads (every hardware thread by default), all playing the same
+// script, and the aggregate frames per second and the total reward are
+// reported instead.
+//
+// Run from the root of the repository, where the roms are loaded from.
+
+#include "spinvaders_env.h"
+#include "spinvaders_machine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <inttypes.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define FRAMES_PER_SECOND 60
+
+// Instruction sequences printed for each length with -p.
+#define TOP_SEQUENCES 16
+
+// Frames the credit and start buttons are pressed at.
+#define CREDIT_FRAME 120
+#define START_FRAME 180
+
+static uint32_t scripted_buttons(int frame) {
+  if (frame >= CREDIT_FRAME && frame < CREDIT_FRAME + 4) {
+    return 1 << BUTTON_INSERT_CREDIT;
+  }
+  if (frame >= START_FRAME && frame < START_FRAME + 4) {
+    return 1 << BUTTON_START_1P;
+  }
+  if (frame < START_FRAME) {
+    return 0;
+  }
+
+  // Fire every half second, and move a second each way.
+  uint32_t buttons = (frame % 30) < 4 ? 1 << BUTTON_FIRE : 0;
+  buttons |= (frame / FRAMES_PER_SECOND) % 2 ? 1 << BUTTON_LEFT : 1 << BUTTON_RIGHT;
+  return buttons;
+}
+
+// FNV-1a
+static uint64_t hash_frame(const uint8_t *frame) {
+  uint64_t hash = UINT64_C(0xCBF29CE484222325);
+  for (int i = 0; i < MACHINE_FRAME_SIZE; i++) {
+    hash = (hash ^ frame[i]) * UINT64_C(0x100000001B3);
+  }
+  return hash;
+}
+
+// Writes the frame rotated upright, as it is seen in the cabinet.
+static int write_pbm(const uint8_t *frame, const char *filepath) {
+  FILE *file = fopen(filepath, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to fopen() the image at %s!\n", filepath);
+    return -1;
+  }
+
+  fprintf(file, "P4\n%d %d\n", MACHINE_DISPLAY_HEIGHT, MACHINE_DISPLAY_WIDTH);
+  uint8_t row[MACHINE_DISPLAY_HEIGHT / 8];
+  for (int r = 0; r < MACHINE_DISPLAY_WIDTH; r++) {
+    int x = MACHINE_DISPLAY_WIDTH - 1 - r;
+    memset(row, 0, sizeof(row));
+    for (int y = 0; y < MACHINE_DISPLAY_HEIGHT; y++) {
+      if ((frame[y * (MACHINE_DISPLAY_WIDTH / 8) + (x >> 3)] >> (x & 7)) & 1) {
+        row[y >> 3] |= 0x80 >> (y & 7);
+      }
+    }
+    fwrite(row, 1, sizeof(row), file);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+// Instruction sequences by their opcodes, packed into a key a byte each from
+// the first, and the times each ran.
+typedef std::map<uint32_t, uint64_t> SequenceCounts;
+
+static const char *sequence_name(uint32_t key, int length, char *buf, int size) {
+  int offset = 0;
+  for (int i = 0; i < length && offset < size; i++) {
+    char assembly[32];
+    adc_8080_cpu_disassemble((key >> (8 * i)) & 0xFF, 0, assembly, sizeof(assembly));
+    // Only the mnemonic and registers, without the operand.
+    char *operand = strchr(assembly, '$');
+    if (operand) {
+      *operand = '\0';
+    }
+    for (size_t n = strlen(assembly); n > 0 && strchr(" ,", assembly[n - 1]); n--) {
+      assembly[n - 1] = '\0';
+    }
+    offset += snprintf(buf + offset, size - offset, "%s%s", i ? "; " : "", assembly);
+  }
+  return buf;
+}
+
+// Counts the runs of length instructions from the profile of every address.
+// Only the last instruction of a run may end a block, so the whole run sits in
+// one block of the block cache. A run is counted as often as its least executed
+// instruction, which is exact unless code jumps into the middle of it.
+static void count_sequences(const adc_8080_cpu_hot_spot *hot_spots, int count,
+                            const uint64_t *pc_counts, const uint8_t *pc_opcodes, int length,
+                            SequenceCounts *sequences) {
+  for (int h = 0; h < count; h++) {
+    uint16_t pc = hot_spots[h].pc;
+    uint64_t times = hot_spots[h].count;
+    uint32_t key = 0;
+    int i = 0;
+    for (; i < length && pc_counts[pc]; i++) {
+      uint8_t opcode = pc_opcodes[pc];
+      if (i < length - 1 && adc::ends_block(opcode)) {
+        break;
+      }
+      key |= (uint32_t)opcode << (8 * i);
+      times = std::min(times, pc_counts[pc]);
+      pc += adc_8080_cpu_disassemble(opcode, 0, NULL, 0);
+    }
+    if (i == length) {
+      (*sequences)[key] += times;
+    }
+  }
+}
+
+static void print_sequences(Machine *machine) {
+  static adc_8080_cpu_hot_spot hot_spots[0x10000];
+  static uint64_t pc_counts[0x10000];
+  static uint8_t pc_opcodes[0x10000];
+  int count = machine_profile_hot_spots(machine, hot_spots, 0x10000);
+  uint64_t total = 0;
+  for (int i = 0; i < count; i++) {
+    pc_counts[hot_spots[i].pc] = hot_spots[i].count;
+    pc_opcodes[hot_spots[i].pc] = hot_spots[i].opcode;
+    total += hot_spots[i].count;
+  }
+  double scale = total ? 100.0 / total : 0.0;
+  printf("%" PRIu64 " instructions profiled\n", total);
+
+  for (int length = 2; length <= 3; length++) {
+    SequenceCounts sequences;
+    count_sequences(hot_spots, count, pc_counts, pc_opcodes, length, &sequences);
+
+    std::vector<std::pair<uint64_t, uint32_t>> sorted;
+    for (const auto &sequence : sequences) {
+      sorted.push_back(std::make_pair(sequence.second, sequence.first));
+    }
+    std::sort(sorted.rbegin(), sorted.rend());
+
+    printf("\nRuns of %d instructions  count  %% of instructions\n", length);
+    for (size_t i = 0; i < sorted.size() && i < TOP_SEQUENCES; i++) {
+      char name[128];
+      uint32_t key = sorted[i].second;
+      printf("  %-36s %12" PRIu64 "  %5.2f\n", sequence_name(key, length, name, sizeof(name)),
+             sorted[i].first, sorted[i].first * length * scale);
+    }
+  }
+}
+
+static int run_machine(int frames, const char *image_path, bool profile) {
+  Machine *machine = machine_create();
+  if (!machine) {
+    fprintf(stderr, "Failed to create the machine, run from the repository root!\n");
+    return 1;
+  }
+
+  uint64_t sound_events = 0;
+  InputState input = {};
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < frames; frame++) {
+    input.buttons = scripted_buttons(frame);
+    machine_tick(machine, &input);
+    uint32_t events = machine_sound_events(machine);
+    for (; events; events &= events - 1) {
+      sound_events++;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  seconds = seconds > 0.0 ? seconds : 1e-9;
+
+  const uint8_t *frame = machine_frame(machine);
+  printf("%d frames in %.3f s (%.0f fps, %.1fx real time)\n", frames, seconds, frames / seconds,
+         frames / seconds / FRAMES_PER_SECOND);
+  printf("%u frames latched, %" PRIu64 " sound events, final frame hash %016" PRIx64 "\n",
+         machine_frame_count(machine), sound_events, hash_frame(frame));
+
+  int result = 0;
+  if (image_path && write_pbm(frame, image_path) != 0) {
+    result = 1;
+  }
+  if (profile) {
+    if (machine_profile_available(machine)) {
+      print_sequences(machine);
+    } else {
+      fprintf(stderr, "The profiler isn't built in, build with make headless profile=1\n");
+      result = 1;
+    }
+  }
+
+  machine_destroy(machine);
+  return result;
+}
+
+static int run_batch(int frames, int count, int threads) {
+  EnvBatch *batch = env_create(count, threads);
+  if (!batch) {
+    fprintf(stderr, "Failed to create the env batch, run from the repository root!\n");
+    return 1;
+  }
+
+  InputState *actions = (InputState *)calloc(count, sizeof(InputState));
+  uint8_t *obs = (uint8_t *)malloc((size_t)count * MACHINE_FRAME_SIZE);
+  float *rewards = (float *)malloc(count * sizeof(float));
+  if (!actions || !obs || !rewards) {
+    fprintf(stderr, "Failed to malloc() the env buffers!\n");
+    free(actions);
+    free(obs);
+    free(rewards);
+    env_destroy(batch);
+    return 1;
+  }
+
+  double total_reward = 0.0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < frames; frame++) {
+    uint32_t buttons = scripted_buttons(frame);
+    for (int i = 0; i < count; i++) {
+      actions[i].buttons = buttons;
+    }
+    env_step(batch, actions, obs, rewards);
+    for (int i = 0; i < count; i++) {
+      total_reward += rewards[i];
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  seconds = seconds > 0.0 ? seconds : 1e-9;
+
+  double total_frames = (double)frames * count;
+  printf("%d machines x %d frames on %d threads in %.3f s (%.0f fps, %.0f fps per thread, "
+         "%.1fx real time per thread)\n",
+         count, frames, env_threads(batch), seconds, total_frames / seconds,
+         total_frames / seconds / env_threads(batch),
+         total_frames / seconds / env_threads(batch) / FRAMES_PER_SECOND);
+  printf("Total reward %.0f, machine 0 final frame hash %016" PRIx64 "\n", total_reward,
+         hash_frame(obs));
+
+  free(actions);
+  free(obs);
+  free(rewards);
+  env_destroy(batch);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int frames = 3600;
+  int count = 0;
+  int threads = 0;
+  const char *image_path = NULL;
+  bool profile = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      image_path = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      profile = true;
+    } else {
+      count = -1;
+      break;
+    }
+  }
+  if (count < 0 || (count == 0 && threads != 0) || (count > 0 && (image_path || profile))) {
+    fprintf(stderr,
+            "Usage: %s [-f <frames>] [-o <frame.pbm>] [-p]\n"
+            "       %s -n <machines> [-j <threads>] [-f <frames>]\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  return count > 0 ? run_batch(frames, count, threads) : run_machine(frames, image_path, profile);
+}
@@ -0,0 +1,104 @@
+// Decoder for the cpu traces written by adc_8080_cpu_write_trace().
+//
+// Usage: spinvaders_trace [-n <count>] <trace.bin>
+//
+// Prints each traced instruction as its cycle stamp, address, bytes and
+// assembly, followed by the registers and flags before it ran. With -n only
+// the latest count instructions are printed.
+
+#include "lib/adc_8080_cpu.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Records read from the file at a time.
+#define READ_BATCH 4096
+
+static void print_record(const adc_8080_cpu_trace_record *record) {
+  char assembly[32];
+  int length = adc_8080_cpu_disassemble(record->opcode, record->operand, assembly,
+                                        sizeof(assembly));
+
+  // Interrupts aren't fetched from memory, so have no address.
+  char bytes[16];
+  if (record->flags & ADC_8080_CPU_TRACE_INTERRUPT) {
+    snprintf(bytes, sizeof(bytes), "%02X int", record->opcode);
+  } else if (length == 3) {
+    snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->opcode, record->operand & 0xFF,
+             record->operand >> 8);
+  } else if (length == 2) {
+    snprintf(bytes, sizeof(bytes), "%02X %02X", record->opcode, record->operand);
+  } else {
+    snprintf(bytes, sizeof(bytes), "%02X", record->opcode);
+  }
+
+  uint8_t psw = record->psw;
+  printf("%12" PRIu64 "  %04X  %-8s  %-14s  A:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+         "SP:%04X %c%c%c%c%c%s\n",
+         record->cycles, record->pc, bytes, assembly, record->ra, record->rb, record->rc,
+         record->rd, record->re, record->rh, record->rl, record->sp, (psw & 0x80) ? 'S' : '-',
+         (psw & 0x40) ? 'Z' : '-', (psw & 0x10) ? 'A' : '-', (psw & 0x04) ? 'P' : '-',
+         (psw & 0x01) ? 'C' : '-', (record->flags & ADC_8080_CPU_TRACE_INTE) ? " EI" : "");
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t latest = 0;
+  const char *filepath = NULL;
+  if (argc == 2) {
+    filepath = argv[1];
+  } else if (argc == 4 && strcmp(argv[1], "-n") == 0) {
+    latest = strtoull(argv[2], NULL, 10);
+    filepath = argv[3];
+  } else {
+    fprintf(stderr, "Usage: %s [-n <count>] <trace.bin>\n", argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(filepath, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to fopen() the trace file at %s!\n", filepath);
+    return 1;
+  }
+
+  adc_8080_cpu_trace_file_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != ADC_8080_CPU_TRACE_MAGIC) {
+    fprintf(stderr, "%s is not a cpu trace!\n", filepath);
+    fclose(file);
+    return 1;
+  }
+  if (header.version != ADC_8080_CPU_TRACE_FILE_VERSION ||
+      header.record_size != sizeof(adc_8080_cpu_trace_record)) {
+    fprintf(stderr, "Trace %s has version %d, expected %d!\n", filepath, header.version,
+            ADC_8080_CPU_TRACE_FILE_VERSION);
+    fclose(file);
+    return 1;
+  }
+
+  uint64_t skip = latest && latest < header.count ? header.count - latest : 0;
+  if (skip && fseek(file, (long)(skip * sizeof(adc_8080_cpu_trace_record)), SEEK_CUR) != 0) {
+    fprintf(stderr, "Failed to seek in the trace file at %s!\n", filepath);
+    fclose(file);
+    return 1;
+  }
+
+  static adc_8080_cpu_trace_record records[READ_BATCH];
+  uint64_t remaining = header.count - skip;
+  while (remaining > 0) {
+    size_t batch = remaining < READ_BATCH ? (size_t)remaining : READ_BATCH;
+    size_t count = fread(records, sizeof(adc_8080_cpu_trace_record), batch, file);
+    for (size_t i = 0; i < count; i++) {
+      print_record(&records[i]);
+    }
+    if (count != batch) {
+      fprintf(stderr, "Trace %s is truncated!\n", filepath);
+      fclose(file);
+      return 1;
+    }
+    remaining -= count;
+  }
+
+  fclose(file);
+  return 0;
+}